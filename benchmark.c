@@ -0,0 +1,201 @@
+/* Benchmark for the copy and check value kernels used to build frames
+   and to take them from the receive buffer.  For each checksum and
+   block size, it times three ways to copy a block and work out its
+   check value:
+     loop   the byte-by-byte copy loop buildDataFrame used to have,
+            then CHK_update over the copy - two passes
+     memcpy memcpy, then CHK_update over the copy - two passes
+     fused  CHK_copy, which does both in one pass
+   and prints the speed of each in bytes per cycle of the processor's
+   time stamp counter (on x86), or bytes per ns (otherwise).  Each time
+   is the best of several tries, so other programs running make little
+   difference.  This shows where the link layer itself, not the line,
+   would limit the speed of a fast local link.
+
+   Usage: benchmark [options]
+     -b list    block sizes, e.g. 64,212,4096 (default 16,64,212,424,4096)
+     -k list    checksums, e.g. crc16,crc32 (default all)
+     -p         portable code only: no carry-less multiply for CRC-32
+
+   Build it with optimisation (e.g. -O2), with checksum.c.  */
+
+#define _POSIX_C_SOURCE 200809L  // needed for getopt
+
+#include <stdio.h>      // standard input-output library
+#include <stdlib.h>     // for strtol
+#include <string.h>     // for memcpy, strcspn
+#include <time.h>       // for timespec_get
+#include <unistd.h>     // for getopt
+#include "checksum.h"   // the check value kernels
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>  // for __rdtsc
+#define USE_TSC
+#define UNIT "B/cycle"
+#else
+#define UNIT "B/ns"
+#endif
+
+#define MAX_LIST 16     // most values in each list
+#define MAX_SIZE 65536  // largest block size
+#define TRIES 7         // times to repeat each measurement, keeping the best
+#define BATCH 400000    // bytes to process in each measurement
+
+// Ways to copy a block and work out its check value
+#define WAY_LOOP 0
+#define WAY_MEMCPY 1
+#define WAY_FUSED 2
+#define N_WAYS 3
+
+static byte_t src[MAX_SIZE];        // block to copy
+static byte_t dest[MAX_SIZE];       // where to copy it
+static volatile uint32_t sink;      // so the results are not optimised away
+
+// Function to read the clock: time stamp counter or ns
+static unsigned long long now(void)
+{
+#ifdef USE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Function to copy a block and work out its check value, in one of
+   the ways being compared.  Returns the check value.  */
+static uint32_t copyAndCheck(int way, int alg, int n)
+{
+    CHK_state check;
+    int i;
+
+    CHK_start(&check, alg);
+    switch (way)
+    {
+    case WAY_LOOP:
+        for (i = 0; i < n; i++)  // as buildDataFrame used to copy
+            dest[i] = src[i];
+        CHK_update(&check, dest, n);
+        break;
+    case WAY_MEMCPY:
+        memcpy(dest, src, n);
+        CHK_update(&check, dest, n);
+        break;
+    default:
+        CHK_copy(&check, dest, src, n);
+        break;
+    }
+    return CHK_finish(&check);
+}
+
+/* Function to measure one way of copying and checking blocks of one size.
+   Returns the speed, in bytes per cycle (or per ns).  */
+static double measure(int way, int alg, int n)
+{
+    int reps = BATCH / n + 1;   // blocks in each measurement
+    unsigned long long start, best = 0, time;
+    uint32_t result = 0;
+    int t, r;
+
+    for (t = 0; t < TRIES; t++)
+    {
+        start = now();
+        for (r = 0; r < reps; r++)
+        {
+            src[0] = (byte_t) r;  // so no two blocks are the same
+            result ^= copyAndCheck(way, alg, n);
+        }
+        time = now() - start;
+        if ((t == 0) || (time < best)) best = time;
+    }
+    sink = result;
+    return (best > 0) ? (double) reps * n / best : 0.0;
+}
+
+/* Function to read a list of numbers separated by commas.
+   Returns the number of values, or 0 if the list is not valid.  */
+static int readList(const char *text, int *values)
+{
+    int n = 0;
+    char *end;
+    do
+    {
+        if (n >= MAX_LIST) return 0;
+        values[n] = (int) strtol(text, &end, 10);
+        if ((end == text) || (values[n] <= 0) || (values[n] > MAX_SIZE)) return 0;
+        n++;
+        text = end + 1;
+    }
+    while (*end == ',');
+    return (*end == '\0') ? n : 0;
+}
+
+/* Function to read a list of checksum names separated by commas.
+   Returns the number of checksums, or 0 if the list is not valid.  */
+static int readChecksums(const char *text, int *algs)
+{
+    char name[16];  // one name from the list
+    int n = 0;
+    size_t len;
+    do
+    {
+        len = strcspn(text, ",");
+        if ((n >= MAX_LIST) || (len >= sizeof(name))) return 0;
+        memcpy(name, text, len);
+        name[len] = '\0';
+        algs[n] = CHK_parse(name);
+        if (algs[n] < 0) return 0;
+        n++;
+        text += len;
+    }
+    while (*text++ == ',');
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int sizes[MAX_LIST] = { 16, 64, 212, 424, 4096 };  // block sizes to use
+    int algs[MAX_LIST] = { CHK_SUM250, CHK_FLETCHER16, CHK_CRC16, CHK_CRC32 };
+    int nSizes = 5, nAlgs = 4;  // number of each
+    double speed[N_WAYS];       // speed of each way
+    int a, s, w, opt;
+    long i;
+
+    // Read the options
+    while ((opt = getopt(argc, argv, "b:k:p")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': nSizes = readList(optarg, sizes); break;
+            case 'k': nAlgs = readChecksums(optarg, algs); break;
+            case 'p': CHK_allowSimd(0); break;
+            default: nSizes = 0; break;
+        }
+    }
+    if ((nSizes == 0) || (nAlgs == 0) || (optind < argc))
+    {
+        printf("Usage: %s [-b sizes] [-k checks] [-p]\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < MAX_SIZE; i++)  // some data that is not all the same
+        src[i] = (byte_t)(i * 7 + (i >> 8));
+
+    printf("CRC-32 by %s, speeds in %s\n", CHK_engine(), UNIT);
+    printf("%-10s %6s %8s %8s %8s %7s\n",
+           "check", "block", "loop", "memcpy", "fused", "gain");
+    for (a = 0; a < nAlgs; a++)
+    {
+        for (s = 0; s < nSizes; s++)
+        {
+            for (w = 0; w < N_WAYS; w++)
+                speed[w] = measure(w, algs[a], sizes[s]);
+            printf("%-10s %6d %8.3f %8.3f %8.3f %6.2fx\n",
+                   CHK_name(algs[a]), sizes[s], speed[WAY_LOOP], speed[WAY_MEMCPY],
+                   speed[WAY_FUSED],
+                   (speed[WAY_LOOP] > 0.0) ? speed[WAY_FUSED] / speed[WAY_LOOP] : 0.0);
+        }
+    }
+    return 0;
+}
@@ -1,53 +1,425 @@
-/*functions to implement the checksum*/
+/*  Error detecting codes, for the trailer of each frame.
+       CHK_parse, CHK_name   convert between algorithms and names
+       CHK_size     gives the number of bytes in a check value
+       CHK_compute  works out the check value of some bytes
+       CHK_start, CHK_update, CHK_finish   do the same a few bytes at a time
+       CHK_copy     copies bytes and adds them to a check value, in one pass
+       CHK_write, CHK_read   put a check value into bytes, and back
+       CHK_allowSimd, CHK_engine   control and report the CRC-32 method
+       makeHCS, inspectHCS   the header check byte
+    See checksum.h for a description of the algorithms.  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include "checksum.h"  //this will give the function prototypes for this
-#include "linklayer.h" //I want to use #defines from here
+#include <string.h>     // for strcmp and memcpy
+#include "linklayer.h"  // for HCSPOS, FRAMEGOOD and FRAMEBAD
+#include "checksum.h"   // header file for functions in this file
 
-static int debug = 1; //Used for printing out the checksum values at each step
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>  // carry-less multiply and SSE functions
+#define USE_PCLMUL
+#elif defined(__SSE2__)
+#include <emmintrin.h>  // SSE2 functions
+#endif
 
-byte_t makeCHKSUM(byte_t *dataTX, int nDataTX, byte_t frameSize, byte_t seqnum)
+#define CRC32_POLY 0xEDB88320u  // CRC-32 polynomial, bits reversed
+#define CRC16_POLY 0x1021u      // CRC-16/CCITT polynomial
+#define FLETCHER_RUN 5802       // bytes that can be summed before the sums could overflow
+
+static const char *algNames[] = { "sum250", "fletcher16", "crc16", "crc32" };
+static const int algSizes[] = { 1, 2, 2, 4 };
+
+/* The tables are made the first time they are needed, in each thread,
+   so threads never share a half-made table.  The same is done for the
+   check of which instructions the processor has.  */
+static _Thread_local uint32_t crc32Table[8][256]; // slice-by-8 tables
+static _Thread_local uint16_t crc16Table[256];    // table for one byte at a time
+static _Thread_local int tablesMade = 0;          // TRUE once the tables are made
+static _Thread_local int simdAllowed = 1;         // FALSE to use only portable code
+static _Thread_local int havePclmul = 0;          // TRUE if the processor has PCLMULQDQ
+
+//===================================================================
+// Helper function to make the CRC tables, and check the processor.
+static void makeTables(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = (uint32_t) i;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        crc32Table[0][i] = c;
+
+        c = (uint32_t) i << 8;
+        for (k = 0; k < 8; k++)
+            c = (c & 0x8000) ? (c << 1) ^ CRC16_POLY : c << 1;
+        crc16Table[i] = (uint16_t) c;
+    }
+    // Each further table moves the effect of a byte on by one more byte
+    for (i = 0; i < 256; i++)
+        for (k = 1; k < 8; k++)
+            crc32Table[k][i] = (crc32Table[k - 1][i] >> 8)
+                               ^ crc32Table[0][crc32Table[k - 1][i] & 0xFF];
+#ifdef USE_PCLMUL
+    __builtin_cpu_init();
+    havePclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+    tablesMade = 1;
+}
+
+//===================================================================
+/* The helper functions below add bytes to a check value.  If dest is
+   not NULL, they also copy the bytes there, in the same pass, so each
+   byte is only read from memory once.  */
+
+// Helper function to read 4 bytes, least significant first.
+static uint32_t read32(const byte_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8)
+           | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Helper function to add bytes to a CRC-32, 8 bytes at a time.
+   The CRC is kept inverted, as it is while the bytes are added.  */
+static uint32_t crc32Slice8(uint32_t crc, byte_t *dest, const byte_t *p, int n)
+{
+    uint32_t one, two;  // the next 8 bytes, with the CRC in the first 4
+
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        one = read32(p) ^ crc;
+        two = read32(p + 4);
+        if (dest != NULL)
+        {
+            memcpy(dest, p, 8);
+            dest += 8;
+        }
+        crc = crc32Table[7][one & 0xFF] ^ crc32Table[6][(one >> 8) & 0xFF]
+              ^ crc32Table[5][(one >> 16) & 0xFF] ^ crc32Table[4][one >> 24]
+              ^ crc32Table[3][two & 0xFF] ^ crc32Table[2][(two >> 8) & 0xFF]
+              ^ crc32Table[1][(two >> 16) & 0xFF] ^ crc32Table[0][two >> 24];
+    }
+    for (; n > 0; p++, n--)
+    {
+        if (dest != NULL) *dest++ = *p;
+        crc = (crc >> 8) ^ crc32Table[0][(crc ^ *p) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef USE_PCLMUL
+// Helper function to load 16 bytes at an offset, and copy them if dest is not NULL
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i load16(byte_t *dest, const byte_t *p, int offset)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + offset));
+    if (dest != NULL) _mm_storeu_si128((__m128i *)(dest + offset), v);
+    return v;
+}
+
+/* Helper function to add bytes to a CRC-32 using carry-less multiply.
+   Four 16-byte lanes are folded forward by 64 bytes at a time, then
+   into one lane, and reduced to 32 bits (Barrett reduction).  The
+   constants are powers of x modulo the CRC polynomial, bits reversed.
+   Needs n >= 64, and a multiple of 16.  */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32Pclmul(uint32_t crc, byte_t *dest, const byte_t *p, int n)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, t1, t2, t3, t4;
+    int pos;  // position in the bytes
+
+    x1 = _mm_xor_si128(load16(dest, p, 0), _mm_cvtsi32_si128((int) crc));
+    x2 = load16(dest, p, 16);
+    x3 = load16(dest, p, 32);
+    x4 = load16(dest, p, 48);
+    for (pos = 64; pos + 64 <= n; pos += 64)
+    {
+        t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), t1);
+        x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), t2);
+        x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), t3);
+        x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), t4);
+        x1 = _mm_xor_si128(x1, load16(dest, p, pos));
+        x2 = _mm_xor_si128(x2, load16(dest, p, pos + 16));
+        x3 = _mm_xor_si128(x3, load16(dest, p, pos + 32));
+        x4 = _mm_xor_si128(x4, load16(dest, p, pos + 48));
+    }
+
+    // Fold the four lanes into one, then fold in any more 16-byte blocks
+    t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), t1);
+    t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), t1);
+    t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), t1);
+    for (; pos + 16 <= n; pos += 16)
+    {
+        t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11),
+                           _mm_xor_si128(load16(dest, p, pos), t1));
+    }
+
+    // Fold 128 bits to 64, then reduce to 32
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5k0, 0x00), x2);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+#endif
+
+/* Helper function to add bytes to a CRC-32: the bulk by PCLMUL if
+   possible, the rest by table.  The CRC is kept inverted.  */
+static uint32_t crc32(uint32_t crc, byte_t *dest, const byte_t *p, int n)
+{
+#ifdef USE_PCLMUL
+    int bulk = n & ~15;  // bytes in whole 16-byte blocks
+    if (havePclmul && simdAllowed && (bulk >= 64))
+    {
+        crc = crc32Pclmul(crc, dest, p, bulk);
+        p += bulk;
+        if (dest != NULL) dest += bulk;
+        n -= bulk;
+    }
+#endif
+    return crc32Slice8(crc, dest, p, n);
+}
+
+// Helper function to add bytes to a CRC-16/CCITT, one byte at a time
+static uint32_t crc16(uint32_t crc, byte_t *dest, const byte_t *p, int n)
+{
+    for (; n > 0; p++, n--)
+    {
+        if (dest != NULL) *dest++ = *p;
+        crc = ((crc << 8) & 0xFFFF) ^ crc16Table[(crc >> 8) ^ *p];
+    }
+    return crc;
+}
+
+/* Helper function to add bytes to Fletcher's sums.  They are only
+   reduced modulo 255 once every FLETCHER_RUN bytes, as late as possible.  */
+static void fletcher16(CHK_state *state, byte_t *dest, const byte_t *p, int n)
+{
+    uint32_t sum1 = state->value, sum2 = state->sum2;
+    int run;
+    while (n > 0)
+    {
+        run = (n < FLETCHER_RUN) ? n : FLETCHER_RUN;
+        for (n -= run; run > 0; run--)
+        {
+            if (dest != NULL) *dest++ = *p;
+            sum1 += *p++;
+            sum2 += sum1;
+        }
+        sum1 %= 255;
+        sum2 %= 255;
+    }
+    state->value = sum1;
+    state->sum2 = sum2;
+}
+
+/* Helper function to add bytes to the original check, a sum modulo 256.
+   With SSE2, 16 bytes at a time are added by _mm_sad_epu8.  */
+static uint32_t sum256(uint32_t sum, byte_t *dest, const byte_t *p, int n)
 {
-    //Construct the checksum to send
-    byte_t checksum = (frameSize + seqnum); // checksum starts with a value equal to the sequence number
-    for (int i = 0; i < nDataTX; i++)
+#ifdef __SSE2__
+    __m128i total = _mm_setzero_si128(), v;
+    for (; n >= 16; p += 16, n -= 16)
     {
-        // then we add every value from the data bits
-        checksum += dataTX[i];
+        v = _mm_loadu_si128((const __m128i *) p);
+        if (dest != NULL)
+        {
+            _mm_storeu_si128((__m128i *) dest, v);
+            dest += 16;
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(v, _mm_setzero_si128()));
     }
-    if (debug == 1)
+    sum += (uint32_t) _mm_cvtsi128_si32(total)
+           + (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+#endif
+    for (; n > 0; p++, n--)
     {
-        //if we are in debug, print this return value
-        printf("\nMADE CHECKSUM = %d\n", checksum % MODULO);
+        if (dest != NULL) *dest++ = *p;
+        sum += *p;
     }
+    return sum & 0xFF;
+}
+
+//===================================================================
+// Function to find an algorithm from its name.
+int CHK_parse(const char *name)
+{
+    int alg;
+    if (name == NULL) return -1;
+    for (alg = CHK_SUM250; alg <= CHK_CRC32; alg++)
+        if (strcmp(name, algNames[alg]) == 0) return alg;
+    return -1;
+}
+
+//===================================================================
+// Function to give the name of an algorithm.
+const char *CHK_name(int alg)
+{
+    if ((alg < CHK_SUM250) || (alg > CHK_CRC32)) return "unknown";
+    return algNames[alg];
+}
+
+//===================================================================
+// Function to give the number of bytes in the check value.
+int CHK_size(int alg)
+{
+    if ((alg < CHK_SUM250) || (alg > CHK_CRC32)) return 0;
+    return algSizes[alg];
+}
 
-    return (checksum % MODULO);
+//===================================================================
+// Function to work out the check value of some bytes.
+uint32_t CHK_compute(int alg, const byte_t *data, int n)
+{
+    CHK_state state;
+    CHK_start(&state, alg);
+    CHK_update(&state, data, n);
+    return CHK_finish(&state);
 }
-int inspectCHKSUM(byte_t *frameRX, int sizeFrame)
+
+//===================================================================
+// Function to set up the state for working out a check value.
+void CHK_start(CHK_state *state, int alg)
 {
-    // construct a new checksum and compare it with the value found in the recieved message
-    byte_t checksum = 0;
-    // we use bytes so that this checksum will never be larger than the 1 byte space allocated
-    for (int c = 1; c < sizeFrame - TRAILERSIZE; c++)
+    if (!tablesMade) makeTables();
+    state->alg = alg;
+    state->sum2 = 0;
+    switch (alg)
     {
-        //for each byte that is not the start bit, checksum or end bit
-        checksum += frameRX[c];
-        //add this to the checksum
+    case CHK_CRC16:
+        state->value = 0xFFFF;
+        break;
+    case CHK_CRC32:
+        state->value = 0xFFFFFFFFu;
+        break;
+    default:
+        state->value = 0;
+        break;
     }
-    if (debug == 1)
+}
+
+//===================================================================
+// Helper function to add some bytes to a check value, copying them if dest is not NULL.
+static void update(CHK_state *state, byte_t *dest, const byte_t *data, int n)
+{
+    switch (state->alg)
     {
-        printf("\nSOLVED CHECKSUM = %d\n", checksum % MODULO);
-        printf("\nFound CHECKSUM = %d\n", frameRX[sizeFrame - TRAILERSIZE]);
-        //print the two different checksums
+    case CHK_FLETCHER16:
+        fletcher16(state, dest, data, n);
+        break;
+    case CHK_CRC16:
+        state->value = crc16(state->value, dest, data, n);
+        break;
+    case CHK_CRC32:
+        state->value = crc32(state->value, dest, data, n);
+        break;
+    default:
+        state->value = sum256(state->value, dest, data, n);
+        break;
     }
-    if (frameRX[sizeFrame - TRAILERSIZE] != (checksum % MODULO)) //if they dont match therefore bad frame
+}
+
+//===================================================================
+// Function to add some bytes to a check value.
+void CHK_update(CHK_state *state, const byte_t *data, int n)
+{
+    update(state, NULL, data, n);
+}
+
+//===================================================================
+// Function to copy some bytes and add them to a check value.
+void CHK_copy(CHK_state *state, byte_t *dest, const byte_t *src, int n)
+{
+    update(state, dest, src, n);
+}
+
+//===================================================================
+// Function to give the check value of the bytes added so far.
+uint32_t CHK_finish(const CHK_state *state)
+{
+    switch (state->alg)
     {
-        return (FRAMEBAD);
+    case CHK_FLETCHER16:
+        return (state->sum2 << 8) | state->value;
+    case CHK_CRC32:
+        return ~state->value;
+    case CHK_CRC16:
+        return state->value;
+    default:
+        return state->value % 250;
     }
-    else
+}
+
+//===================================================================
+// Function to put a check value into bytes, most significant first.
+void CHK_write(int alg, uint32_t value, byte_t *dest)
+{
+    int i;
+    for (i = CHK_size(alg) - 1; i >= 0; i--)
     {
-        //otherwise good frame
-        return (FRAMEGOOD);
+        dest[i] = (byte_t)(value & 0xFF);
+        value >>= 8;
     }
 }
+
+//===================================================================
+// Function to get a check value from bytes, most significant first.
+uint32_t CHK_read(int alg, const byte_t *src)
+{
+    uint32_t value = 0;
+    int i;
+    for (i = 0; i < CHK_size(alg); i++)
+        value = (value << 8) | src[i];
+    return value;
+}
+
+//===================================================================
+// Function to allow or stop the use of SIMD instructions.
+void CHK_allowSimd(int allow)
+{
+    simdAllowed = allow;
+}
+
+//===================================================================
+// Function to give the name of the CRC-32 method in use.
+const char *CHK_engine(void)
+{
+    if (!tablesMade) makeTables();
+    return (havePclmul && simdAllowed) ? "pclmul" : "slice-by-8";
+}
+
+//===================================================================
+// Make the header check byte, from the bytes before it in the frame
+byte_t makeHCS(const byte_t *frame)
+{
+    byte_t crc = 0;
+    for (int c = 0; c < HCSPOS; c++)
+    {
+        crc ^= frame[c];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (byte_t)((crc << 1) ^ 0x07) : (byte_t)(crc << 1);
+    }
+    return crc;
+}
+
+// Check the header check byte of a received frame
+int inspectHCS(const byte_t *frame)
+{
+    return (frame[HCSPOS] == makeHCS(frame)) ? FRAMEGOOD : FRAMEBAD;
+}
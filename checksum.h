@@ -6,10 +6,100 @@ typedef unsigned char byte_t;  // define type "byte_t" for simplicity
 #ifndef CHECKSUM_H_INCLUDED
 #define CHECKSUM_H_INCLUDED
 
-#define MODULO 250    // define modulo value
+#include <stdint.h>  // for uint32_t
 
-int inspectCHKSUM(byte_t *frameRX, int sizeFrame);
-byte_t makeCHKSUM(byte_t *dataTX, int nDataTX, byte_t frameSize, byte_t seqnum);
-//fuction prototypes for the checksum
+/*  Error detecting codes, for the trailer of each frame.
+    The algorithm is chosen per link (see LL_options), and both ends
+    must use the same one.  Each gives a check value of a few bytes,
+    sent after the bytes it covers, most significant byte first.
+       CHK_SUM250     sum of the bytes, modulo 256 then modulo 250 -
+                      the original check, 1 byte, misses many errors
+       CHK_FLETCHER16 Fletcher's checksum, 2 bytes: a sum and a sum of
+                      sums, so it also sees bytes in the wrong order
+       CHK_CRC16      CRC-16/CCITT (polynomial 0x1021, start 0xFFFF),
+                      2 bytes, finds every burst of up to 16 bits
+       CHK_CRC32      CRC-32 as used by Ethernet, 4 bytes, finds every
+                      burst of up to 32 bits
+    The CRCs use tables, so they work on a byte (CRC-16) or 8 bytes
+    (CRC-32, "slice-by-8") at a time.  On an x86 processor that has
+    carry-less multiply (PCLMULQDQ), CRC-32 folds 64 bytes at a time
+    with it instead - this is checked when the program runs, so the
+    same program works on any processor.  */
+
+#define CHK_SUM250     0
+#define CHK_FLETCHER16 1
+#define CHK_CRC16      2
+#define CHK_CRC32      3
+
+#define CHK_MAXSIZE 4  // most bytes in a check value, for any algorithm
+
+/* The state of a check value while it is worked out, so the bytes can
+   be added a few at a time, as they arrive.  */
+typedef struct
+{
+    int alg;         // the algorithm
+    uint32_t value;  // the check so far (for a CRC, inverted if need be)
+    uint32_t sum2;   // second sum, for Fletcher's checksum
+} CHK_state;
+
+/* Function to find an algorithm from its name:
+   "sum250", "fletcher16", "crc16" or "crc32".
+   Returns the algorithm, or negative if the name is not known.  */
+int CHK_parse(const char *name);
+
+/* Function to give the name of an algorithm. */
+const char *CHK_name(int alg);
+
+/* Function to give the number of bytes in the check value. */
+int CHK_size(int alg);
+
+/* Function to work out the check value of some bytes.
+   Arguments: alg - the algorithm,
+              data - the bytes, n - the number of bytes.
+   Returns the check value.  */
+uint32_t CHK_compute(int alg, const byte_t *data, int n);
+
+/* Functions to work out a check value a few bytes at a time.
+   CHK_start sets up the state for an algorithm, CHK_update adds some
+   bytes, and CHK_finish gives the check value of all the bytes added
+   so far - the same as CHK_compute of them all.  More bytes can still
+   be added after CHK_finish.  */
+void CHK_start(CHK_state *state, int alg);
+void CHK_update(CHK_state *state, const byte_t *data, int n);
+uint32_t CHK_finish(const CHK_state *state);
+
+/* Function to copy bytes and add them to a check value, in one pass
+   over the bytes - quicker than copying them, then using CHK_update,
+   which reads them all twice.
+   Arguments: state - the check value so far,
+              dest - array for the copy, src - the bytes,
+              n - the number of bytes (dest and src must not overlap).  */
+void CHK_copy(CHK_state *state, byte_t *dest, const byte_t *src, int n);
+
+/* Function to put a check value into CHK_size(alg) bytes,
+   most significant first, e.g. in the trailer of a frame. */
+void CHK_write(int alg, uint32_t value, byte_t *dest);
+
+/* Function to get a check value from CHK_size(alg) bytes. */
+uint32_t CHK_read(int alg, const byte_t *src);
+
+/* Function to allow or stop the use of instructions that only some
+   processors have (carry-less multiply, for CRC-32), for example to
+   compare speeds.  They are allowed by default, and used if the
+   processor has them.  SSE2, which every x86-64 processor has, is
+   used whenever the compiler allows it.  */
+void CHK_allowSimd(int allow);
+
+/* Function to give the name of the CRC-32 method in use:
+   "pclmul" or "slice-by-8".  */
+const char *CHK_engine(void);
+
+/* Header check: a CRC-8 (polynomial x^8 + x^2 + x + 1) of the start
+   marker, size field and sequence number, sent in the byte after them.
+   It lets the receiver reject a damaged header as soon as it arrives,
+   without waiting for the number of bytes a bad size field asks for.  */
+byte_t makeHCS(const byte_t *frame);
+// returns FRAMEGOOD if the header check byte matches, FRAMEBAD if not
+int inspectHCS(const byte_t *frame);
 
 #endif
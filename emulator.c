@@ -0,0 +1,508 @@
+/*  Channel emulator, for the bytes received on a link.
+       EMU_parse    reads emulator settings from a string
+       EMU_create   makes an emulator for a link, reading any trace file
+       EMU_free     reports what the emulator did, and frees it
+       EMU_get      gets bytes through the emulator
+       EMU_poll     waits for bytes to come out of the emulator
+    Bytes are taken from the driver as soon as they are available, and
+    put on an emulated line, each with the time it should arrive.  When
+    that time comes, the byte moves into the receive buffer (or is lost,
+    if the buffer is full), where PHY_linkGet can take it.
+    Events from a trace file are applied to the bytes as they are taken
+    from the driver, before the random events.
+    See emulator.h for a description of the settings.  */
+
+#include <stdio.h>   // for printf and sscanf
+#include <stdlib.h>  // for calloc and free
+#include <string.h>  // for strcmp and memset
+#include "physical.h"  // for waitms
+#include "phydriver.h" // for the link, its driver and PHY_timeUs
+#include "emulator.h"  // header file for functions in this file
+
+#define EMU_BUFSIZE 65536  // bytes on the line, and in the receive buffer
+#define EMU_ROOM (EMU_BUFSIZE - EMU_MAXBURST - 2)  // line limit, leaving room
+                                // for a burst of garbage and a duplicate
+
+// Types of trace event
+#define TRACE_FLIP 0     // invert bits in a byte
+#define TRACE_DROP 1     // lose bytes
+#define TRACE_GAP 2      // line stalls
+#define TRACE_GARBAGE 3  // random bytes arrive
+
+// One event from a trace file
+typedef struct
+{
+    long long offset;  // byte offset in the stream
+    int type;          // TRACE_FLIP, TRACE_DROP, etc.
+    int value;         // mask, number of bytes or time in ms
+    int order;         // line number, to keep events in file order
+} traceEvent;
+
+// The emulator in use, with its state
+struct EMU_state
+{
+    EMU_config config;              // the settings
+    uint64_t rng;                   // random number generator state
+    byte_t line[EMU_BUFSIZE];       // bytes on their way
+    long long arrive[EMU_BUFSIZE];  // time each byte on the line arrives, in us
+    int lineHead, lineCount;        // oldest byte on the line, number of bytes
+    long long lastArrive;           // arrival time of the last byte put on the line
+    byte_t fifo[EMU_BUFSIZE];       // receive buffer
+    int fifoHead, fifoCount;        // oldest byte in the buffer, number of bytes
+    int cutLeft;                    // bytes still to lose, after a cut
+    traceEvent *trace;              // events from the trace file, in order
+    int nTrace, nextTrace;          // number of events, next one to use
+    long long traceLoop;            // trace length if it repeats, or 0
+    long long bytesIn;              // bytes taken from the driver
+    long long stallUntil;           // no byte can arrive before this time
+    int dropLeft;                   // bytes still to lose, from the trace
+    long dropped, duplicated, garbage, cut, overrun;  // counts for the report
+    long flipped;                   // bytes changed by the trace
+};
+
+// Helper function to decide if an event with probability p happens.
+static int chance(EMU_state *emu, double p)
+{
+    if (p <= 0.0) return 0;
+    return (ERR_random(&emu->rng) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+// Helper function to get a random number from 0 to max.
+static int upTo(EMU_state *emu, int max)
+{
+    if (max <= 0) return 0;
+    return (int)(ERR_random(&emu->rng) % (uint64_t)(max + 1));
+}
+
+/* Helper function to put a byte on the line, to arrive after the delay.
+   A byte never arrives before the one in front of it.  */
+static void putLine(EMU_state *emu, byte_t b, long long now)
+{
+    long long arrive = now + 1000LL * emu->config.delayMs
+                     + 1000LL * upTo(emu, emu->config.jitterMs);
+    int pos = (emu->lineHead + emu->lineCount) % EMU_BUFSIZE;
+
+    if (arrive < emu->lastArrive) arrive = emu->lastArrive;
+    if (arrive < emu->stallUntil) arrive = emu->stallUntil;
+    emu->lastArrive = arrive;
+    emu->line[pos] = b;
+    emu->arrive[pos] = arrive;
+    emu->lineCount++;
+}
+
+/* Helper function to apply the trace events at the present byte offset.
+   Changes the byte, and returns the number of garbage bytes to put
+   on the line before it.  */
+static int applyTrace(EMU_state *emu, byte_t *b, long long now)
+{
+    long long pos = emu->bytesIn++;  // offset of this byte
+    traceEvent *ev;
+    int nGarbage = 0;
+
+    if (emu->traceLoop > 0)
+    {
+        pos %= emu->traceLoop;
+        if (pos == 0) emu->nextTrace = 0;  // start the trace again
+    }
+    while ((emu->nextTrace < emu->nTrace)
+           && (emu->trace[emu->nextTrace].offset <= pos))
+    {
+        ev = &emu->trace[emu->nextTrace++];
+        if (ev->offset < pos) continue;  // missed, only if offsets repeat
+        switch (ev->type)
+        {
+            case TRACE_FLIP:
+                *b ^= (byte_t) ev->value;
+                emu->flipped++;
+                break;
+            case TRACE_DROP:
+                emu->dropLeft = ev->value;
+                break;
+            case TRACE_GAP:
+                if (emu->stallUntil < now) emu->stallUntil = now;
+                if (emu->stallUntil < emu->lastArrive) emu->stallUntil = emu->lastArrive;
+                emu->stallUntil += 1000LL * ev->value;
+                break;
+            default:  // TRACE_GARBAGE
+                nGarbage += ev->value;
+                break;
+        }
+    }
+    return (nGarbage > EMU_MAXBURST) ? EMU_MAXBURST : nGarbage;
+}
+
+/* Helper function to take all the bytes the driver has received,
+   decide what happens to each one, and put the results on the line.
+   Room is kept for a burst of garbage and a duplicate with every byte.
+   Returns 0, or a negative value if the driver fails.  */
+static int pull(PHY_link *link, EMU_state *emu)
+{
+    EMU_config *c = &emu->config;
+    byte_t b;         // byte from the driver
+    long long now;    // time it was received
+    int i, n, status;
+    int nGarbage;     // garbage bytes from the trace
+
+    while (emu->lineCount < EMU_ROOM)
+    {
+        status = link->driver->poll(link, 0);
+        if (status <= 0) return status;  // nothing more, or failure
+        status = link->driver->get(link, &b, 1);
+        if (status <= 0) return status;
+        now = PHY_timeUs();
+
+        nGarbage = (emu->trace != NULL) ? applyTrace(emu, &b, now) : 0;
+        for (i = 0; i < nGarbage; i++)
+            putLine(emu, (byte_t) ERR_random(&emu->rng), now);
+        emu->garbage += nGarbage;
+        if (emu->dropLeft > 0)  // lost, as the trace says
+        {
+            emu->dropLeft--;
+            emu->dropped++;
+            continue;
+        }
+        if (emu->cutLeft > 0)  // line still cut
+        {
+            emu->cutLeft--;
+            emu->cut++;
+            continue;
+        }
+        if (chance(emu, c->pCut))  // line cut - lose this byte and some more
+        {
+            emu->cutLeft = upTo(emu, c->cutMax - 1);
+            emu->cut++;
+            continue;
+        }
+        if (chance(emu, c->pDrop))  // lose this byte
+        {
+            emu->dropped++;
+            continue;
+        }
+        if (chance(emu, c->pGarbage))  // noise before this byte
+        {
+            n = 1 + upTo(emu, c->garbageMax - 1);
+            for (i = 0; i < n; i++)
+                putLine(emu, (byte_t) ERR_random(&emu->rng), now);
+            emu->garbage += n;
+        }
+        putLine(emu, b, now);
+        if (chance(emu, c->pDup))  // and again
+        {
+            putLine(emu, b, now);
+            emu->duplicated++;
+        }
+    }
+    return 0;
+}
+
+/* Helper function to move bytes that have arrived by now from the line
+   to the receive buffer.  If the buffer is full, they are lost.  */
+static void deliver(EMU_state *emu, long long now)
+{
+    int limit = (emu->config.fifoSize > 0) ? emu->config.fifoSize : EMU_BUFSIZE;
+    while ((emu->lineCount > 0) && (emu->arrive[emu->lineHead] <= now))
+    {
+        if (emu->fifoCount < limit)
+        {
+            emu->fifo[(emu->fifoHead + emu->fifoCount) % EMU_BUFSIZE]
+                = emu->line[emu->lineHead];
+            emu->fifoCount++;
+        }
+        else emu->overrun++;
+        emu->lineHead = (emu->lineHead + 1) % EMU_BUFSIZE;
+        emu->lineCount--;
+    }
+}
+
+/* Helper function to wait until a byte may come out of the emulator:
+   until the next byte on the line arrives, or the driver has a byte,
+   or the time limit given (in us, or -1 for no limit) is reached.
+   Returns 0, or a negative value if the driver fails.  */
+static int waitEvent(PHY_link *link, EMU_state *emu, long long limit)
+{
+    long long now = PHY_timeUs();
+    long long until = limit;  // time to wait until
+    int status;
+
+    if ((emu->lineCount > 0) && ((until < 0) || (emu->arrive[emu->lineHead] < until)))
+        until = emu->arrive[emu->lineHead];
+
+    if (emu->lineCount >= EMU_ROOM)
+    {
+        // Line full - the driver must keep its bytes until there is room
+        waitms((int)((until - now + 999) / 1000));
+        return 0;
+    }
+    status = link->driver->poll(link, (until < 0) ? -1 : (int)((until - now + 999) / 1000));
+    return (status < 0) ? status : 0;
+}
+
+//===================================================================
+/* Function to check if settings would have any effect.
+   Returns TRUE (1) if they would, FALSE (0) if not.  */
+int EMU_active(const EMU_config *c)
+{
+    return (c->delayMs > 0) || (c->jitterMs > 0) || (c->pDrop > 0.0)
+        || (c->pDup > 0.0) || (c->pGarbage > 0.0) || (c->pCut > 0.0)
+        || (c->fifoSize > 0) || (c->traceFile[0] != '\0');
+}
+
+//===================================================================
+/* Function to read emulator settings from a string.
+   Returns 0 if it succeeds, negative if the string is not valid.  */
+int EMU_parse(const char *text, EMU_config *config)
+{
+    char key[16];     // name of a setting
+    double p;         // probability read
+    int n;            // number read
+    int used;         // characters used by sscanf
+    int nRead;        // values read by sscanf
+
+    memset(config, 0, sizeof(EMU_config));
+    if ((text == NULL) || (text[0] == '\0') || (strcmp(text, "none") == 0))
+        return 0;
+
+    while (*text != '\0')
+    {
+        // Each setting is key=value, with P:N for garbage and cut
+        used = 0;
+        if ((sscanf(text, "%15[a-z]=%n", key, &used) != 1) || (used == 0))
+            return -1;
+        text += used;
+        p = 0.0;
+        n = 1;
+        if (strcmp(key, "trace") == 0)  // file name, up to the next comma
+        {
+            for (n = 0; (text[n] != '\0') && (text[n] != ','); n++)
+                ;
+            if ((n == 0) || (n >= EMU_PATHSIZE)) return -1;
+            memcpy(config->traceFile, text, n);
+            config->traceFile[n] = '\0';
+            text += n;
+            if (*text == ',') text++;
+            continue;
+        }
+        if ((strcmp(key, "delay") == 0) || (strcmp(key, "jitter") == 0)
+            || (strcmp(key, "fifo") == 0))
+            nRead = sscanf(text, "%d%n", &n, &used);
+        else
+            nRead = sscanf(text, "%lf%n", &p, &used);
+        if (nRead != 1) return -1;
+        text += used;
+        if ((*text == ':') && (sscanf(text + 1, "%d%n", &n, &used) == 1))
+            text += used + 1;  // number of bytes, for garbage and cut
+        if ((p < 0.0) || (p > 1.0) || (n < 0)) return -2;
+
+        if (strcmp(key, "delay") == 0) config->delayMs = n;
+        else if (strcmp(key, "jitter") == 0) config->jitterMs = n;
+        else if (strcmp(key, "fifo") == 0) config->fifoSize = n;
+        else if (strcmp(key, "drop") == 0) config->pDrop = p;
+        else if (strcmp(key, "dup") == 0) config->pDup = p;
+        else if (strcmp(key, "garbage") == 0)
+        {
+            config->pGarbage = p;
+            config->garbageMax = n;
+        }
+        else if (strcmp(key, "cut") == 0)
+        {
+            config->pCut = p;
+            config->cutMax = n;
+        }
+        else return -1;  // unknown setting
+
+        if (*text == ',') text++;
+        else if (*text != '\0') return -1;
+    }
+    if ((config->garbageMax > EMU_MAXBURST) || (config->fifoSize > EMU_BUFSIZE))
+        return -2;
+    return 0;
+}
+
+/* Helper function to compare trace events, for sorting by offset.
+   Events at the same offset stay in the order of the file.  */
+static int compareEvents(const void *a, const void *b)
+{
+    const traceEvent *ea = (const traceEvent *) a;
+    const traceEvent *eb = (const traceEvent *) b;
+    if (ea->offset != eb->offset) return (ea->offset < eb->offset) ? -1 : 1;
+    return ea->order - eb->order;
+}
+
+/* Helper function to read a trace file into the emulator.
+   Returns 0 if it succeeds, negative if there is a problem.  */
+static int readTrace(EMU_state *emu, const char *fName)
+{
+    FILE *fp;             // the trace file
+    char text[256];       // one line of the file
+    char type[16];        // type of event
+    long long offset;     // byte offset of event
+    long value;           // value for event
+    int lineNum = 0;      // line number, for messages
+    int size = 0;         // number of events the array can hold
+    traceEvent *ev;       // for growing the array
+
+    fp = fopen(fName, "r");
+    if (fp == NULL)
+    {
+        printf("PHY: Cannot open trace file |%s|\n", fName);
+        return -1;
+    }
+    while (fgets(text, sizeof(text), fp) != NULL)
+    {
+        lineNum++;
+        if ((sscanf(text, " %15s", type) != 1) || (type[0] == '#'))
+            continue;  // blank line or comment
+        if (strcmp(type, "loop") == 0)
+        {
+            if ((sscanf(text, " loop %lld", &emu->traceLoop) != 1)
+                || (emu->traceLoop < 0))
+                break;  // problem
+            continue;
+        }
+        if ((sscanf(text, "%lld %15s %li", &offset, type, &value) != 3)
+            || (offset < 0) || (value < 0))
+            break;  // problem
+
+        if (emu->nTrace == size)  // array full, make it bigger
+        {
+            size = (size == 0) ? 64 : 2 * size;
+            ev = (traceEvent *) realloc(emu->trace, size * sizeof(traceEvent));
+            if (ev == NULL) break;
+            emu->trace = ev;
+        }
+        ev = &emu->trace[emu->nTrace];
+        ev->offset = offset;
+        ev->value = (int) value;
+        ev->order = lineNum;
+        if (strcmp(type, "flip") == 0) ev->type = TRACE_FLIP;
+        else if (strcmp(type, "drop") == 0) ev->type = TRACE_DROP;
+        else if (strcmp(type, "gap") == 0) ev->type = TRACE_GAP;
+        else if (strcmp(type, "garbage") == 0) ev->type = TRACE_GARBAGE;
+        else break;  // problem
+        emu->nTrace++;
+    }
+
+    if (!feof(fp))  // stopped early
+    {
+        printf("PHY: Problem in trace file |%s|, line %d\n", fName, lineNum);
+        fclose(fp);
+        return -2;
+    }
+    fclose(fp);
+    qsort(emu->trace, emu->nTrace, sizeof(traceEvent), compareEvents);
+    printf("PHY: Read %d events from trace file |%s|\n", emu->nTrace, fName);
+    return 0;
+}
+
+//===================================================================
+/* Function to make an emulator, reading the trace file if there is one.
+   Returns the emulator, or NULL if there is no memory or the trace
+   file cannot be read.  */
+EMU_state *EMU_create(const EMU_config *config, uint64_t seed)
+{
+    EMU_state *emu = (EMU_state *) calloc(1, sizeof(EMU_state));
+    if (emu == NULL) return NULL;
+    emu->config = *config;
+    if (emu->config.garbageMax < 1) emu->config.garbageMax = 1;
+    if (emu->config.cutMax < 1) emu->config.cutMax = 1;
+    emu->rng = seed;
+    if ((config->traceFile[0] != '\0') && (readTrace(emu, config->traceFile) != 0))
+    {
+        free(emu->trace);
+        free(emu);
+        return NULL;
+    }
+    return emu;
+}
+
+//===================================================================
+/* Function to print what the emulator did, then free it. */
+void EMU_free(EMU_state *emu)
+{
+    if (emu == NULL) return;
+    printf("PHY: Emulator lost %ld bytes (%ld dropped, %ld cut, %ld overrun), "
+           "added %ld duplicate and %ld garbage bytes\n",
+           emu->dropped + emu->cut + emu->overrun, emu->dropped, emu->cut,
+           emu->overrun, emu->duplicated, emu->garbage);
+    if (emu->trace != NULL)
+        printf("PHY: Trace replay changed %ld bytes, after %lld bytes received\n",
+               emu->flipped, emu->bytesIn);
+    free(emu->trace);
+    free(emu);
+}
+
+//===================================================================
+/* Function to get received bytes through the emulator.  Uses the same
+   time limits as the drivers: a total limit of rxTimeConst + timeMult *
+   bytes requested, and after the first byte, a limit of rxTimeIntv
+   between bytes.
+   Returns number of bytes got, or a negative value on failure.  */
+int EMU_get(PHY_link *link, EMU_state *emu, byte_t *dataRX, int nBytesToGet)
+{
+    PHY_params *p = &link->params;
+    int nBytesGot = 0;         // number of bytes got so far
+    long long now;             // time now, in us
+    long long endTime = -1;    // time limit for the whole read, or -1
+    long long limit;           // time limit for the next byte, or -1
+    long long lastByte = 0;    // time when the last byte was got
+    int status;                // return value from helper functions
+
+    now = PHY_timeUs();
+    if (p->rxTimeConst != 0)
+        endTime = now + 1000LL * (p->rxTimeConst + (long long)p->timeMult * nBytesToGet);
+
+    while (1)
+    {
+        status = pull(link, emu);
+        if (status < 0) return status;
+        now = PHY_timeUs();
+        deliver(emu, now);
+
+        // Take bytes from the receive buffer
+        while ((nBytesGot < nBytesToGet) && (emu->fifoCount > 0))
+        {
+            dataRX[nBytesGot++] = emu->fifo[emu->fifoHead];
+            emu->fifoHead = (emu->fifoHead + 1) % EMU_BUFSIZE;
+            emu->fifoCount--;
+            lastByte = now;
+        }
+        if (nBytesGot == nBytesToGet) break;
+
+        // Work out how long we may wait for the next byte
+        limit = endTime;
+        if ((nBytesGot > 0) && (p->rxTimeIntv != 0))
+        {
+            long long intvEnd = lastByte + 1000LL * p->rxTimeIntv;
+            if ((limit < 0) || (intvEnd < limit)) limit = intvEnd;
+        }
+        if ((limit >= 0) && (now >= limit)) break;  // out of time
+
+        status = waitEvent(link, emu, limit);
+        if (status < 0) return status;
+    }
+    return nBytesGot;
+}
+
+//===================================================================
+/* Function to wait for bytes to come out of the emulator.
+   Returns positive if bytes are waiting, 0 if time ran out,
+   negative on failure.  */
+int EMU_poll(PHY_link *link, EMU_state *emu, int timeout_ms)
+{
+    long long limit = -1;  // time limit, or -1 to wait forever
+    long long now;         // time now, in us
+    int status;            // return value from helper functions
+
+    if (timeout_ms >= 0) limit = PHY_timeUs() + 1000LL * timeout_ms;
+    while (1)
+    {
+        status = pull(link, emu);
+        if (status < 0) return status;
+        now = PHY_timeUs();
+        deliver(emu, now);
+        if (emu->fifoCount > 0) return emu->fifoCount;
+        if ((limit >= 0) && (now >= limit)) return 0;  // time ran out
+        status = waitEvent(link, emu, limit);
+        if (status < 0) return status;
+    }
+}
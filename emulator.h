@@ -0,0 +1,95 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef EMULATOR_H_INCLUDED
+#define EMULATOR_H_INCLUDED
+
+#include <stdint.h>  // for uint64_t
+
+/*  Channel emulator, for the bytes received on a link.
+    Bit errors (errmodel.h) are not the only problem on a real line.
+    The emulator sits between the driver and PHY_linkGet, so it works
+    with any driver, and can add:
+       delay      every byte arrives a fixed time after it was received
+       jitter     and a random extra time, up to the limit given -
+                  bytes stay in order, so this makes gaps in the stream
+       drop       bytes lost at random, as when a UART misses a start bit
+       dup        bytes received twice
+       garbage    bursts of random bytes, as from noise on an idle line
+       cut        runs of lost bytes, so frames are cut short
+       fifo       a receive buffer of limited size: bytes that arrive
+                  when it is full are lost (overrun), as in a UART FIFO
+                  that the program does not empty in time
+    Each probability applies to each byte received.  The random numbers
+    come from a seed, so a run can be repeated.
+
+    The emulator can also replay a trace file, recorded from a real line,
+    so the same problems happen at the same places in the byte stream.
+    Each line of the file is an event at a byte offset (counting from 0,
+    the first byte received on the link), or a comment starting with #:
+       OFFSET flip MASK     invert the bits set in MASK (e.g. 0x10) in that byte
+       OFFSET drop N        lose N bytes, starting at that byte
+       OFFSET gap MS        the line stalls for MS ms before that byte
+       OFFSET garbage N     N random bytes arrive before that byte
+       loop LENGTH          start the trace again after LENGTH bytes
+    The events in the trace are added to any others chosen.  */
+
+#define EMU_PATHSIZE 128   // longest trace file name
+#define EMU_MAXBURST 1024  // most bytes in a burst of garbage
+
+// Settings for the channel emulator
+typedef struct
+{
+    int delayMs;       // one-way delay added to every byte, in ms
+    int jitterMs;      // largest random extra delay, in ms
+    double pDrop;      // probability that a byte is lost
+    double pDup;       // probability that a byte is received twice
+    double pGarbage;   // probability of a burst of garbage before a byte
+    int garbageMax;    // longest burst of garbage, in bytes
+    double pCut;       // probability that the line is cut at a byte
+    int cutMax;        // most bytes lost when the line is cut
+    int fifoSize;      // receive buffer size in bytes, 0 for no limit
+    char traceFile[EMU_PATHSIZE];  // trace file to replay, or empty for none
+} EMU_config;
+
+typedef struct EMU_state EMU_state;  // the emulator in use, in emulator.c
+typedef struct PHY_link PHY_link;    // a link, from phydriver.h
+
+/* Function to read emulator settings from a string, e.g. from the
+   PHY_EMU environment variable.  The string is "none", or a list of
+   settings separated by commas, any of:
+       delay=MS  jitter=MS  drop=P  dup=P  garbage=P:N  cut=P:N  fifo=N
+       trace=FILE
+   For example: delay=200,jitter=20,drop=1e-4,fifo=16
+   Returns 0 if it succeeds, negative if the string is not valid.  */
+int EMU_parse(const char *text, EMU_config *config);
+
+/* Function to check if settings would have any effect.
+   Returns TRUE (1) if they would, FALSE (0) if not.  */
+int EMU_active(const EMU_config *config);
+
+/* Function to make an emulator, reading the trace file if there is one.
+   Arguments: config - the settings,
+              seed - seed for the random number generator.
+   Returns the emulator, or NULL if there is no memory or the trace
+   file cannot be read.  */
+EMU_state *EMU_create(const EMU_config *config, uint64_t seed);
+
+/* Function to print what the emulator did, then free it. */
+void EMU_free(EMU_state *emu);
+
+/* Function to get received bytes through the emulator, using the
+   driver for the link.  Time limits are as for the driver.
+   Returns number of bytes got, or a negative value on failure.  */
+int EMU_get(PHY_link *link, EMU_state *emu, byte_t *dataRX, int nBytesToGet);
+
+/* Function to wait for bytes to come out of the emulator.
+   Returns positive if bytes are waiting, 0 if time ran out,
+   negative on failure.  */
+int EMU_poll(PHY_link *link, EMU_state *emu, int timeout_ms);
+
+#endif // EMULATOR_H_INCLUDED
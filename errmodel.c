@@ -0,0 +1,164 @@
+/*  Channel error models, for simulated bit errors.
+       ERR_init    sets up a model, with its settings and seed
+       ERR_apply   adds errors to a block of bytes
+       ERR_parse   reads model settings from a string
+       ERR_random  gets the next random number from a generator
+    See errmodel.h for a description of the models.  */
+
+#include <stdio.h>   // for sscanf
+#include <stdlib.h>  // for strtod
+#include <string.h>  // for strncmp, memset
+#include <math.h>    // for log and log1p
+#include "errmodel.h"  // header file for functions in this file
+
+#define ERR_NEVER 0x7FFFFFFFFFFFFFFFLL  // bits before an event that never happens
+
+//===================================================================
+/* Function to get a random 64-bit value from a generator state.
+   This is the splitmix64 generator: it is fast, passes the usual
+   statistical tests, and works well with any seed, including 0.  */
+uint64_t ERR_random(uint64_t *rng)
+{
+    uint64_t z = (*rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Helper function to draw the number of trials before the first success,
+   when each trial succeeds with probability p (a geometric distribution).
+   Uses inversion: floor(log(U) / log(1-p)), with U uniform in (0,1].  */
+static long long geometric(uint64_t *rng, double p)
+{
+    double u, n;
+    if (p <= 0.0) return ERR_NEVER;
+    if (p >= 1.0) return 0;
+    u = ((double)(ERR_random(rng) >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+    n = floor(log(u) / log1p(-p));
+    if (n >= (double)ERR_NEVER) return ERR_NEVER;
+    return (long long) n;
+}
+
+// Helper function to get the bit error probability in the present state.
+static double stateBer(ERR_model *model)
+{
+    return model->bad ? model->config.berBad : model->config.ber;
+}
+
+// Helper function to draw the number of bits to stay in the present state.
+static long long stateLength(ERR_model *model)
+{
+    double pLeave = model->bad ? model->config.pBadToGood : model->config.pGoodToBad;
+    long long n = geometric(&model->rng, pLeave);
+    return (n == ERR_NEVER) ? n : n + 1;  // stay for at least one bit
+}
+
+//===================================================================
+/* Function to set up an error model.
+   Arguments: model - the model to set up,
+              config - the settings, or NULL for no errors,
+              seed - seed for the random number generator.  */
+void ERR_init(ERR_model *model, const ERR_config *config, uint64_t seed)
+{
+    memset(model, 0, sizeof(ERR_model));
+    if (config != NULL) model->config = *config;
+    else model->config.type = ERR_NONE;
+    model->rng = seed;
+
+    // Start in the good state, with the first error and change drawn
+    model->bad = 0;
+    model->toSwitch = ERR_NEVER;
+    if (model->config.type == ERR_GILBERT)
+        model->toSwitch = stateLength(model);
+    if (model->config.type == ERR_NONE)
+        model->toError = ERR_NEVER;
+    else
+        model->toError = geometric(&model->rng, stateBer(model));
+}
+
+//===================================================================
+/* Function to add errors to a block of bytes, changing them in place.
+   It works through the block in runs: a run ends at the next error,
+   at the next change of state, or at the end of the block.
+   Returns the number of bits changed.  */
+int ERR_apply(ERR_model *model, byte_t *data, int nBytes)
+{
+    long long nBits = 8LL * nBytes;  // number of bits in the block
+    long long pos = 0;    // position in the block, in bits
+    long long run;        // number of bits in this run
+    int nErrors = 0;      // number of bits changed
+    int gilbert = (model->config.type == ERR_GILBERT);
+
+    if ((model->config.type == ERR_NONE) || (nBytes <= 0)) return 0;
+    model->bits += nBits;
+
+    while (pos < nBits)
+    {
+        // The run can go to the end of the block, or the change of state
+        run = nBits - pos;
+        if (gilbert && (model->toSwitch < run)) run = model->toSwitch;
+
+        if (model->toError < run)  // an error comes first
+        {
+            pos += model->toError;
+            if (gilbert) model->toSwitch -= model->toError + 1;
+            data[pos >> 3] ^= (byte_t)(1 << (pos & 7));  // invert one bit
+            nErrors++;
+            pos++;
+            model->toError = geometric(&model->rng, stateBer(model));
+        }
+        else  // no error in this run
+        {
+            pos += run;
+            if (model->toError != ERR_NEVER) model->toError -= run;
+            if (gilbert) model->toSwitch -= run;
+        }
+
+        // Change state if it is time to do so
+        if (gilbert && (model->toSwitch == 0))
+        {
+            model->bad = !model->bad;
+            model->toSwitch = stateLength(model);
+            model->toError = geometric(&model->rng, stateBer(model));
+        }
+    }
+
+    model->errors += nErrors;
+    return nErrors;
+}
+
+//===================================================================
+/* Function to read error model settings from a string.
+   Returns 0 if it succeeds, negative if the string is not valid.  */
+int ERR_parse(const char *text, ERR_config *config)
+{
+    char *end;  // end of number read by strtod
+
+    memset(config, 0, sizeof(ERR_config));
+    config->type = ERR_NONE;
+    if ((text == NULL) || (text[0] == '\0') || (strcmp(text, "none") == 0))
+        return 0;
+
+    if (strncmp(text, "ge:", 3) == 0)
+    {
+        config->type = ERR_GILBERT;
+        if (sscanf(text + 3, "%lf,%lf,%lf,%lf", &config->ber, &config->berBad,
+                   &config->pGoodToBad, &config->pBadToGood) != 4)
+            return -1;
+    }
+    else
+    {
+        if (strncmp(text, "ber:", 4) == 0) text += 4;
+        config->type = ERR_BER;
+        config->ber = strtod(text, &end);
+        if ((end == text) || (*end != '\0')) return -1;
+    }
+
+    // Check all the probabilities are sensible
+    if ((config->ber < 0.0) || (config->ber > 1.0)
+        || (config->berBad < 0.0) || (config->berBad > 1.0)
+        || (config->pGoodToBad < 0.0) || (config->pGoodToBad > 1.0)
+        || (config->pBadToGood < 0.0) || (config->pBadToGood > 1.0))
+        return -2;
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef ERRMODEL_H_INCLUDED
+#define ERRMODEL_H_INCLUDED
+
+#include <stdint.h>  // for uint64_t
+
+/*  Channel error models, used by the physical layer to add simulated
+    bit errors to the bytes sent or received on a link.
+       ERR_NONE     no errors
+       ERR_BER      independent errors, each bit has probability ber
+       ERR_GILBERT  Gilbert-Elliott burst model: the channel is in a good
+                    or a bad state, with bit error probability ber or berBad,
+                    and moves between states with the probabilities given
+    Instead of drawing a random number for every bit or byte, the model
+    draws the number of bits until the next error (or change of state)
+    from a geometric distribution, and skips straight to it.  So the cost
+    is set by the number of errors, not the number of bytes.
+    Each model has its own random number generator, with a seed, so a run
+    can be repeated exactly by using the same seed.  */
+
+#define ERR_NONE 0     // no errors
+#define ERR_BER 1      // independent bit errors
+#define ERR_GILBERT 2  // Gilbert-Elliott burst errors
+
+// Settings for an error model
+typedef struct
+{
+    int type;           // ERR_NONE, ERR_BER or ERR_GILBERT
+    double ber;         // bit error probability (in good state for ERR_GILBERT)
+    double berBad;      // bit error probability in bad state
+    double pGoodToBad;  // probability per bit of moving to bad state
+    double pBadToGood;  // probability per bit of moving back to good state
+} ERR_config;
+
+// An error model in use, with its state
+typedef struct
+{
+    ERR_config config;  // the settings
+    uint64_t rng;       // random number generator state
+    long long toError;  // error-free bits before the next error
+    long long toSwitch; // bits left in the present state (ERR_GILBERT only)
+    int bad;            // TRUE in the bad state (ERR_GILBERT only)
+    long long bits;     // count of bits passed through the model
+    long long errors;   // count of bits changed
+} ERR_model;
+
+/* Function to set up an error model.
+   Arguments: model - the model to set up,
+              config - the settings, or NULL for no errors,
+              seed - seed for the random number generator.  */
+void ERR_init(ERR_model *model, const ERR_config *config, uint64_t seed);
+
+/* Function to add errors to a block of bytes, changing them in place.
+   The model carries on from where it was at the end of the last block.
+   Returns the number of bits changed.  */
+int ERR_apply(ERR_model *model, byte_t *data, int nBytes);
+
+/* Function to read error model settings from a string, e.g. from
+   the command line or environment.  Forms accepted:
+       none
+       ber:P                     independent errors, probability P
+       ge:P,PBAD,PGB,PBG         Gilbert-Elliott, P in good state, PBAD in
+                                 bad state, PGB and PBG to change state
+   A plain number is taken as ber:P.
+   Returns 0 if it succeeds, negative if the string is not valid.  */
+int ERR_parse(const char *text, ERR_config *config);
+
+/* Function to get a random 64-bit value from a generator state,
+   which may be seeded with any value.  Used by the error models,
+   and by anything else that needs repeatable random numbers.  */
+uint64_t ERR_random(uint64_t *rng);
+
+#endif // ERRMODEL_H_INCLUDED
@@ -0,0 +1,375 @@
+/*  Forward error correction: a Reed-Solomon code over GF(256).
+       FEC_encode      adds the parity bytes to a block
+       FEC_decode      corrects a block, and takes the parity bytes out
+       FEC_decodeCopies  the same, from several copies of a block
+       FEC_interleave  and FEC_deinterleave, to spread out bursts of errors
+       FEC_probDecode  predicts how often a block can be decoded
+    See fec.h for a description of the code.  */
+
+#include <string.h>     // for memmove and memcpy
+#include <math.h>       // for log1p, exp and pow, to predict decoding
+#include "fec.h"        // header file for functions in this file
+
+#if defined(__SSE2__) && (FEC_PARITY == 16)
+#include <emmintrin.h>  // SSE2 functions, to work on the 16 parity bytes at once
+#define USE_SSE2
+#endif
+
+#define GF_POLY 0x11D   // polynomial for the field, x^8 + x^4 + x^3 + x^2 + 1
+#define FEC_T (FEC_PARITY / 2)  // most wrong bytes that can be corrected in a codeword
+
+/* The tables are made the first time they are needed, in each thread,
+   so threads never share a half-made table (as in checksum.c).  */
+static _Thread_local byte_t gfExp[512];   // a to the power i, twice over, so sums of logs need no modulo
+static _Thread_local int gfLog[256];      // i such that a to the power i is the byte
+static _Thread_local byte_t genRows[256][FEC_PARITY]; // each byte value times the generator
+static _Thread_local int tablesMade = 0;  // TRUE once the tables are made
+
+//===================================================================
+// Helper function to multiply two elements of the field.
+static byte_t gfMul(byte_t x, byte_t y)
+{
+    return ((x == 0) || (y == 0)) ? 0 : gfExp[gfLog[x] + gfLog[y]];
+}
+
+// Helper function to divide one element of the field by another, not 0.
+static byte_t gfDiv(byte_t x, byte_t y)
+{
+    return (x == 0) ? 0 : gfExp[gfLog[x] + 255 - gfLog[y]];
+}
+
+/* Helper function to make the tables.  The generator is the product of
+   (x - a^j) for each root, multiplied out one root at a time.  Its
+   coefficients are kept highest power first, as the parity bytes are,
+   so row b of genRows is what byte b, fed back, adds to the parity.  */
+static void makeTables(void)
+{
+    byte_t gen[FEC_PARITY + 1] = { 1 }; // generator, lowest power first
+    int i, j, x = 1;
+
+    for (i = 0; i < 255; i++)
+    {
+        gfExp[i] = gfExp[i + 255] = (byte_t) x;
+        gfLog[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLY;
+    }
+    gfExp[510] = gfExp[511] = gfExp[0];
+    gfLog[0] = 0; // not used
+
+    for (j = 0; j < FEC_PARITY; j++) // multiply by (x - a^j)
+    {
+        for (i = j + 1; i > 0; i--)
+            gen[i] = gen[i - 1] ^ gfMul(gen[i], gfExp[j]);
+        gen[0] = gfMul(gen[0], gfExp[j]);
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 0; j < FEC_PARITY; j++)
+            genRows[i][j] = gfMul((byte_t) i, gen[FEC_PARITY - 1 - j]);
+    tablesMade = 1;
+}
+
+/* Helper function to work out the parity bytes of some data bytes: the
+   remainder when they, as a polynomial, are divided by the generator.
+   Each byte is fed back through a shift register of the parity bytes.  */
+static void parity(const byte_t *data, int n, byte_t *par)
+{
+    int i;
+#ifdef USE_SSE2
+    __m128i reg = _mm_setzero_si128(); // the shift register
+    for (i = 0; i < n; i++)
+        reg = _mm_xor_si128(_mm_srli_si128(reg, 1),
+                            _mm_loadu_si128((const __m128i *)
+                                            genRows[data[i] ^ (byte_t) _mm_cvtsi128_si32(reg)]));
+    _mm_storeu_si128((__m128i *) par, reg);
+#else
+    const byte_t *row; // what the byte fed back adds
+    int j;
+    memset(par, 0, FEC_PARITY);
+    for (i = 0; i < n; i++)
+    {
+        row = genRows[data[i] ^ par[0]];
+        for (j = 0; j < FEC_PARITY - 1; j++)
+            par[j] = par[j + 1] ^ row[j];
+        par[FEC_PARITY - 1] = row[FEC_PARITY - 1];
+    }
+#endif
+}
+
+//===================================================================
+/* Helper function to correct one codeword, in place.  The syndromes are
+   the codeword's values at the roots of the generator; as the parity of
+   the data bytes received is known, they are worked out from just the
+   difference between that and the parity bytes received.  From them,
+   Berlekamp-Massey finds the error locator, whose roots (found by trying
+   every byte) give the wrong bytes, and Forney's formula the errors.
+   Arguments: word - the codeword, n - the number of bytes in it,
+              fixed - the count of bytes corrected, to add to.
+   Returns 0 for success, negative if it cannot be corrected.  */
+static int correct(byte_t *word, int n, int *fixed)
+{
+    byte_t diff[FEC_PARITY];          // the parity, worked out again, minus that received
+    byte_t synd[FEC_PARITY];          // syndromes
+    byte_t loc[FEC_PARITY + 1] = { 1 }; // error locator, lowest power first
+    byte_t prev[FEC_PARITY + 1] = { 1 }; // the locator before its last change
+    byte_t save[FEC_PARITY + 1];      // copy of the locator while it changes
+    byte_t eval[FEC_PARITY];          // error evaluator
+    byte_t d, lastD = 1;              // discrepancy, now and at the last change
+    byte_t value, deriv;              // polynomials at a root
+    int len = 0, shift = 1;           // length of the locator, powers since the last change
+    int i, j, p, roots = 0, any = 0;
+
+    parity(word, n - FEC_PARITY, diff);
+    for (j = 0; j < FEC_PARITY; j++)
+    {
+        diff[j] ^= word[n - FEC_PARITY + j];
+        any |= diff[j];
+    }
+    if (any == 0)
+        return 0; // no errors, as is most likely
+
+    for (j = 0; j < FEC_PARITY; j++) // value of the difference at a^j
+    {
+        synd[j] = 0;
+        for (i = 0; i < FEC_PARITY; i++)
+            synd[j] = gfMul(synd[j], gfExp[j]) ^ diff[i];
+    }
+
+    // Berlekamp-Massey: the shortest locator that gives the syndromes
+    for (j = 0; j < FEC_PARITY; j++)
+    {
+        d = synd[j];
+        for (i = 1; i <= len; i++)
+            d ^= gfMul(loc[i], synd[j - i]);
+        if (d == 0)
+        {
+            shift++;
+            continue;
+        }
+        memcpy(save, loc, sizeof(loc));
+        for (i = 0; i + shift <= FEC_PARITY; i++)
+            loc[i + shift] ^= gfMul(gfDiv(d, lastD), prev[i]);
+        if (2 * len <= j)
+        {
+            len = j + 1 - len;
+            memcpy(prev, save, sizeof(prev));
+            lastD = d;
+            shift = 1;
+        }
+        else
+            shift++;
+    }
+    if (len > FEC_T)
+        return -1; // too many errors
+
+    // Evaluator: syndromes times locator, up to the power FEC_PARITY - 1
+    for (j = 0; j < FEC_PARITY; j++)
+    {
+        eval[j] = 0;
+        for (i = 0; (i <= j) && (i <= len); i++)
+            eval[j] ^= gfMul(loc[i], synd[j - i]);
+    }
+
+    // Chien search: byte i is wrong if the locator is 0 at a^-p, p = n - 1 - i
+    for (i = 0; i < n; i++)
+    {
+        p = n - 1 - i;
+        value = 0;
+        for (j = 0; j <= len; j++)
+            value ^= gfMul(loc[j], gfExp[(255 - p) * j % 255]);
+        if (value != 0)
+            continue;
+        // Forney: the error is a^p times the evaluator over the derivative of the locator
+        value = 0;
+        for (j = 0; j < FEC_PARITY; j++)
+            value ^= gfMul(eval[j], gfExp[(255 - p) * j % 255]);
+        deriv = 0;
+        for (j = 1; j <= len; j += 2) // only odd powers are left in GF(2^8)
+            deriv ^= gfMul(loc[j], gfExp[(255 - p) * (j - 1) % 255]);
+        if (deriv == 0)
+            return -1; // not a simple root, so not a real error
+        word[i] ^= gfMul(gfExp[p % 255], gfDiv(value, deriv));
+        roots++;
+    }
+    if (roots != len) // some roots lie outside the codeword
+        return -1;
+    *fixed += roots;
+    return 0;
+}
+
+//===================================================================
+// Helper function to find the number of codewords for n data bytes.
+static int codewords(int n)
+{
+    return (n + FEC_MAXDATA - 1) / FEC_MAXDATA;
+}
+
+/* Function to add the parity bytes to a block, in place.  The data bytes
+   are shared out among the codewords, the first ones taking one more if
+   need be.  Working from the last codeword back, each one's data bytes
+   move along to make room for the parity bytes of those before it.  */
+int FEC_encode(byte_t *block, int n)
+{
+    int words = codewords(n);          // number of codewords
+    int in = n;                        // end of the data bytes of a codeword
+    int out = n + words * FEC_PARITY;  // end of the coded bytes of a codeword
+    int w, len;
+
+    if (!tablesMade)
+        makeTables();
+    for (w = words - 1; w >= 0; w--)
+    {
+        len = n / words + ((w < n % words) ? 1 : 0); // data bytes in this codeword
+        in -= len;
+        out -= len + FEC_PARITY;
+        memmove(block + out, block + in, len);
+        parity(block + out, len, block + out + len);
+    }
+    return n + words * FEC_PARITY;
+}
+
+/* Function to correct a block and take out the parity bytes, in place.
+   The number of codewords is found from the coded size, which cannot
+   be more than 255 bytes for each, then the data bytes are shared out
+   as FEC_encode does.  */
+int FEC_decode(byte_t *block, int nCoded, int *fixed)
+{
+    int words = FEC_WORDS(nCoded);    // number of codewords
+    int n = nCoded - words * FEC_PARITY; // number of data bytes
+    int in = 0, out = 0;              // start of a codeword, and of its data bytes once moved
+    int w, len;
+
+    *fixed = 0;
+    if (n < words) // every codeword has at least one data byte
+        return -1;
+    if (!tablesMade)
+        makeTables();
+    for (w = 0; w < words; w++)
+    {
+        len = n / words + ((w < n % words) ? 1 : 0); // data bytes in this codeword
+        if (correct(block + in, len + FEC_PARITY, fixed) != 0)
+            return -1;
+        memmove(block + out, block + in, len);
+        in += len + FEC_PARITY;
+        out += len;
+    }
+    return n;
+}
+
+/* Function to correct a block from several copies of it, and take out
+   the parity bytes.  Each codeword is taken from the first copy that can
+   be corrected, into a separate array, so the copies are not changed
+   until the codeword has been found.  */
+int FEC_decodeCopies(byte_t *copies[], int nCopies, int nCoded, int *fixed)
+{
+    byte_t word[255];                 // one codeword, being corrected
+    int words = FEC_WORDS(nCoded);    // number of codewords
+    int n = nCoded - words * FEC_PARITY; // number of data bytes
+    int in = 0, out = 0;              // start of a codeword, and of its data bytes once moved
+    int w, c, len, wordFixed;
+
+    *fixed = 0;
+    if (n < words) // every codeword has at least one data byte
+        return -1;
+    if (!tablesMade)
+        makeTables();
+    for (w = 0; w < words; w++)
+    {
+        len = n / words + ((w < n % words) ? 1 : 0); // data bytes in this codeword
+        for (c = 0; c < nCopies; c++)
+        {
+            memcpy(word, copies[c] + in, len + FEC_PARITY);
+            wordFixed = 0;
+            if (correct(word, len + FEC_PARITY, &wordFixed) == 0)
+                break;
+        }
+        if (c == nCopies) // no copy of this codeword can be corrected
+            return -1;
+        memcpy(copies[0] + out, word, len);
+        *fixed += wordFixed;
+        in += len + FEC_PARITY;
+        out += len;
+    }
+    return n;
+}
+
+//===================================================================
+/* Helper function to interleave bytes, or put them back in order.  The
+   codewords are taken in groups of depth, and the bytes of a group go
+   out one from each codeword in turn.  The longer codewords come first,
+   so when a shorter one runs out, so do the rest of its group.
+   Arguments as for FEC_interleave, and undo - TRUE to put the bytes
+   back in order.  */
+static long shuffle(byte_t *dest, const byte_t *src, int nCoded, int depth, int undo)
+{
+    int words = FEC_WORDS(nCoded);                 // number of codewords
+    int base, longer;                              // bytes in the shorter ones, number with one more
+    int out = 0;                                   // position on the line
+    int first, last, w, i, at;
+    long delay = 0;
+
+    if (words == 0)
+        return 0; // nothing to move
+    if (depth < 1)
+        depth = 1;
+    base = (nCoded - words * FEC_PARITY) / words + FEC_PARITY;
+    longer = (nCoded - words * FEC_PARITY) % words;
+    for (first = 0; first < words; first += depth)
+    {
+        last = (first + depth < words) ? first + depth : words;
+        for (i = 0; i <= base; i++)
+            for (w = first; (w < last) && (i < base + (w < longer)); w++)
+            {
+                at = w * base + ((w < longer) ? w : longer) + i; // position in the codeword order
+                if (undo)
+                    dest[at] = src[out];
+                else
+                    dest[out] = src[at];
+                if (i == base - 1 + (w < longer)) // the last byte of the codeword
+                    delay += out - at;
+                out++;
+            }
+    }
+    return delay;
+}
+
+long FEC_interleave(byte_t *dest, const byte_t *src, int nCoded, int depth)
+{
+    return shuffle(dest, src, nCoded, depth, 0);
+}
+
+long FEC_deinterleave(byte_t *dest, const byte_t *src, int nCoded, int depth)
+{
+    return shuffle(dest, src, nCoded, depth, 1);
+}
+
+/* Helper function to find the chance of decoding a codeword of len
+   bytes: no more than FEC_T of them wrong.  Each term of the binomial
+   distribution is worked out from the one before.  */
+static double probWord(int len, double pByte)
+{
+    double term = exp(len * log1p(-pByte)); // chance of exactly j wrong bytes, from none
+    double sum = term;                      // chance of up to j wrong bytes
+    for (int j = 0; j < FEC_T; j++)
+    {
+        term *= (double)(len - j) / (j + 1) * pByte / (1.0 - pByte);
+        sum += term;
+    }
+    return (sum < 1.0) ? sum : 1.0;
+}
+
+/* Function to predict the chance of decoding a block: every codeword
+   must be decoded.  There are only two lengths of codeword.  */
+double FEC_probDecode(int n, double pByte)
+{
+    int words = codewords(n); // number of codewords
+    int longer = n % words;   // number of them with one more data byte
+
+    if (n <= 0)
+        return 1.0;
+    if (pByte >= 1.0)
+        return 0.0;
+    return pow(probWord(n / words + FEC_PARITY, pByte), words - longer)
+           * ((longer > 0) ? pow(probWord(n / words + 1 + FEC_PARITY, pByte), longer) : 1.0);
+}
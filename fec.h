@@ -0,0 +1,93 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef FEC_H_INCLUDED
+#define FEC_H_INCLUDED
+
+/*  Forward error correction (FEC), so the receiver can put right a few
+    wrong bytes in a frame, instead of asking for the frame again.
+    The bytes are split into codewords of up to 255 bytes, as evenly as
+    possible, and each codeword is a Reed-Solomon code over GF(256): its
+    data bytes, then FEC_PARITY parity bytes.  Any FEC_PARITY / 2 wrong
+    bytes in a codeword can be corrected, however many bits are wrong in
+    each, so a short burst of errors costs no more than one wrong bit.
+    A codeword with more wrong bytes than that is nearly always found
+    to be beyond correction, rather than "corrected" wrongly.
+
+    The field is made with the polynomial x^8 + x^4 + x^3 + x^2 + 1, and
+    the roots of the generator are 1, a, a^2 ... a^(FEC_PARITY - 1), where
+    a is 2.  Multiplying uses log and antilog tables.  The parity is
+    worked out with a table of the generator times each byte value, which
+    with 16 parity bytes is one SSE2 register, when the compiler allows
+    it.  The receiver works out the parity of the data bytes again, in
+    the same way: if it matches, there are no errors, which is the usual
+    case.  Only if not does it find the wrong bytes, from the difference
+    (Berlekamp-Massey, a Chien search and Forney's formula).
+
+    A burst of errors longer than FEC_PARITY / 2 bytes is too much for
+    one codeword, so the coded bytes can be interleaved before they are
+    sent: the first byte of each of a group of codewords, then the second
+    byte of each, and so on.  A burst then falls on several codewords, a
+    few bytes each.  The number of codewords in a group is the depth.
+    The cost is delay - each codeword ends further along the line, so
+    its last byte arrives later than if it were sent alone.  */
+
+#define FEC_PARITY 16                   // parity bytes in each codeword
+#define FEC_MAXDATA (255 - FEC_PARITY)  // most data bytes in each codeword
+
+// Number of bytes after coding n bytes
+#define FEC_CODEDSIZE(n) ((n) + ((n) + FEC_MAXDATA - 1) / FEC_MAXDATA * FEC_PARITY)
+// Number of codewords in nCoded bytes
+#define FEC_WORDS(nCoded) (((nCoded) + 254) / 255)
+
+/* Function to add the parity bytes to a block of bytes, in place.
+   Arguments: block - the bytes, in an array with space for
+              FEC_CODEDSIZE(n) bytes,
+              n - the number of bytes.
+   Returns the number of bytes after coding.  */
+int FEC_encode(byte_t *block, int n);
+
+/* Function to correct the errors in a block of coded bytes, in place,
+   and take out the parity bytes.
+   Arguments: block - the coded bytes,
+              nCoded - the number of coded bytes,
+              fixed - set to the number of bytes corrected.
+   Returns the number of bytes left, or negative if the errors could not
+   all be corrected (or nCoded could not come from FEC_encode).  */
+int FEC_decode(byte_t *block, int nCoded, int *fixed);
+
+/* Function to correct a block from several copies of it, each received
+   with errors, taking each codeword from the first copy in which it can
+   be corrected.  So two copies can be corrected when neither could be
+   alone, as long as their errors fall in different codewords.
+   Arguments: copies - pointers to the coded bytes of each copy, the
+              corrected bytes are left in copies[0], without parity,
+              nCopies - the number of copies,
+              nCoded - the number of coded bytes in each copy,
+              fixed - set to the number of bytes corrected.
+   Returns as FEC_decode.  */
+int FEC_decodeCopies(byte_t *copies[], int nCopies, int nCoded, int *fixed);
+
+/* Functions to interleave coded bytes, and to put them back in order.
+   Arguments: dest - array for the bytes, in their new order,
+              src - the bytes (dest and src must not overlap),
+              nCoded - the number of coded bytes, from FEC_encode,
+              depth - the number of codewords to interleave together,
+              1 or less for none.
+   Returns the total, over all the codewords, of the number of byte
+   times by which interleaving holds back the last byte of each.  */
+long FEC_interleave(byte_t *dest, const byte_t *src, int nCoded, int depth);
+long FEC_deinterleave(byte_t *dest, const byte_t *src, int nCoded, int depth);
+
+/* Function to predict the chance of a coded block being decoded
+   correctly, when each byte is wrong with a given probability.
+   Arguments: n - number of bytes in the block, before coding,
+              pByte - probability of each coded byte being wrong.
+   Returns the probability, from 0 to 1.  */
+double FEC_probDecode(int n, double pByte);
+
+#endif // FEC_H_INCLUDED
@@ -11,11 +11,15 @@
 #include <string.h>     // needed for string manipulation
 #include <stdlib.h>   // needed for atoi()
 #include "linklayer.h"  // link layer functions
+#ifndef _WIN32
+#include <pthread.h>    // for the receiving thread in loopback mode
+#include "phydriver.h"  // to choose the loopback driver
+#endif
 
 #define FILENAME 233  // header value for file name
 #define FILEDATA 234  // header value for data
 #define FILEEND 235   // header value to mark end of file
-#define MAX_DATA 300  // maximum data block size to use
+#define MAX_DATA MAX_BLK  // maximum data block size to use
 
 #define MAX_FNAME 80  // maximum file name length
 #define MAX_MODE 10   // maximum length of mode input
@@ -24,6 +28,26 @@
 int sendFile(char *fName, int portNum, int debug);
 int receiveFile(int portNum, int debug);
 
+#ifndef _WIN32
+/* In loopback mode, the file is sent and received in this program,
+   using the loopback driver, with the receiver in a separate thread. */
+typedef struct
+{
+    int portNum;  // port number, used to name the loopback channel
+    int debug;    // controls printing
+    int retVal;   // return value from receiveFile
+} rxArgs;
+
+// Function to run receiveFile in a thread
+static void *receiveThread(void *arg)
+{
+    rxArgs *rx = (rxArgs *) arg;
+    PHY_setSeedIndex(1);  // receiving end gets the seed after the sender's
+    rx->retVal = receiveFile(rx->portNum, rx->debug);
+    return NULL;
+}
+#endif
+
 int main()
 {
     char fName[MAX_FNAME];   // string to hold  filename
@@ -32,6 +56,10 @@ int main()
     int retVal;         // return value from functions
     int portNum;        // serial port number
     int debug = FALSE;  // controls printing in many functions
+#ifndef _WIN32
+    pthread_t rxThread; // thread for receiver in loopback mode
+    rxArgs rx;          // arguments for receiver thread
+#endif
 
     printf("Link Layer Assignment - Application Program\n");  // welcome message
 
@@ -51,7 +79,11 @@ int main()
     }
 
     // Then ask what the user wants to do
+#ifndef _WIN32
+    printf("\nSelect send, receive or loopback test (s/r/l): ");
+#else
     printf("\nSelect send or receive (s/r): ");
+#endif
     fgets(inString, MAX_MODE, stdin);  // get user input
 
     // Decide what to do, based on what the user entered
@@ -76,6 +108,33 @@ int main()
             else printf("\n*** Receive failed, code %d\n", retVal);
             break;
 
+#ifndef _WIN32
+        case 'l':
+        case 'L':
+            printf("\nEnter name of file to send with extension (name.ext): ");
+            fgets(fName, MAX_FNAME, stdin);  // get filename
+            nInput = strlen(fName);
+            fName[nInput-1] = '\0';   // remove the newline at the end
+            printf("\n");  // blank line
+            // Both ends use the loopback channel, instead of a serial port
+            if (PHY_selectDriver("loopback", NULL) != 0) break;
+            rx.portNum = portNum;
+            rx.debug = debug;
+            PHY_setSeedIndex(0);  // sending end gets PHY_SEED, whichever opens first
+            if (pthread_create(&rxThread, NULL, receiveThread, &rx) != 0)
+            {
+                printf("\nFailed to start receiver thread\n");
+                break;
+            }
+            retVal = sendFile(fName, portNum, debug);  // call function to send file
+            pthread_join(rxThread, NULL);  // wait for receiver to finish
+            if (retVal == 0) printf("\nFile sent!\n");
+            else printf("\n*** Send failed, code %d\n", retVal);
+            if (rx.retVal == 0) printf("File received!\n");
+            else printf("*** Receive failed, code %d\n", rx.retVal);
+            break;
+#endif
+
         default:
             printf("\nCommand not recognised\n");
             break;
@@ -0,0 +1,233 @@
+/*  Framing, to make the start-of-frame marker unambiguous.
+       FRM_parse, FRM_name   convert between modes and names
+       FRM_encode   codes the bytes of a frame, for sending
+       FRM_decode   decodes the bytes of a frame, as received
+    See framing.h for a description of the modes.  */
+
+#include <string.h>     // for memchr and memcpy
+#include "linklayer.h"  // for STARTBYTE and special()
+#include "framing.h"    // header file for functions in this file
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // SSE2 functions, to work on 16 bytes at a time
+#define USE_SSE2
+#endif
+
+#define COBS_BLOCK 254  // most bytes in a COBS block, after its count
+
+static const char *modeNames[] = { "plain", "stuff", "cobs" };
+
+//===================================================================
+/* Helper function to find the first byte that is special(),
+   i.e. STARTBYTE or ESCBYTE.
+   Returns its position, or n if there is none.  */
+static int findSpecial(const byte_t *p, int n)
+{
+    int i = 0;
+#ifdef USE_SSE2
+    const __m128i start = _mm_set1_epi8((char) STARTBYTE);
+    const __m128i esc = _mm_set1_epi8((char) ESCBYTE);
+    __m128i v;
+    int mask;   // one bit for each of the 16 bytes that is special
+
+    for (; i + 16 <= n; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, start),
+                                              _mm_cmpeq_epi8(v, esc)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++)
+        if (special(p[i])) return i;
+    return n;
+}
+
+// Helper function to copy bytes, XORing each one with a key.
+static void xorCopy(byte_t *dst, const byte_t *src, int n, byte_t key)
+{
+    int i = 0;
+#ifdef USE_SSE2
+    const __m128i k = _mm_set1_epi8((char) key);
+    for (; i + 16 <= n; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), k));
+#endif
+    for (; i < n; i++)
+        dst[i] = src[i] ^ key;
+}
+
+//===================================================================
+/* Helper function for byte stuffing: copy runs of ordinary bytes as
+   they are, and send each special byte as ESCBYTE, then byte XOR 0x20.  */
+static int stuffEncode(const byte_t *in, int n, byte_t *out)
+{
+    int i = 0, o = 0;   // positions in the input and output
+    int run;            // number of ordinary bytes before a special one
+
+    while (i < n)
+    {
+        run = findSpecial(in + i, n - i);
+        memcpy(out + o, in + i, run);
+        i += run;
+        o += run;
+        if (i < n)  // a special byte
+        {
+            out[o++] = ESCBYTE;
+            out[o++] = in[i++] ^ 0x20;
+        }
+    }
+    return o;
+}
+
+/* Helper function to undo byte stuffing.
+   Returns number of bytes decoded, or negative if an escaped byte
+   is not a special byte.  */
+static int stuffDecode(const byte_t *in, int nIn, byte_t *out, int want, int *used)
+{
+    int i = 0, o = 0;   // positions in the input and output
+    int run;            // number of ordinary bytes before an escape
+    const byte_t *esc;  // position of the next escape
+    byte_t b;           // escaped byte
+
+    while ((o < want) && (i < nIn))
+    {
+        esc = memchr(in + i, ESCBYTE, nIn - i);
+        run = (esc != NULL) ? (int)(esc - (in + i)) : nIn - i;
+        if (run > want - o) run = want - o;
+        memcpy(out + o, in + i, run);
+        i += run;
+        o += run;
+        if ((o == want) || (i == nIn)) break;
+        if (i + 1 >= nIn) break;  // need the byte after the escape
+        b = in[i + 1] ^ 0x20;
+        if (!special(b)) return -1;  // only special bytes are escaped
+        out[o++] = b;
+        i += 2;
+    }
+    *used = i;
+    return o;
+}
+
+//===================================================================
+/* Helper function for COBS: each block is a count, then up to 254
+   bytes that are not zero.  A count of n+1 means n bytes, then a zero
+   (not sent), except that 255 means 254 bytes and no zero, and there
+   is no zero after the last block.  Every coded byte is XORed with
+   STARTBYTE, so a zero would become STARTBYTE - but there are none.  */
+static int cobsEncode(const byte_t *in, int n, byte_t *out)
+{
+    int i = 0, o = 0;     // positions in the input and output
+    int run;              // number of bytes before the next zero
+    const byte_t *zero;   // position of the next zero
+
+    while (1)
+    {
+        zero = memchr(in + i, 0, n - i);
+        run = (zero != NULL) ? (int)(zero - (in + i)) : n - i;
+        if (run >= COBS_BLOCK)  // full block, with no zero after it
+        {
+            out[o++] = (byte_t)(COBS_BLOCK + 1) ^ STARTBYTE;
+            xorCopy(out + o, in + i, COBS_BLOCK, STARTBYTE);
+            o += COBS_BLOCK;
+            i += COBS_BLOCK;
+            if (i == n) break;
+            continue;
+        }
+        out[o++] = (byte_t)(run + 1) ^ STARTBYTE;
+        xorCopy(out + o, in + i, run, STARTBYTE);
+        o += run;
+        i += run;
+        if (i == n) break;  // end of the frame
+        i++;                // skip the zero
+        if (i == n) break;  // the frame ended with the zero
+    }
+    return o;
+}
+
+/* Helper function to undo COBS.
+   Returns number of bytes decoded, or negative if a count is zero.  */
+static int cobsDecode(const byte_t *in, int nIn, byte_t *out, int want, int *used)
+{
+    int i = 0, o = 0;   // positions in the input and output
+    int code;           // the count at the start of a block
+    int take;           // number of bytes to take from the block
+
+    while (o < want)
+    {
+        if (i >= nIn) break;  // need another block
+        code = in[i] ^ STARTBYTE;
+        if (code == 0) return -1;  // not valid
+        take = code - 1;
+        if (take > want - o) take = want - o;
+        if (take > nIn - i - 1)  // only part of the block is here
+        {
+            take = nIn - i - 1;
+            xorCopy(out + o, in + i + 1, take, STARTBYTE);
+            o += take;
+            break;  // need the rest of the block
+        }
+        xorCopy(out + o, in + i + 1, take, STARTBYTE);
+        o += take;
+        if (take < code - 1) break;  // have all that was wanted
+        i += code;
+        if ((code != COBS_BLOCK + 1) && (o < want))
+            out[o++] = 0;  // the zero at the end of the block
+    }
+    *used = i;
+    return o;
+}
+
+//===================================================================
+// Function to find a framing mode from its name.
+int FRM_parse(const char *name)
+{
+    int mode;
+    if (name == NULL) return -1;
+    for (mode = FRM_PLAIN; mode <= FRM_COBS; mode++)
+        if (strcmp(name, modeNames[mode]) == 0) return mode;
+    return -1;
+}
+
+//===================================================================
+// Function to give the name of a framing mode.
+const char *FRM_name(int mode)
+{
+    if ((mode < FRM_PLAIN) || (mode > FRM_COBS)) return "unknown";
+    return modeNames[mode];
+}
+
+//===================================================================
+// Function to code the bytes of a frame that follow the start marker.
+int FRM_encode(int mode, const byte_t *in, int n, byte_t *out)
+{
+    switch (mode)
+    {
+    case FRM_STUFF:
+        return stuffEncode(in, n, out);
+    case FRM_COBS:
+        return cobsEncode(in, n, out);
+    default:
+        memcpy(out, in, n);
+        return n;
+    }
+}
+
+//===================================================================
+// Function to decode the bytes of a frame that follow the start marker.
+int FRM_decode(int mode, const byte_t *in, int nIn, byte_t *out,
+               int want, int *used)
+{
+    switch (mode)
+    {
+    case FRM_STUFF:
+        return stuffDecode(in, nIn, out, want, used);
+    case FRM_COBS:
+        return cobsDecode(in, nIn, out, want, used);
+    default:
+        if (want > nIn) want = nIn;
+        memcpy(out, in, want);
+        *used = want;
+        return want;
+    }
+}
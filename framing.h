@@ -0,0 +1,70 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef FRAMING_H_INCLUDED
+#define FRAMING_H_INCLUDED
+
+/*  Framing, to make the start-of-frame marker unambiguous.
+    In plain framing, the bytes after the start marker are sent as
+    they are, so a data byte equal to STARTBYTE looks just like the
+    start of a frame.  The other modes code those bytes, so STARTBYTE
+    is never sent inside a frame - the receiver can trust every start
+    marker, and after an error it finds the next frame at once.
+       FRM_PLAIN  no coding: START, then the frame bytes as they are
+       FRM_STUFF  byte stuffing: STARTBYTE and ESCBYTE in the frame are
+                  sent as ESCBYTE, then the byte XOR 0x20.  No overhead
+                  for most data, but up to double for the worst.
+       FRM_COBS   consistent overhead byte stuffing: the frame is coded
+                  in blocks of up to 254 bytes, each starting with a
+                  count, so no byte is zero; then every byte is XORed
+                  with STARTBYTE, so none is STARTBYTE.  One byte extra
+                  for every 254, whatever the data.
+    The coded bytes follow the start marker, which is sent as it is.
+    Both ends of a link must use the same mode.
+
+    The loops that look for special bytes, and that copy and XOR blocks
+    of bytes, work on 16 bytes at a time when the compiler supports SSE2,
+    and one byte at a time otherwise.  */
+
+#define FRM_PLAIN 0   // frame bytes sent as they are
+#define FRM_STUFF 1   // escape-based byte stuffing
+#define FRM_COBS  2   // consistent overhead byte stuffing
+
+// Largest number of coded bytes for n frame bytes, in any mode
+#define FRM_MAXCODED(n) (2 * (n) + 1)
+
+/* Function to find a framing mode from its name:
+   "plain", "stuff" or "cobs".
+   Returns the mode, or negative if the name is not known.  */
+int FRM_parse(const char *name);
+
+/* Function to give the name of a framing mode. */
+const char *FRM_name(int mode);
+
+/* Function to code the bytes of a frame that follow the start marker.
+   Arguments: mode - the framing mode,
+              in - the bytes to code, n - the number of bytes,
+              out - array for the coded bytes, with space for
+              FRM_MAXCODED(n) bytes.
+   Returns the number of coded bytes.  */
+int FRM_encode(int mode, const byte_t *in, int n, byte_t *out);
+
+/* Function to decode the bytes of a frame that follow the start marker.
+   It decodes from the start, until it has the number of frame bytes
+   wanted, or runs out of coded bytes.
+   Arguments: mode - the framing mode,
+              in - the coded bytes, nIn - the number of coded bytes,
+              out - array for the frame bytes,
+              want - the number of frame bytes wanted,
+              used - set to the number of coded bytes used.
+   Returns the number of frame bytes decoded, which is less than want
+   if more coded bytes are needed, or negative if the coded bytes are
+   not valid (e.g. damaged by an error).  */
+int FRM_decode(int mode, const byte_t *in, int nIn, byte_t *out,
+               int want, int *used);
+
+#endif // FRAMING_H_INCLUDED
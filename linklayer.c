@@ -6,6 +6,8 @@
    LL_receive_basic()  waits to receive a block of data;
    LL_receive_LLC()    tries to receive a block of data, sends a response;
    LL_getOptBlockSize()  returns the optimum size of data block
+   LL_getOptions(), LL_setOptions()  get or change settings
+   LL_getStats()  gets the counters for a report
    All functions take a debug argument - if non-zero, they print
    messages explaining what is happening.  Regardless of debug,
    functions print messages when things go wrong.
@@ -13,28 +15,1038 @@
    Definitions of constants are in the header file.  */
 
 #include <stdio.h>     // input-output library: print & file operations
-#include <time.h>      // for timing functions
+#include <string.h>    // for memcpy
+#include <math.h>      // for exp, log and sqrt, to choose the block size
 #include "physical.h"  // physical layer functions
+#include "phydriver.h" // for PHY_timeUs, to measure time connected
+#include "timer.h"     // deadlines and the retransmission timers
+#include "rxbuffer.h"  // buffer for received bytes
 #include "linklayer.h" // these functions
-#include "checksum.h"  // the checksum functions
+#include "checksum.h"  // the error detecting codes
+#include "fec.h"       // forward error correction
+#include "errmodel.h"  // for ERR_random, to spread out the timeouts
 
 /* These variables need to retain their values between function calls, so they
    are declared as static.  By declaring them outside any function, they are
-   made available to all the functions in this file.  */
-static int seqNumTX;          // sequence number for the next transmit data block
-static int lastSeqRX;         // sequence number of last good data block received
-static int connected = FALSE; // keep track of state of connection
-static int framesSent = 0;    // count of frames sent
-static int acksSent = 0;      // count of ACKs sent
-static int naksSent = 0;      // count of NAKs sent
-static int acksRX = 0;        // count of ACKs received
-static int naksRX = 0;        // count of NAKs received
-static int badFrames = 0;     // count of bad frames received
-static int goodFrames = 0;    // count of good frames received
-static int timeouts = 0;      // count of timeouts
-static long timerRX;          // time value for timeouts at receiver
-static long connectTime;      // time when connection was established
-static int debug = 1;         // debug value - controls printing
+   made available to all the functions in this file.  They are also declared
+   _Thread_local, so each thread has its own link: the two ends of a link can
+   run in one program, in separate threads, over the loopback channel.  */
+static _Thread_local int seqNumTX;          // sequence number for the next transmit data block
+static _Thread_local int lastSeqRX;         // sequence number of last good data block received
+static _Thread_local int connected = FALSE; // keep track of state of connection
+static _Thread_local int framesSent = 0;    // count of frames sent
+static _Thread_local int acksSent = 0;      // count of ACKs sent
+static _Thread_local int naksSent = 0;      // count of NAKs sent
+static _Thread_local int acksRX = 0;        // count of ACKs received
+static _Thread_local int naksRX = 0;        // count of NAKs received
+static _Thread_local int badFrames = 0;     // count of bad frames received
+static _Thread_local int goodFrames = 0;    // count of good frames received
+static _Thread_local int timeouts = 0;      // count of timeouts
+static _Thread_local long dataBytesTX = 0;  // count of data bytes sent and acknowledged
+static _Thread_local long dataBytesRX = 0;  // count of data bytes delivered to the application
+static _Thread_local long long timerRX;     // time value for timeouts at receiver
+static _Thread_local RXB_buffer rxBuffer;   // bytes received, not yet in a frame
+static _Thread_local int resyncLeft = 0;    // bytes of a bad frame still to search for a frame
+static _Thread_local int resyncs = 0;       // count of frames found inside bad frames
+static _Thread_local int badHeaders = 0;    // count of frames rejected by the header check
+static _Thread_local const byte_t *checkedFrame; // frame last returned by getFrame, if its trailer was checked
+static _Thread_local int checkedSize;       // size of that frame
+static _Thread_local int checkedStatus;     // result of checking its trailer
+static _Thread_local TIM_wheel timers;      // timer wheel for this link
+static _Thread_local TIM_timer retxTimer[MOD_SEQNUM]; // retransmission timer for each sequence number
+static _Thread_local byte_t txFrames[MAX_WINDOW][MAX_FRAME]; // frames sent, not yet acknowledged (with a window)
+static _Thread_local int txSizes[MAX_WINDOW]; // number of bytes in each of those frames
+static _Thread_local int txData[MAX_WINDOW];  // number of data bytes in each of those frames
+static _Thread_local int txTries[MAX_WINDOW]; // times each of those frames has been sent
+static _Thread_local long txOrder[MAX_WINDOW]; // when each was last sent, counting frames sent
+static _Thread_local int txAcked[MAX_WINDOW]; // TRUE if acknowledged by a selective ACK
+static _Thread_local long sendCount;        // frames sent, for txOrder
+static _Thread_local long orderSeen;        // latest txOrder of a frame known to have arrived
+static _Thread_local int txBase;            // sequence number of the oldest frame not acknowledged
+static _Thread_local int txCount;           // number of frames sent, not yet acknowledged
+static _Thread_local int txBacks;           // times the sender has gone back to the oldest frame
+static _Thread_local long long lineFree;    // when the bytes sent will have left, in us (estimate)
+static _Thread_local long long backDone;    // when the oldest frame, sent again, will have left
+static _Thread_local long long txLeft[MAX_WINDOW]; // when each of those frames should have left the line
+static _Thread_local long long sampleFrom;  // when the newest frame just acknowledged left, or -1
+static _Thread_local int rttSamples;        // count of round trip times measured
+static _Thread_local double srtt;           // smoothed round trip time, in seconds
+static _Thread_local double rttvar;         // mean deviation of the round trip time, in seconds
+static _Thread_local double rto;            // retransmission timeout, in seconds
+static _Thread_local long long nextBackOff; // time from when the RTO may be doubled again, in us
+static _Thread_local uint64_t rtoRandom;    // random number generator state, for the jitter
+static _Thread_local int blockSize = OPT_BLK; // optimum data block size, for LL_getOptBlockSize
+static _Thread_local int adaptSent;         // frames sent since the block size was checked
+static _Thread_local int adaptResent;       // how many of those were sent again
+static _Thread_local long adaptBytes;       // number of bytes in those frames
+static _Thread_local int cleanSent;         // frames sent before those, since one was sent again
+static _Thread_local long cleanBytes;       // number of bytes in those frames
+static _Thread_local double berEst = -1.0;  // bit error rate measured, kept between connections
+static _Thread_local int adaptFixed;        // bytes the receiver has corrected, reported since the check
+static _Thread_local int fecOn;             // TRUE if FEC parity is added to the frames sent
+static _Thread_local int fecFrames = 0;     // count of frames received with FEC parity
+static _Thread_local int fecFixed = 0;      // count of bytes corrected in them
+static _Thread_local long long ilvBytes = 0; // byte times interleaving held back the codewords in them
+static _Thread_local long ilvWords = 0;     // number of codewords in them
+static _Thread_local int fixedToReport;     // bytes corrected, not yet reported in an ACK
+static _Thread_local byte_t rxCopies[MAX_WINDOW][HARQ_COPIES][MAX_FRAME]; // bad frames kept, to combine with the next copy
+static _Thread_local int copySeq[MAX_WINDOW];   // sequence number of each of those frames
+static _Thread_local int copySize[MAX_WINDOW];  // number of bytes in them
+static _Thread_local int copyCount[MAX_WINDOW]; // number of copies kept (0 if none)
+static _Thread_local int harqFrames = 0;    // count of bad frames put right by combining copies
+static _Thread_local int rejSent;           // TRUE if a NAK has been sent for the expected block
+static _Thread_local int rejAhead;          // since then, furthest ahead of it a block has been
+static _Thread_local byte_t rxData[MAX_WINDOW][MAX_BLK]; // blocks received, not yet delivered (ARQ_SELECTIVE)
+static _Thread_local int rxSizes[MAX_WINDOW]; // number of data bytes in each of those blocks
+static _Thread_local int rxHave[MAX_WINDOW];  // TRUE if that block has been received
+static _Thread_local int deliverSeq;        // sequence number of the next block to deliver
+static _Thread_local long long connectTime; // time when connection was established, in us
+static _Thread_local long long disconTime;  // time when connection ended, in us
+static _Thread_local LL_options options = { BIT_RATE, OPT_BLK, FRAMING, HEADER_CHECK, CHECKSUM, ARQ, WINDOW, ADAPT_BLOCK, FEC, INTERLEAVE, HARQ }; // settings for this thread
+static _Thread_local int debug = 1;         // debug value - controls printing
+static const char *const arqNames[] = { "stop-and-wait", "go-back-N", "selective repeat" };
+static const char *const fecNames[] = { "off", "on", "auto" };
+
+// ===========================================================================
+/* Function to find the number of bytes in a frame header, which depends
+   on whether the header check byte is used.  The data bytes (or the
+   type of an ack) follow the header.  */
+static int headerSize(void)
+{
+    return options.headerCheck ? HEADERSIZE + HCS_SIZE : HEADERSIZE;
+}
+
+/* Function to put the frame size in its place in the header: the number
+   of bytes after the size field, most significant byte first, with
+   FECBIT clear.
+   Arguments: frame - pointer to the frame,
+              sizeFrame - number of bytes in the whole frame.  */
+static void putFrameSize(byte_t *frame, int sizeFrame)
+{
+    int after = sizeFrame - FRAMENUMBERPOS - SIZE_BYTES; // bytes after the size field
+    frame[FRAMENUMBERPOS] = (byte_t)(after >> 8);
+    frame[FRAMENUMBERPOS + 1] = (byte_t)after;
+}
+
+/* Function to find the number of bytes in a frame, from the size field
+   in its header, leaving out FECBIT.
+   Argument:  frame - pointer to the frame, at least as far as the size.
+   Return value: the number of bytes in the whole frame.  */
+static int frameSize(const byte_t *frame)
+{
+    return FRAMENUMBERPOS + SIZE_BYTES
+           + (((frame[FRAMENUMBERPOS] & (FECBIT - 1)) << 8) | frame[FRAMENUMBERPOS + 1]);
+}
+
+// Function to find the number of bytes in a frame trailer - the check value
+static int trailerSize(void)
+{
+    return CHK_size(options.checksum);
+}
+
+/* Function to add the trailer to a frame.  The check value covers every
+   byte after the start marker.
+   Arguments: frame - pointer to the frame,
+              sizeFrame - number of bytes in the frame, before the trailer. */
+static void addTrailer(byte_t *frame, int sizeFrame)
+{
+    CHK_write(options.checksum,
+              CHK_compute(options.checksum, frame + 1, sizeFrame - 1),
+              frame + sizeFrame);
+}
+
+/* Function to check the trailer of a received frame.
+   Arguments: frame - pointer to the frame,
+              sizeFrame - number of bytes in the frame, with the trailer.
+   Return value: FRAMEGOOD if the check value matches, FRAMEBAD if not. */
+static int checkTrailer(const byte_t *frame, int sizeFrame)
+{
+    int sizeData = sizeFrame - trailerSize(); // bytes before the trailer
+    if (sizeData < HEADERSIZE)
+        return FRAMEBAD; // too short to be a frame
+    if (CHK_compute(options.checksum, frame + 1, sizeData - 1)
+        != CHK_read(options.checksum, frame + sizeData))
+        return FRAMEBAD;
+    return FRAMEGOOD;
+}
+
+// ===========================================================================
+/* Functions for the retransmission timeout (RTO).  The sender measures
+   the round trip from when a frame should have left the line to when
+   its ACK arrives, but only for frames sent once - for a frame sent
+   again, it is not known which copy was acknowledged (Karn's rule).
+   As in TCP (RFC 6298), it keeps a smoothed round trip time and its
+   mean deviation, and waits for the smoothed time plus four deviations.
+   Each timeout doubles the RTO, until the next measurement.  With a
+   window, the frames have a timer each, but the RTO is doubled no more
+   than once in each RTO, as with the single timer of RFC 6298 - not
+   again for each frame of a lost window, as their timers expire one
+   after another.  */
+
+/* Function to take one measurement of the round trip time, and work
+   out the RTO again.
+   Argument:  leftAt - when the frame should have left the line, in us.  */
+static void rttSample(long long leftAt)
+{
+    double rtt = (PHY_timeUs() - leftAt) / 1.0e6; // round trip, in seconds
+    double err;                                    // difference from the smoothed time
+    if (rtt < 0.0)
+        rtt = 0.0; // the line was quicker than estimated
+    if (rttSamples++ == 0) // the first measurement
+    {
+        srtt = rtt;
+        rttvar = rtt / 2;
+    }
+    else
+    {
+        err = (rtt > srtt) ? rtt - srtt : srtt - rtt;
+        rttvar = 0.75 * rttvar + 0.25 * err;
+        srtt = 0.875 * srtt + 0.125 * rtt;
+    }
+    // Allow at least a timer tick for the deviation, as the timers are no finer
+    rto = srtt + ((4 * rttvar > TIMER_TICK / 1000.0) ? 4 * rttvar : TIMER_TICK / 1000.0);
+    if (rto < RTO_MIN)
+        rto = RTO_MIN;
+    if (rto > RTO_MAX)
+        rto = RTO_MAX;
+}
+
+// Function to double the RTO after a timeout, up to RTO_MAX, once in each RTO
+static void backOff(void)
+{
+    long long now = PHY_timeUs();
+    if (now < nextBackOff)
+        return; // already doubled for the timers expiring now
+    rto = (2 * rto < RTO_MAX) ? 2 * rto : RTO_MAX;
+    nextBackOff = now + (long long)(rto * 1.0e6);
+    if (debug)
+        printf("LLS: Timeout now %.3f s\n", rto);
+}
+
+/* Function to find when a frame's retransmission timer should expire.
+   Sending does not wait for the bytes to leave, so a frame behind a
+   window of others leaves well after it is sent - the RTO starts when
+   the last byte should have left the line.  A random extra of up to an
+   eighth of the RTO stops timers set together all expiring together.
+   Arguments: sizeFrame - number of bytes in the frame,
+              leftAt - pointer to where to put when it should have left.
+   Return value: the expiry time, in us.  */
+static long long retxDeadline(int sizeFrame, long long *leftAt)
+{
+    long long now = PHY_timeUs();
+    double jitter = (ERR_random(&rtoRandom) >> 11) * 0x1.0p-53; // 0 to 1
+    if (lineFree < now)
+        lineFree = now; // the line is idle
+    // 10 bits per byte, rounded up to 0.1 ms as the physical layer does
+    lineFree += 100LL * (1 + 100000 / options.bitRate) * sizeFrame;
+    *leftAt = lineFree;
+    return lineFree + (long long)(rto * (1.0 + jitter / 8) * 1.0e6);
+}
+
+// ===========================================================================
+/* Functions to adjust the optimum block size to the line (see linklayer.h).
+   A frame sent again means an earlier copy, or its ACK, was lost, so the
+   fraction of frames sent again is the frame error rate.  If each bit is
+   wrong with probability p, a frame of L bytes arrives with probability
+   (1 - p) to the power 8L, which gives p from the frame error rate.  */
+
+/* Function to find the largest data block that fits in a frame, with
+   some settings.  The frame size field limits a frame to 32767 bytes
+   after it (the top bit is FECBIT), including the sequence number,
+   header check byte (if used), check value and FEC parity, as well as
+   the MAX_BLK limit.  */
+static int largestBlock(const LL_options *opt)
+{
+    int maxCoded = 0x7FFF - 1 - (opt->headerCheck ? HCS_SIZE : 0); // bytes after the header
+    int maxBlock = maxCoded - (maxCoded + 254) / 255 * FEC_PARITY - CHK_size(opt->checksum);
+    return (maxBlock < MAX_BLK) ? maxBlock : MAX_BLK;
+}
+
+// Function to find the number of bytes in an ACK
+static int ackSize(void)
+{
+    return headerSize() + ((options.arq == ARQ_SELECTIVE) ? SACK_BYTES : 1) + trailerSize();
+}
+
+/* Function to find the chance of a frame and its ACK both arriving,
+   with a given bit error rate, with or without FEC.  Without FEC, one
+   wrong bit anywhere loses the frame; with it, the header and ACK must
+   still be right, but the rest can have a few wrong bytes in each
+   codeword (see FEC_probDecode).
+   Arguments: sizeBody - number of bytes after the header, before any FEC,
+              ber - probability of each bit being wrong,
+              fec - TRUE if FEC parity is added.
+   Return value: the probability, from 0 to 1.  */
+static double probArrive(int sizeBody, double ber, int fec)
+{
+    if (fec)
+        return exp(-8.0 * ber * (headerSize() + ackSize()))
+               * FEC_probDecode(sizeBody, -expm1(8.0 * log1p(-ber)));
+    return exp(-8.0 * ber * (headerSize() + sizeBody + ackSize()));
+}
+
+/* Function to predict the data carried per byte time of the line, with
+   a given block size and bit error rate, with or without FEC.  A frame
+   takes its own bytes, then the round trip for its ACK (or just the ACK,
+   if no round trip has been measured), unless a window of frames fills
+   that time.
+   Arguments: n - number of data bytes in each frame,
+              ber - probability of each bit being wrong,
+              fec - TRUE if FEC parity is added.
+   Return value: the predicted efficiency, from 0 to 1.  */
+static double predictEfficiency(int n, double ber, int fec)
+{
+    int sizeBody = n + trailerSize(); // bytes after the header, before any FEC
+    int sizeFrame = headerSize() + (fec ? FEC_CODEDSIZE(sizeBody) : sizeBody);
+    double rttBytes = (rttSamples > 0) ? srtt * options.bitRate / 10 : ackSize();
+    double cycle = sizeFrame + rttBytes; // byte times from sending a frame to its ACK
+    if (options.arq != ARQ_STOPWAIT) // the window shares out that time
+    {
+        cycle /= options.window;
+        if (cycle < sizeFrame)
+            cycle = sizeFrame; // the line is always busy
+    }
+    return n * probArrive(sizeBody, ber, fec) / cycle;
+}
+
+/* Function to find the bit error rate that would lose a given fraction
+   of frames with FEC, by halving the range it could be in (on a log
+   scale) until it is close enough.
+   Arguments: fer - frame error rate,
+              sizeBody - number of bytes after the header, before FEC.
+   Return value: the bit error rate.  */
+static double berFromLoss(double fer, int sizeBody)
+{
+    double low = 1.0e-9, high = 0.1; // range of bit error rates
+    double mid;
+    for (int i = 0; i < 30; i++)
+    {
+        mid = sqrt(low * high);
+        if (1.0 - probArrive(sizeBody, mid, TRUE) < fer)
+            low = mid;
+        else
+            high = mid;
+    }
+    return sqrt(low * high);
+}
+
+/* Function to choose the block size for the bit error rate measured,
+   and with FEC_AUTO, whether to use FEC.  Without adaptBlock, only FEC
+   is chosen.  It only changes either if the best choice should carry
+   more data by a fraction ADAPT_GAIN.  */
+static void chooseBlockSize(void)
+{
+    int minBlock = options.adaptBlock ? MIN_OPT_BLK : blockSize; // block sizes to try
+    int maxBlock = options.adaptBlock ? largestBlock(&options) : blockSize;
+    int best = blockSize; // best block size found so far
+    int bestFec = fecOn;  // and whether it uses FEC
+    double bestEff = predictEfficiency(blockSize, berEst, fecOn);
+    double eff;
+    for (int fec = FALSE; fec <= TRUE; fec++)
+    {
+        if ((options.fec != FEC_AUTO) && (fec != fecOn))
+            continue; // FEC stays as it is
+        for (int n = minBlock; n <= maxBlock; n++)
+        {
+            eff = predictEfficiency(n, berEst, fec);
+            if (eff > bestEff)
+            {
+                best = n;
+                bestFec = fec;
+                bestEff = eff;
+            }
+        }
+    }
+    if (bestEff > (1.0 + ADAPT_GAIN) * predictEfficiency(blockSize, berEst, fecOn))
+    {
+        if (debug)
+            printf("LL: Bit error rate %.2e, block size now %d (was %d), FEC %s\n",
+                   berEst, best, blockSize, bestFec ? "on" : "off");
+        blockSize = best;
+        fecOn = bestFec;
+    }
+}
+
+/* Function to count a frame sent, for the frame error rate.
+   Arguments: sizeFrame - number of bytes in the frame,
+              again - TRUE if the frame has been sent before.  */
+static void countForBlockSize(int sizeFrame, int again)
+{
+    adaptSent++;
+    adaptBytes += sizeFrame;
+    if (again)
+        adaptResent++;
+}
+
+/* Function to measure the bit error rate, once ADAPT_FRAMES frames
+   have been sent since the last time, or ADAPT_RESENT sent again,
+   and choose the block size.  */
+static void adaptBlockSize(void)
+{
+    int sent;     // frames to work out the error rate from
+    long bytes;   // number of bytes in them
+    double fer;   // frame error rate
+    double wrong; // fraction of bytes wrong, with FEC
+    double ber;   // bit error rate that would give it
+    double lossBer; // bit error rate that would lose the frames sent again, with FEC
+    if ((!options.adaptBlock && (options.fec != FEC_AUTO))
+        || ((adaptSent < ADAPT_FRAMES) && (adaptResent < ADAPT_RESENT)))
+        return;
+    /* Count half a frame sent again (or half a byte corrected), so a run
+       with no errors does not look like a perfect line.  While there are
+       none, the frames from earlier checks are counted too, so the longer
+       the line stays clean, the lower the error rate, and the block size
+       grows in steps.  */
+    sent = adaptSent + cleanSent;
+    bytes = adaptBytes + cleanBytes;
+    if (fecOn) // FEC hides most errors, but the receiver reports them
+    {
+        wrong = (adaptFixed + 0.5) / bytes;
+        if (wrong > 0.5)
+            wrong = 0.5; // the block size will be small anyway
+        ber = -log1p(-wrong) / 8.0;
+        /* A frame sent again was lost to an error in its header or ACK,
+           or too many in a codeword - if there are more than the bytes
+           corrected would explain, the error rate is higher.  */
+        if (adaptResent > 0)
+        {
+            fer = (adaptResent < 0.9 * sent) ? (double)adaptResent / sent : 0.9;
+            lossBer = berFromLoss(fer, (int)((bytes / sent - headerSize()) * FEC_MAXDATA / 255));
+            if (lossBer > ber)
+                ber = lossBer;
+        }
+    }
+    else
+    {
+        fer = (adaptResent + 0.5) / sent;
+        if (fer > 0.9)
+            fer = 0.9; // so the log is finite - the block size will be small anyway
+        ber = -log(1.0 - fer) / (8.0 * bytes / sent);
+    }
+    if ((berEst < 0.0) || ((adaptResent == 0) && (adaptFixed == 0) && (cleanSent > 0)))
+        berEst = ber; // the first, or over the whole run without errors
+    else
+        berEst = 0.75 * berEst + 0.25 * ber; // smooth it
+    cleanSent = ((adaptResent == 0) && (adaptFixed == 0)) ? sent : 0;
+    cleanBytes = ((adaptResent == 0) && (adaptFixed == 0)) ? bytes : 0;
+    adaptSent = 0;
+    adaptResent = 0;
+    adaptBytes = 0;
+    adaptFixed = 0;
+    chooseBlockSize();
+}
+
+/* Function to take the count of bytes corrected by the receiver from a
+   response, if it has one: it follows the type byte or bitmap.
+   Arguments: frameAck - the response, already checked,
+              sizeAck - number of bytes in it,
+              sizeType - number of bytes of type or bitmap.  */
+static void takeFixed(const byte_t *frameAck, int sizeAck, int sizeType)
+{
+    if (sizeAck == headerSize() + sizeType + 1 + trailerSize())
+        adaptFixed += frameAck[headerSize() + sizeType];
+}
+
+// ===========================================================================
+/* Functions for the sliding window (ARQ_GOBACKN and ARQ_SELECTIVE).  The
+   sender keeps each frame it has sent in txFrames, until it is
+   acknowledged, so it can send it again without building it again.  The
+   window moves on from txBase as frames are acknowledged, so the slot
+   for a frame is its sequence number modulo MAX_WINDOW.  The receiver
+   keeps blocks that arrive out of order in the same way, in rxData.  */
+
+/* Function to find how many steps a sequence number is after another,
+   modulo MOD_SEQNUM, from 0 to MOD_SEQNUM - 1.  */
+static int seqDiff(int later, int earlier)
+{
+    return ((later - earlier) % MOD_SEQNUM + MOD_SEQNUM) % MOD_SEQNUM;
+}
+
+/* Function to mark one frame as acknowledged and stop its timer.
+   A frame sent only once shows that the frames sent before it should
+   have arrived by now - if it was sent again, it is not known which
+   copy arrived.  The newest such frame gives the round trip time.  */
+static void ackFrame(int seq)
+{
+    int slot = seq % MAX_WINDOW;
+    if (txAcked[slot])
+        return; // already done
+    TIM_cancel(&timers, &retxTimer[seq]);
+    dataBytesTX += txData[slot]; // count the data bytes for the report
+    txAcked[slot] = TRUE;
+    if ((txTries[slot] == 1) && (txOrder[slot] > orderSeen))
+    {
+        orderSeen = txOrder[slot];
+        sampleFrom = txLeft[slot];
+    }
+}
+
+/* Function to mark frames as acknowledged, from txBase up to and
+   including seqAck, and move the window on past them.  */
+static void ackUpTo(int seqAck)
+{
+    int n = seqDiff(seqAck, txBase) + 1; // number of frames acknowledged
+    while ((n-- > 0) && (txCount > 0))
+    {
+        ackFrame(txBase);
+        txAcked[txBase % MAX_WINDOW] = FALSE; // the slot is free
+        txBase = next(txBase);
+        txCount--;
+        txBacks = 0; // the oldest frame is a new one
+    }
+}
+
+/* Function to send one frame again (ARQ_SELECTIVE), and restart its timer.
+   Argument:  seq - the sequence number of the frame.
+   Return value: 0 for success, GIVEUP if the frame has been sent
+   MAX_TRIES times, FAILURE if it could not be sent.  */
+static int sendAgain(int seq)
+{
+    int slot = seq % MAX_WINDOW;
+    if (txTries[slot] >= MAX_TRIES)
+    {
+        printf("LLS: Block %d, tried %d times, failed\n", seq, txTries[slot]);
+        return GIVEUP; // tried enough times, giving up
+    }
+    if (sendFrame(txFrames[slot], txSizes[slot]) != txSizes[slot])
+    {
+        printf("LLS: Block %d, failed to send frame\n", seq);
+        return FAILURE; // problem code
+    }
+    framesSent++; // increment frame counter (for report)
+    countForBlockSize(txSizes[slot], TRUE);
+    txTries[slot]++;
+    txOrder[slot] = ++sendCount;
+    if (debug)
+        printf("LLS: Sent block %d again, attempt %d\n", seq, txTries[slot]);
+    TIM_arm(&timers, &retxTimer[seq], retxDeadline(txSizes[slot], &txLeft[slot]));
+    return SUCCESS;
+}
+
+/* Function to act on a selective ACK (ARQ_SELECTIVE).  It marks the
+   frames acknowledged, moves the window on, then sends again each frame
+   not acknowledged that was sent before a frame that has arrived - the
+   line keeps frames in order, so it must have been lost.
+   Argument:  frameAck - the ACK frame, already checked.
+   Return value: 0 for success, negative for failure.  */
+static int takeSack(const byte_t *frameAck)
+{
+    const byte_t *sack = frameAck + headerSize(); // the bitmap
+    int seqAck = (int)frameAck[SEQNUMPOS];       // last block received in order
+    int i, seq, retVal;
+
+    if (seqDiff(seqAck, txBase) < txCount) // ignore if already acknowledged
+        ackUpTo(seqAck);
+    for (i = 0; i < 8 * SACK_BYTES; i++) // blocks received after a missing one
+    {
+        seq = (seqAck + 1 + i) % MOD_SEQNUM;
+        if ((sack[i / 8] & (0x80 >> (i % 8))) && (seqDiff(seq, txBase) < txCount))
+            ackFrame(seq);
+    }
+    while ((txCount > 0) && txAcked[txBase % MAX_WINDOW]) // move the window on
+        ackUpTo(txBase);
+
+    for (i = 0; i < txCount; i++) // send again the frames that must be lost
+    {
+        seq = (txBase + i) % MOD_SEQNUM;
+        if (!txAcked[seq % MAX_WINDOW] && (txOrder[seq % MAX_WINDOW] < orderSeen))
+        {
+            retVal = sendAgain(seq);
+            if (retVal != SUCCESS)
+                return retVal;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Function to go back: send again all the frames not yet acknowledged,
+   from the oldest, and restart their timers.
+   Return value: 0 for success, GIVEUP if the oldest frame has been
+   sent MAX_TRIES times, FAILURE if a frame could not be sent.  */
+static int goBack(void)
+{
+    int i, seq, slot;
+    if (++txBacks >= MAX_TRIES)
+    {
+        printf("LLS: Block %d, tried %d times, failed\n", txBase, txBacks);
+        return GIVEUP; // tried enough times, giving up
+    }
+    if (debug)
+        printf("LLS: Going back to block %d, sending %d frames again\n",
+               txBase, txCount);
+    for (i = 0; i < txCount; i++)
+    {
+        seq = (txBase + i) % MOD_SEQNUM;
+        slot = seq % MAX_WINDOW;
+        if (sendFrame(txFrames[slot], txSizes[slot]) != txSizes[slot])
+        {
+            printf("LLS: Block %d, failed to send frame\n", seq);
+            return FAILURE; // problem code
+        }
+        framesSent++; // increment frame counter (for report)
+        countForBlockSize(txSizes[slot], TRUE);
+        txTries[slot]++;
+        txOrder[slot] = ++sendCount;
+        TIM_arm(&timers, &retxTimer[seq], retxDeadline(txSizes[slot], &txLeft[slot]));
+        if (i == 0)
+            backDone = lineFree;
+    }
+    return SUCCESS;
+}
+
+/* Function to receive responses until no more than a given number of
+   frames are waiting to be acknowledged.  With ARQ_SELECTIVE, see
+   takeSack(), and a frame whose timer expires is sent again.
+   With ARQ_GOBACKN, an ACK acknowledges its block
+   and all before it.  A NAK asks for its block, so acknowledges all
+   before it, and the sender goes back to it - unless it is a NAK for
+   the oldest frame, and that has not yet left the line since the last
+   time the sender went back, so the NAK was caused by the frames before
+   that.  If the oldest frame's timer expires, the sender also goes back.
+   Each response that acknowledges a frame sent once gives a round trip time.
+   Argument:  most - number of frames that can be left waiting.
+   Return value: 0 for success, negative for failure.  */
+static int waitForAcks(int most)
+{
+    static _Thread_local byte_t frameAck[ACK_MAXSIZE]; // array large enough for any ack
+    int sizeAck;      // size of ACK frame received
+    int seqAck;       // sequence number in response received
+    int ahead;        // steps from the oldest frame to seqAck
+    int retVal;       // return value from functions
+    long long expiry; // when the next timer expires
+    TIM_timer *timer; // a timer that has expired
+
+    while (txCount > most)
+    {
+        expiry = TIM_nextExpiry(&timers);
+        if (expiry < 0) // no timers running: the frames left have been given up
+            return GIVEUP;
+        sizeAck = getFrame(frameAck, ACK_MAXSIZE, (float)TIM_secondsLeft(expiry));
+        if (sizeAck < 0) // some problem receiving
+            return FAILURE;
+
+        else if (sizeAck == 0) // time limit reached, or no valid frame
+        {
+            if (!TIM_passed(expiry))
+                continue; // no timer has expired yet
+            timeouts++; // increment counter for report
+            retVal = SUCCESS;
+            while ((timer = TIM_nextExpired(&timers, PHY_timeUs())) != NULL)
+            {
+                if (debug)
+                    printf("LLS: Timeout waiting for response, block %d\n", timer->id);
+                backOff(); // the line is slower than thought, or frames are being lost
+                if ((options.arq == ARQ_SELECTIVE) && (retVal == SUCCESS))
+                    retVal = sendAgain(timer->id); // just this frame
+            }
+            if (options.arq == ARQ_GOBACKN) // all the frames, restarting their timers
+                retVal = goBack();
+            if (retVal != SUCCESS)
+                return retVal;
+        }
+        else if (checkFrame(frameAck, sizeAck) == FRAMEBAD) // bad frame received
+        {
+            badFrames++; // increment counter for report
+            if (debug)
+                printf("LLS: Bad frame received\n");
+        }
+        else if (options.arq == ARQ_SELECTIVE) // good selective ACK
+        {
+            goodFrames++; // increment counter for report
+            acksRX++;
+            if (debug)
+                printf("LLS: Selective ACK received, seq %d, waiting from %d\n",
+                       (int)frameAck[SEQNUMPOS], txBase);
+            takeFixed(frameAck, sizeAck, SACK_BYTES);
+            retVal = takeSack(frameAck);
+            if (retVal != SUCCESS)
+                return retVal;
+        }
+        else // good response - an ACK or a NAK
+        {
+            goodFrames++; // increment counter for report
+            takeFixed(frameAck, sizeAck, 1);
+            seqAck = (int)frameAck[SEQNUMPOS];
+            ahead = seqDiff(seqAck, txBase);
+            if (frameAck[headerSize()] == POSACK)
+            {
+                acksRX++; // increment counter for report
+                if (debug)
+                    printf("LLS: ACK received, seq %d, waiting from %d\n", seqAck, txBase);
+                if (ahead < txCount) // ignore an ACK for blocks already acknowledged
+                    ackUpTo(seqAck);
+            }
+            else
+            {
+                naksRX++; // increment counter for report
+                if (debug)
+                    printf("LLS: NAK received, seq %d, waiting from %d\n", seqAck, txBase);
+                if ((ahead == 0) && (PHY_timeUs() < backDone))
+                {
+                    if (debug)
+                        printf("LLS: Already sending block %d again\n", seqAck);
+                }
+                else if (ahead <= txCount) // ignore a NAK for a block already acknowledged
+                {
+                    if (ahead > 0) // all the blocks before it have arrived
+                        ackUpTo((seqAck + MOD_SEQNUM - 1) % MOD_SEQNUM);
+                    if (txCount > 0) // send the rest again, from the one asked for
+                    {
+                        retVal = goBack();
+                        if (retVal != SUCCESS)
+                            return retVal;
+                    }
+                }
+            }
+        }
+        if (sampleFrom >= 0) // a frame sent once has been acknowledged
+        {
+            rttSample(sampleFrom);
+            sampleFrom = -1;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Function to send a block of data in a frame, within the window.
+   It waits for responses until there is room in the window, then
+   builds the frame in the retransmit buffer and sends it.
+   Arguments:  dataTX - pointer to array of data bytes to send,
+               nTXdata - number of data bytes to send.
+   Return value:  0 for success, negative for failure  */
+static int sendInWindow(byte_t *dataTX, int nTXdata)
+{
+    int slot = seqNumTX % MAX_WINDOW;          // where to keep the frame
+    int retVal = waitForAcks(options.window - 1); // wait for room in the window
+    if (retVal != SUCCESS)
+        return retVal;
+
+    txSizes[slot] = buildDataFrame(txFrames[slot], dataTX, nTXdata, seqNumTX);
+    txData[slot] = nTXdata;
+    txTries[slot] = 1;
+    txOrder[slot] = ++sendCount;
+    txAcked[slot] = FALSE;
+    if (sendFrame(txFrames[slot], txSizes[slot]) != txSizes[slot]) // problem!
+    {
+        printf("LLS: Block %d, failed to send frame\n", seqNumTX);
+        return FAILURE; // problem code
+    }
+    framesSent++; // increment frame counter (for report)
+    countForBlockSize(txSizes[slot], FALSE);
+    txCount++;
+    if (debug)
+        printf("LLS: Sent frame of %d bytes, block %d, %d in window\n",
+               txSizes[slot], seqNumTX, txCount);
+    TIM_arm(&timers, &retxTimer[seqNumTX], retxDeadline(txSizes[slot], &txLeft[slot]));
+    seqNumTX = next(seqNumTX); // increment the sequence number
+    return SUCCESS;
+}
+
+// ===========================================================================
+/* Functions to combine copies of a bad frame (see HARQ_COPIES).  The
+   copies of a frame are kept in the slot for its sequence number, as
+   blocks are in rxData, and only combined with a frame of the same
+   sequence number and size.  A good frame clears its slot, so a later
+   frame with that sequence number is not combined with the wrong copies.  */
+
+// Helper function to find the bitwise majority vote of three copies of n bytes
+static void voteBytes(byte_t *dest, const byte_t *a, const byte_t *b, const byte_t *c, int n)
+{
+    for (int i = 0; i < n; i++)
+        dest[i] = (byte_t)((a[i] & b[i]) | (a[i] & c[i]) | (b[i] & c[i]));
+}
+
+// Function to forget the copies kept of a frame, once a good one has arrived
+static void forgetCopies(const byte_t *frame)
+{
+    int slot = frame[SEQNUMPOS] % MAX_WINDOW;
+    if (copySeq[slot] == frame[SEQNUMPOS])
+        copyCount[slot] = 0;
+}
+
+/* Helper function to try each mixture of two copies of a frame, where
+   they differ in a few bytes, until one passes the check.
+   Arguments: frameRX - the frame, changed to the mixture that passes,
+              copy - the other copy, sizeFrame - the number of bytes.
+   Return value: FRAMEGOOD if a mixture passes the check, FRAMEBAD if not.  */
+static int mixCopies(byte_t *frameRX, const byte_t *copy, int sizeFrame)
+{
+    byte_t own[HARQ_FLIPS]; // this frame's bytes where they differ
+    int at[HARQ_FLIPS];     // positions of those bytes
+    int nDiff = 0;          // number of them
+    int i, mix, gray;
+
+    for (i = 1; i < sizeFrame; i++)
+        if (frameRX[i] != copy[i])
+        {
+            if (nDiff == HARQ_FLIPS)
+                return FRAMEBAD; // too many to try
+            own[nDiff] = frameRX[i];
+            at[nDiff++] = i;
+        }
+    /* Bit i of the mixture is set if byte at[i] comes from the other
+       copy.  The mixtures are taken in Gray code order, so only one
+       byte changes each time - the lowest bit set in the count gives
+       the bit of the Gray code that changes.  */
+    for (mix = 1; mix < (1 << nDiff); mix++)
+    {
+        for (i = 0; !(mix & (1 << i)); i++)
+            ;
+        gray = mix ^ (mix >> 1);
+        frameRX[at[i]] = (gray & (1 << i)) ? copy[at[i]] : own[i];
+        if (checkTrailer(frameRX, sizeFrame) == FRAMEGOOD)
+            return FRAMEGOOD;
+    }
+    for (i = 0; i < nDiff; i++)
+        frameRX[at[i]] = own[i]; // back as it arrived
+    return FRAMEBAD;
+}
+
+// ===========================================================================
+/* Function to put the bytes of a frame received with FEC parity back in
+   order, correct them, take the parity out and put the size of the
+   frame without it in the header, then check the trailer.  The header
+   check, if used, is made again for the new size - the header itself
+   was checked as it arrived.  The frame is only changed if it is good,
+   so a bad one can be kept as it arrived, to combine with the next copy.
+   Arguments: frameRX - pointer to the frame,
+              sizeFrame - pointer to the number of bytes in the frame,
+              changed to the number without the parity, if corrected,
+              slot - the copies of the frame to combine with it (see
+              combineFrame), or -1 for none.
+   Return value: FRAMEGOOD if the frame is good after correction,
+                 FRAMEBAD if not.  */
+static int decodeFrame(byte_t *frameRX, int *sizeFrame, int slot)
+{
+    static _Thread_local byte_t coded[HARQ_COPIES + 2][MAX_FRAME]; // coded bytes of each copy, back in order, and their vote
+    byte_t *copies[HARQ_COPIES + 2]; // pointers to them, for FEC_decodeCopies
+    byte_t header[HEADERSIZE + HCS_SIZE]; // the header as it would be without FEC
+    int sizeHeader = headerSize(); // bytes before the coded bytes
+    int nCoded = *sizeFrame - sizeHeader; // number of coded bytes
+    int words = FEC_WORDS(nCoded); // number of codewords
+    int nCopies = 1;               // number of copies to decode from
+    int fixed;                     // number of bytes corrected
+    int sizeBody;                  // number of bytes after the header, once decoded
+    long delay = FEC_deinterleave(coded[0], frameRX + sizeHeader, nCoded, options.interleave);
+    CHK_state check;               // check value of the frame without FEC
+
+    if (slot < 0)
+        sizeBody = FEC_decode(coded[0], nCoded, &fixed);
+    else
+    {
+        for (int c = 0; c < copyCount[slot]; c++)
+            FEC_deinterleave(coded[nCopies++], rxCopies[slot][c] + sizeHeader, nCoded,
+                             options.interleave);
+        if (nCopies >= 3)
+            voteBytes(coded[nCopies++], coded[0], coded[1], coded[2], nCoded);
+        for (int c = 0; c < nCopies; c++)
+            copies[c] = coded[c];
+        sizeBody = FEC_decodeCopies(copies, nCopies, nCoded, &fixed);
+    }
+    if (sizeBody >= trailerSize()) // check the trailer, with the header as it would be without FEC
+    {
+        memcpy(header, frameRX, sizeHeader);
+        putFrameSize(header, sizeHeader + sizeBody);
+        if (options.headerCheck)
+            header[HCSPOS] = makeHCS(header);
+        CHK_start(&check, options.checksum);
+        CHK_update(&check, header + 1, sizeHeader - 1);
+        CHK_update(&check, coded[0], sizeBody - trailerSize());
+        if (CHK_finish(&check) != CHK_read(options.checksum, coded[0] + sizeBody - trailerSize()))
+            sizeBody = -1;
+    }
+    else
+        sizeBody = -1;
+    if (sizeBody < 0)
+    {
+        if (debug && (slot < 0))
+            printf("LLGF: FEC could not correct the frame\n");
+        return FRAMEBAD;
+    }
+    memcpy(frameRX, header, sizeHeader);
+    memcpy(frameRX + sizeHeader, coded[0], sizeBody);
+    *sizeFrame = sizeHeader + sizeBody;
+    fecFrames++;   // count for the report
+    fecFixed += fixed;
+    ilvBytes += delay;
+    ilvWords += words;
+    fixedToReport += fixed; // for the next response
+    if (debug && (fixed > 0))
+        printf("LLGF: FEC corrected %d bytes\n", fixed);
+    return FRAMEGOOD;
+}
+
+// ===========================================================================
+/* Function to try to put right a bad frame by combining it with the
+   copies of it kept before (see HARQ_COPIES).  If that fails, the frame
+   is kept, in place of the oldest copy if need be.
+   Arguments: frameRX - pointer to the frame, as it arrived,
+              sizeFrame - pointer to the number of bytes in the frame,
+              changed to the number without any FEC parity, if put right.
+   Return value: FRAMEGOOD if the frame has been put right, FRAMEBAD if not.  */
+static int combineFrame(byte_t *frameRX, int *sizeFrame)
+{
+    static _Thread_local byte_t vote[MAX_FRAME]; // majority vote of three copies
+    int slot = frameRX[SEQNUMPOS] % MAX_WINDOW; // where the copies are kept
+    int size = *sizeFrame;  // number of bytes in the frame, as it arrived
+    int have;               // number of copies kept
+    int status = FRAMEBAD;  // result
+
+    if (!options.harq || (size <= HEADERSIZE) || (size > MAX_FRAME)
+        || (frameSize(frameRX) != size)) // cut short, or not a frame at all
+        return FRAMEBAD;
+    if ((copySeq[slot] != frameRX[SEQNUMPOS]) || (copySize[slot] != size))
+        copyCount[slot] = 0; // copies of another frame - start again
+    have = copyCount[slot];
+
+    if (have > 0)
+    {
+        if (frameRX[FRAMENUMBERPOS] & FECBIT)
+            status = decodeFrame(frameRX, sizeFrame, slot);
+        else if ((have >= 2)
+                 && ((options.checksum == CHK_CRC16) || (options.checksum == CHK_CRC32)))
+        {
+            voteBytes(vote, frameRX, rxCopies[slot][0], rxCopies[slot][1], size);
+            status = checkTrailer(vote, size);
+            if (status == FRAMEGOOD)
+                memcpy(frameRX, vote, size);
+        }
+        else if (options.checksum == CHK_CRC32)
+            status = mixCopies(frameRX, rxCopies[slot][0], size);
+    }
+    if (status == FRAMEGOOD)
+    {
+        copyCount[slot] = 0;
+        harqFrames++; // count for the report
+        if (debug)
+            printf("LLR: Bad frame put right with %d earlier copies\n", have);
+        return FRAMEGOOD;
+    }
+
+    // Keep this copy for next time, in place of the oldest
+    if (have == HARQ_COPIES)
+    {
+        for (int c = 1; c < HARQ_COPIES; c++)
+            memcpy(rxCopies[slot][c - 1], rxCopies[slot][c], size);
+        have--;
+    }
+    memcpy(rxCopies[slot][have], frameRX, size);
+    copyCount[slot] = have + 1;
+    copySeq[slot] = frameRX[SEQNUMPOS];
+    copySize[slot] = size;
+    return FRAMEBAD;
+}
+
+// ===========================================================================
+/* Function to check a data frame received, and if it is bad, try to put
+   it right with the copies of it kept before.  Only data frames are
+   combined - a response to the same sequence number can be different
+   each time.
+   Arguments: frameRX - pointer to the frame,
+              sizeFrame - pointer to the number of bytes in the frame,
+              changed if the frame is put right.
+   Return value: FRAMEGOOD or FRAMEBAD, as for checkFrame.  */
+static int checkDataFrame(byte_t *frameRX, int *sizeFrame)
+{
+    if (checkFrame(frameRX, *sizeFrame) == FRAMEGOOD)
+    {
+        forgetCopies(frameRX);
+        return FRAMEGOOD;
+    }
+    return combineFrame(frameRX, sizeFrame);
+}
+
+/* Function to receive a block of data, with selective repeat.  Good
+   blocks in the window are kept in rxData until all the blocks before
+   them have arrived, then delivered in order, one for each call.
+   Every good frame is answered with a selective ACK, so the sender
+   knows which blocks are missing.
+   Arguments:  dataRX - pointer to an array to hold the data block,
+               maxData - maximum size of the data block.
+   Return value: the size of the data block, or negative on failure.  */
+static int receiveSelective(byte_t *dataRX, int maxData)
+{
+    static _Thread_local byte_t frameRX[MAX_FRAME]; // array to hold a frame
+    byte_t sack[SACK_BYTES];  // bitmap for the selective ACK
+    int sizeRXframe;          // number of bytes in the frame received
+    int seqNumRX;             // sequence number of the received frame
+    int nRXdata;              // number of data bytes delivered
+    int slot;                 // place for a block in rxData
+    int attempts = 0;         // attempt counter
+    int idle = 0;             // timeouts in a row
+    int i, seq;
+
+    do
+    {
+        // First deliver the next block, if it has arrived already
+        slot = deliverSeq % MAX_WINDOW;
+        if (rxHave[slot])
+        {
+            nRXdata = (rxSizes[slot] < maxData) ? rxSizes[slot] : maxData;
+            memcpy(dataRX, rxData[slot], nRXdata);
+            rxHave[slot] = FALSE;
+            deliverSeq = next(deliverSeq);
+            dataBytesRX += nRXdata; // count the data bytes for the report
+            return nRXdata;
+        }
+
+        sizeRXframe = getFrame(frameRX, MAX_FRAME, RX_WAIT);
+        if (sizeRXframe < 0) // some problem receiving
+            return FAILURE;  // quit if there was a problem
+
+        attempts++;           // increment the attempt counter
+        idle = (sizeRXframe == 0) ? idle + 1 : 0;
+        if (sizeRXframe == 0) // a timeout occurred
+        {
+            printf("LLR: Timeout trying to receive frame, attempt %d\n",
+                   attempts);
+            timeouts++; // increment the counter for the report
+        }
+        else if (checkDataFrame(frameRX, &sizeRXframe) == FRAMEBAD) // frame is bad
+        {
+            badFrames++; // increment the bad frame counter
+            if (debug)
+                printf("LLR: Bad frame received\n");
+        }
+        else // good frame - keep it if it is new and in the window
+        {
+            goodFrames++; // increment the good frame counter
+            seqNumRX = (int)frameRX[SEQNUMPOS];
+            slot = seqNumRX % MAX_WINDOW;
+            if ((seqDiff(seqNumRX, deliverSeq) < options.window) && !rxHave[slot])
+            {
+                rxSizes[slot] = processFrame(frameRX, sizeRXframe, rxData[slot],
+                                             MAX_BLK, &seqNumRX);
+                rxHave[slot] = TRUE;
+                // Move on past the blocks now received in order
+                while ((seqDiff(next(lastSeqRX), deliverSeq) < options.window)
+                       && rxHave[next(lastSeqRX) % MAX_WINDOW])
+                    lastSeqRX = next(lastSeqRX);
+                if (debug)
+                    printf("LLR: Received block %d with %d data bytes, in order to %d\n",
+                           seqNumRX, rxSizes[slot], lastSeqRX % MOD_SEQNUM);
+            }
+            else if (debug)
+                printf("LLR: Duplicate rx seq. %d, expected %d\n",
+                       seqNumRX, deliverSeq);
+
+            // Acknowledge the blocks received in order, and those after them
+            memset(sack, 0, SACK_BYTES);
+            for (i = 0; i < 8 * SACK_BYTES; i++)
+            {
+                seq = (lastSeqRX + 1 + i) % MOD_SEQNUM;
+                if ((seqDiff(seq, deliverSeq) < options.window) && rxHave[seq % MAX_WINDOW])
+                    sack[i / 8] |= (byte_t)(0x80 >> (i % 8));
+            }
+            sendSack(lastSeqRX, sack);
+        }
+    } // repeat all this until a block can be delivered or reach the limit
+    while ((attempts < MAX_TRIES * options.window) && (idle < MAX_TRIES));
+
+    if (debug)
+        printf("LLR: Tried to receive a frame %d times, failed\n", attempts);
+    return GIVEUP; // tried enough times, giving up
+}
 
 // ===========================================================================
 /* Function to connect to another computer.
@@ -46,10 +1058,10 @@ static int debug = 1;         // debug value - controls printing
    Return value: 0 for success, negative for failure  */
 int LL_connect(int portNum, int debugIn)
 {
-    /* Try to connect using port number given, bit rate as in header file,
+    /* Try to connect using port number given, bit rate from the options,
        always uses 8 data bits, no parity, fixed time limits.  */
     debugIn = 1;
-    int status = PHY_open(portNum, BIT_RATE, 8, 0, 1000, 50, PROB_ERR);
+    int status = PHY_open(portNum, options.bitRate, 8, 0, 1000, RX_GAP, PROB_ERR);
     if (status == SUCCESS) // check if succeeded
     {
         connected = TRUE;               // record that we are connected
@@ -69,9 +1081,60 @@ int LL_connect(int portNum, int debugIn)
         badFrames = 0;
         goodFrames = 0;
         timeouts = 0;
-        connectTime = clock(); // capture time when connection was established
+        dataBytesTX = 0;
+        dataBytesRX = 0;
+        RXB_clear(&rxBuffer);           // nothing received yet
+        resyncLeft = 0;
+        resyncs = 0;
+        badHeaders = 0;
+        txBase = seqNumTX;              // no frames waiting for an ACK
+        txCount = 0;
+        txBacks = 0;
+        lineFree = 0;
+        backDone = 0;
+        rejSent = FALSE;
+        rejAhead = 0;
+        sendCount = 0;
+        orderSeen = 0;
+        sampleFrom = -1;
+        rttSamples = 0;                 // no round trip measured yet
+        srtt = 0.0;
+        rttvar = 0.0;
+        rto = RTO_INIT;
+        nextBackOff = 0;
+        adaptSent = 0;                  // no frames sent at this block size yet
+        adaptResent = 0;
+        adaptBytes = 0;
+        cleanSent = 0;
+        cleanBytes = 0;
+        adaptFixed = 0;
+        fecFrames = 0;
+        fecFixed = 0;
+        ilvBytes = 0;
+        ilvWords = 0;
+        fixedToReport = 0;
+        harqFrames = 0;
+        blockSize = options.optBlock;   // start from the settings, or
+        fecOn = (options.fec == FEC_ON);
+        if ((options.adaptBlock || (options.fec == FEC_AUTO)) && (berEst >= 0.0))
+            chooseBlockSize();          // from the error rate on the last connection
+        deliverSeq = 0;                 // the first block to deliver
+        for (int slot = 0; slot < MAX_WINDOW; slot++)
+        {
+            txAcked[slot] = FALSE;
+            rxHave[slot] = FALSE;       // no blocks waiting to be delivered
+            copyCount[slot] = 0;        // no bad frames kept
+        }
+        TIM_wheelInit(&timers, TIMER_TICK); // no timers running yet
+        for (int seq = 0; seq < MOD_SEQNUM; seq++)
+            TIM_timerInit(&retxTimer[seq], seq);
+        connectTime = PHY_timeUs(); // capture time when connection was established
+        disconTime = connectTime;
+        rtoRandom = (uint64_t)connectTime; // a different jitter for each connection
         if (debug)
-            printf("LL: Connected\n");
+            printf("LL: Connected, checksum %s, CRC-32 by %s, %s, FEC %s\n",
+                   CHK_name(options.checksum), CHK_engine(), arqNames[options.arq],
+                   fecNames[options.fec]);
         return SUCCESS;
     }
     else // failed
@@ -85,14 +1148,18 @@ int LL_connect(int portNum, int debugIn)
 
 // ===========================================================================
 /* Function to disconnect from the other computer.
+   First it waits for the frames not yet acknowledged, if any (with a window).
    It calls PHY_close() and prints a report of what happened while connected.
    Return value: 0 for success, negative for failure.  */
 int LL_discon(void)
 {
-    long elapsedTime = clock() - connectTime;               // measure time connected
-    float connTime = ((float)elapsedTime) / CLOCKS_PER_SEC; // convert to seconds
+    int drained = (connected && (txCount > 0)) ? waitForAcks(0) : SUCCESS; // finish sending
+    long long elapsedTime = PHY_timeUs() - connectTime;     // measure time connected
+    float connTime = ((float)elapsedTime) / 1.0e6f;         // convert to seconds
+    long dataBytes = dataBytesTX + dataBytesRX;             // data carried, either way
     int status = PHY_close();                               // try to disconnect
     connected = FALSE;                                      // assume we are no longer connected
+    disconTime = connectTime + elapsedTime;                 // keep for LL_getStats
     if (status == SUCCESS)                                  // check if succeeded
     {
         /* Print the report, including all the counters, as
@@ -101,8 +1168,37 @@ int LL_discon(void)
                connTime, framesSent);
         printf("LL: Received %d good and %d bad frames, had %d timeouts\n",
                goodFrames, badFrames, timeouts);
+        if (resyncs > 0)
+            printf("LL: Found %d frames by searching bad frames again\n", resyncs);
+        if (badHeaders > 0)
+            printf("LL: Rejected %d frames by the header check\n", badHeaders);
         printf("LL: Sent %d ACKs and %d NAKs\n", acksSent, naksSent);
         printf("LL: Received %d ACKs and %d NAKs\n", acksRX, naksRX);
+        if (rttSamples > 0)
+            printf("LL: Round trip %.1f ms, deviation %.1f ms (%d measured), timeout %.1f ms\n",
+                   1000.0 * srtt, 1000.0 * rttvar, rttSamples, 1000.0 * rto);
+        if (fecFrames > 0)
+            printf("LL: Received %d frames with FEC, corrected %d bytes\n",
+                   fecFrames, fecFixed);
+        if (harqFrames > 0)
+            printf("LL: Put right %d bad frames by combining copies\n", harqFrames);
+        if ((ilvWords > 0) && (options.interleave > 1))
+            printf("LL: Interleaving %d codewords held back each one %.1f ms on average\n",
+                   options.interleave, 10000.0 * ilvBytes / ilvWords / options.bitRate);
+        if ((options.adaptBlock || (options.fec == FEC_AUTO)) && (berEst >= 0.0))
+            printf("LL: Bit error rate measured %.2e, optimum block size %d, FEC %s\n",
+                   berEst, blockSize, fecOn ? "on" : "off");
+        /* Goodput is the rate of useful data carried, and efficiency
+           compares that with the bit rate of the line.  */
+        if ((dataBytes > 0) && (connTime > 0.0f))
+            printf("LL: Carried %ld data bytes, goodput %.1f bit/s, efficiency %.1f%%\n",
+                   dataBytes, 8.0f * dataBytes / connTime,
+                   800.0f * dataBytes / connTime / options.bitRate);
+        if (drained != SUCCESS)
+        {
+            printf("LL: %d blocks sent were not acknowledged\n", txCount);
+            return drained;
+        }
         return SUCCESS;
     }
     else // failed
@@ -114,16 +1210,16 @@ int LL_discon(void)
 
 // ===========================================================================
 /* Function to send a block of data in a frame - basic version.
-   If connected, it builds a frame, then sends the frame using PHY_send.
+   If connected, it builds a frame, then sends the frame using sendFrame.
    If this succeeds, it advances the sequence number and returns.
    Arguments:  dataTX - pointer to array of data bytes to send,
                nTXdata - number of data bytes to send.
    Return value:  0 for success, negative for failure  */
 int LL_send_basic(byte_t *dataTX, int nTXdata)
 {
-    static byte_t frameTX[3 * MAX_BLK]; // array large enough for frame
+    static _Thread_local byte_t frameTX[MAX_FRAME]; // array large enough for any frame
     int sizeTXframe = 0;                // size of frame being transmitted
-    int numSent;                        // number of bytes sent by PHY_send
+    int numSent;                        // number of bytes sent by sendFrame
 
     // First check if connected
     if (connected == FALSE)
@@ -144,8 +1240,8 @@ int LL_send_basic(byte_t *dataTX, int nTXdata)
     sizeTXframe = buildDataFrame(frameTX, dataTX, nTXdata, seqNumTX);
 
     // Send the frame, then check for problems
-    numSent = PHY_send(frameTX, sizeTXframe); // send frame bytes
-    if (numSent != sizeTXframe)               // problem!
+    numSent = sendFrame(frameTX, sizeTXframe); // send frame bytes
+    if (numSent != sizeTXframe)                // problem!
     {
         printf("LLS: Block %d, failed to send frame\n", seqNumTX);
         return FAILURE; // problem code
@@ -169,14 +1265,16 @@ int LL_send_basic(byte_t *dataTX, int nTXdata)
    Return value:  0 for success, negative for failure  */
 int LL_send_LLC(byte_t *dataTX, int nTXdata)
 {
-    static byte_t frameTX[3 * MAX_BLK]; // array large enough for frame
-    static byte_t frameAck[ACK_SIZE];   // allow extra bytes for stuffing
+    static _Thread_local byte_t frameTX[MAX_FRAME]; // array large enough for any frame
+    static _Thread_local byte_t frameAck[ACK_MAXSIZE]; // array large enough for any ack
     int sizeTXframe = 0;                // size of frame being transmitted
     int sizeAck = 0;                    // size of ACK frame received
     int seqAck;                         // sequence number in response received
     int attempts = 0;                   // number of attempts to send this data block
     int success = FALSE;                // flag to indicate block sent and ACKed
-    int numSent;                        // number of bytes sent by PHY_send
+    int stale = FALSE;                  // flag to wait on, after an ACK for the block before
+    int numSent;                        // number of bytes sent by sendFrame
+    long long leftAt = 0;               // when the frame should have left the line
 
     // First check if connected
     if (connected == FALSE)
@@ -193,6 +1291,12 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
         return BADUSE; // problem code
     }
 
+    adaptBlockSize(); // check the block size, now and then
+
+    // With a window, the frame is sent now, and acknowledged later
+    if (options.arq != ARQ_STOPWAIT)
+        return sendInWindow(dataTX, nTXdata);
+
     // Build the frame - sizeTXframe is the number of bytes in the framcheckFramee
     sizeTXframe = buildDataFrame(frameTX, dataTX, nTXdata, seqNumTX);
 
@@ -200,32 +1304,51 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
        Repeat until success - a positive response is received.  */
     do
     {
-        // Send the frame, then check for problems
-        numSent = PHY_send(frameTX, sizeTXframe); // send frame bytes
-        if (numSent != sizeTXframe)               // problem!
+        /* A second ACK for the block before (if both copies of it
+           arrived) is no reason to send this one again - doing so would
+           give a second ACK for this one too, and so on for every block
+           after.  Just wait on, while the timer runs.  */
+        if (!stale)
         {
-            printf("LLS: Block %d, failed to send frame\n", seqNumTX);
-            return FAILURE; // problem code
-        }
+            // Send the frame, then check for problems
+            numSent = sendFrame(frameTX, sizeTXframe); // send frame bytes
+            if (numSent != sizeTXframe)                // problem!
+            {
+                printf("LLS: Block %d, failed to send frame\n", seqNumTX);
+                return FAILURE; // problem code
+            }
 
-        // The frame has been sent - update counters
-        framesSent++; // increment frame counter (for report)
-        attempts++;   // increment attempt counter, so we don't try forever
-        if (debug)
-            printf("LLS: Sent frame of %d bytes, block %d, attempt %d\n",
-                   sizeTXframe, seqNumTX, attempts);
+            // The frame has been sent - update counters
+            framesSent++; // increment frame counter (for report)
+            attempts++;   // increment attempt counter, so we don't try forever
+            countForBlockSize(sizeTXframe, attempts > 1);
+            if (debug)
+                printf("LLS: Sent frame of %d bytes, block %d, attempt %d\n",
+                       sizeTXframe, seqNumTX, attempts);
 
-        // Now wait to receive a response (ack or nak)
+            // Start (or restart) the retransmission timer for this block
+            TIM_arm(&timers, &retxTimer[seqNumTX], retxDeadline(sizeTXframe, &leftAt));
+        }
+        stale = FALSE;
 
-        sizeAck = getFrame(frameAck, 2 * ACK_SIZE, 2 * TX_WAIT);
+        // Now wait to receive a response (ack or nak), until the timer expires
+        sizeAck = getFrame(frameAck, ACK_MAXSIZE,
+                           (float)TIM_secondsLeft(retxTimer[seqNumTX].expiry));
         if (sizeAck < 0)    // some problem receiving
+        {
+            TIM_cancel(&timers, &retxTimer[seqNumTX]);
             return FAILURE; // quit if failed
+        }
 
-        else if (sizeAck == 0) // time limit reached
+        else if (sizeAck == 0) // time limit reached, or no valid frame
         {
             if (debug)
                 printf("LLS: Timeout waiting for response\n");
-            timeouts++; // increment counter for report
+            // Count the timers that have expired - the frame is sent again
+            if (TIM_passed(retxTimer[seqNumTX].expiry))
+                backOff(); // wait longer for the next response
+            while (TIM_nextExpired(&timers, PHY_timeUs()) != NULL)
+                timeouts++; // increment counter for report
             /* What else should be done about that (if anything)?
                If success remains FALSE, this loop will continue, so
                it will re-transmit the frame and wait for a response... */
@@ -238,6 +1361,7 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
             if (checkFrame(frameAck, sizeAck) == FRAMEGOOD) // good frame
             {
                 goodFrames++; // increment counter for report
+                takeFixed(frameAck, sizeAck, 1); // bytes the receiver corrected, if any
 
                 // Extract some information from the response
                 seqAck = (int)frameAck[SEQNUMPOS]; // get sequence number
@@ -245,18 +1369,27 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
 
                 /* Need to check if this is a positive ACK,
                    and if it relates to the data block just sent... */
-                if ((frameAck[SEQNUMPOS + 1] == POSACK) && (seqAck == seqNumTX)) // need a sensible test here!!
+                if ((frameAck[headerSize()] == POSACK) && (seqAck == seqNumTX)) // need a sensible test here!!
                 {
                     if (debug)
                         printf("LLS: ACK received, seq %d\n", seqAck);
                     acksRX++;       // increment counter for report
                     success = TRUE; // job is done
+                    if (attempts == 1) // only one copy sent, so the round trip is known
+                        rttSample(leftAt);
+                }
+                else if ((frameAck[headerSize()] == POSACK) && (seqDiff(seqNumTX, seqAck) == 1)
+                         && !TIM_passed(retxTimer[seqNumTX].expiry))
+                {
+                    if (debug)
+                        printf("LLS: ACK for block %d again, still waiting\n", seqAck);
+                    stale = TRUE; // wait for the rest of the time
                 }
                 else // response could be NAK, or ACK for wrong block...
                 {
                     if (debug)
                         printf("LLS: Response received, type %d, seq %d\n",
-                               (int)frameAck[SEQNUMPOS + 1], seqAck); // need sensible values here!!
+                               (int)frameAck[headerSize()], seqAck); // need sensible values here!!
                     naksRX++;                                         // increment counter for report
                                                                       /* What else should be done about this (if anything)?
                                                                          If success remains FALSE, this loop will continue, so
@@ -279,8 +1412,11 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
     } // repeat all this until succeed or reach the limit
     while ((success == FALSE) && (attempts < MAX_TRIES));
 
+    TIM_cancel(&timers, &retxTimer[seqNumTX]); // no longer waiting for this block
+
     if (success == TRUE) // the data block has been sent and acknowledged
     {
+        dataBytesTX += nTXdata;       // count the data bytes for the report
         seqNumTX = next(seqNumTX); // increment the sequence number
         return SUCCESS;
     }
@@ -304,7 +1440,7 @@ int LL_send_LLC(byte_t *dataTX, int nTXdata)
    Return value: the size of the data block, or negative on failure.  */
 int LL_receive_basic(byte_t *dataRX, int maxData)
 {
-    static byte_t frameRX[3 * MAX_BLK]; // create an array to hold the frame
+    static _Thread_local byte_t frameRX[MAX_FRAME]; // create an array to hold the frame
     int nRXdata = 0;                    // number of data bytes received
     int sizeRXframe = 0;                // number of bytes in the frame received
     int seqNumRX = 0;                   // sequence number of the received frame
@@ -326,7 +1462,7 @@ int LL_receive_basic(byte_t *dataRX, int maxData)
            getFrame function returns the number of bytes in the frame,
            or zero if it did not receive a frame within the time limit
            or a negative value if there was some other problem. */
-        sizeRXframe = getFrame(frameRX, 3 * MAX_BLK, RX_WAIT);
+        sizeRXframe = getFrame(frameRX, MAX_FRAME, RX_WAIT);
         if (sizeRXframe < 0) // some problem receiving
             return FAILURE;  // quit if there was a problem
 
@@ -392,18 +1528,24 @@ int LL_receive_basic(byte_t *dataRX, int maxData)
    If connected, it tries to get a frame from the received bytes.  It keeps
    trying until it gets a good frame, with no errors and the expected sequence
    number, then it returns with the data bytes from the frame.
+   A block that arrives again (because an ACK was lost) is acknowledged
+   again, so the sender can move on.  With ARQ_GOBACKN, the ACK carries the
+   last block received in order, and a missing block is asked for with a
+   NAK - the blocks after it that arrive meanwhile are thrown away.
    Arguments:  dataRX - pointer to an array to hold the data block,
                maxData - maximum size of the data block.
    Return value: the size of the data block, or negative on failure.  */
 int LL_receive_LLC(byte_t *dataRX, int maxData)
 {
-    static byte_t frameRX[3 * MAX_BLK]; // create an array to hold the frame
+    static _Thread_local byte_t frameRX[MAX_FRAME]; // create an array to hold the frame
     int nRXdata = 0;                    // number of data bytes received
     int sizeRXframe = 0;                // number of bytes in the frame received
     int seqNumRX = 0;                   // sequence number of the received frame
     int success = FALSE;                // flag to indicate success
     int attempts = 0;                   // attempt counter
+    int idle = 0;                       // timeouts in a row
     int expected = next(lastSeqRX);     // calculate expected sequence number
+    int window = (options.arq == ARQ_GOBACKN) ? options.window : 1; // frames sent without waiting
 
     // First check if connected
     if (connected == FALSE)
@@ -412,6 +1554,10 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
         return BADUSE; // problem code
     }
 
+    // Selective repeat keeps blocks that arrive out of order
+    if (options.arq == ARQ_SELECTIVE)
+        return receiveSelective(dataRX, maxData);
+
     /* Loop to receive a frame, repeats until a good frame with
        the expected sequence number is received. */
     do
@@ -420,11 +1566,12 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
            getFrame() returns the number of bytes in the frame,
            or zero if it did not receive a frame within the time limit
            or a negative value if there was some other problem.  */
-        sizeRXframe = getFrame(frameRX, 3 * MAX_BLK, RX_WAIT);
+        sizeRXframe = getFrame(frameRX, MAX_FRAME, RX_WAIT);
         if (sizeRXframe < 0) // some problem receiving
             return FAILURE;  // quit if there was a problem
 
         attempts++;           // increment the attempt counter
+        idle = (sizeRXframe == 0) ? idle + 1 : 0;
         if (sizeRXframe == 0) // a timeout occurred
         {
             printf("LLR: Timeout trying to receive frame, attempt %d\n",
@@ -440,8 +1587,8 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
                 printf("LLR: Got frame, %d bytes, attempt %d\n",
                        sizeRXframe, attempts);
 
-            // Now check the frame for errors
-            if (checkFrame(frameRX, sizeRXframe) == FRAMEBAD) // frame is bad
+            // Now check the frame for errors, putting it right if it can be
+            if (checkDataFrame(frameRX, &sizeRXframe) == FRAMEBAD) // frame is bad
             {
                 badFrames++; // increment the bad frame counter
                 if (debug)
@@ -450,7 +1597,14 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
                    Maybe send a response to the sender ?
                    If so, what sequence number ?
                    See the sendAck() function below.  */
-                sendAck(NEGACK, seqNumRX); // send bad ack on badframe
+                if (options.arq != ARQ_GOBACKN)
+                    sendAck(NEGACK, seqNumRX); // send bad ack on badframe
+                else if (rejSent == FALSE) // ask for the expected block, once
+                {
+                    sendAck(NEGACK, expected);
+                    rejSent = TRUE;
+                    rejAhead = 0;
+                }
             }
             else // we have a good frame - process it
             {
@@ -467,18 +1621,21 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
                 {
                     success = TRUE;       // job is done
                     lastSeqRX = seqNumRX; // update last sequence number
+                    rejSent = FALSE;      // no block missing now
                                           /* Maybe send a response to the sender ?
                                              If so, what sequence number ?
                                              See the sendAck() function below. */
                     sendAck(POSACK, seqNumRX); // send good ack otherwise
                 }
-                else if (seqNumRX == lastSeqRX) // got a duplicate data block
+                else if ((seqDiff(expected, seqNumRX) >= 1)
+                         && (seqDiff(expected, seqNumRX) <= window)) // got a duplicate data block
                 {
                     if (debug)
                         printf("LLR: Duplicate rx seq. %d, expected %d\n",
                                seqNumRX, expected);
-                    // What should be done about this?
-                    sendAck(NEGACK, seqNumRX); // send bad ack on badframe
+                    /* The ACK for it must have been lost, so acknowledge it again,
+                       or the sender will keep sending it until it gives up.  */
+                    sendAck(POSACK, lastSeqRX);
                 }
                 else // some other data block??
                 {
@@ -486,7 +1643,20 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
                         printf("LLR: Unexpected block rx seq. %d, expected %d\n",
                                seqNumRX, expected);
                     // What should be done about this?
-                    sendAck(NEGACK, seqNumRX); // send bad ack on badframe
+                    if (options.arq != ARQ_GOBACKN)
+                        sendAck(NEGACK, seqNumRX); // send bad ack on badframe
+                    else
+                    {
+                        /* A block is missing - ask for it once, not for every block
+                           after it.  But if the blocks go backwards, the sender has
+                           gone back, and the block is still missing, so ask again.  */
+                        if ((rejSent == FALSE) || (seqDiff(seqNumRX, expected) <= rejAhead))
+                        {
+                            sendAck(NEGACK, expected);
+                            rejSent = TRUE;
+                        }
+                        rejAhead = seqDiff(seqNumRX, expected);
+                    }
 
                 } // end of sequence number checking
 
@@ -495,10 +1665,13 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
         } // end of received frame processing
 
     } // repeat all this until succeed or reach the limit
-    while ((success == FALSE) && (attempts < MAX_TRIES));
+    while ((success == FALSE) && (attempts < MAX_TRIES * window) && (idle < MAX_TRIES));
 
     if (success == TRUE) // received good frame with expected sequence number
+    {
+        dataBytesRX += nRXdata; // count the data bytes for the report
         return nRXdata;  // return number of data bytes extracted from frame
+    }
     else                 // failed to get a good frame within limit
     {
         if (debug)
@@ -511,14 +1684,89 @@ int LL_receive_LLC(byte_t *dataRX, int maxData)
 
 // ===========================================================================
 /* Function to return the optimum size of a data block.
-   This is currently specified as a constant in linklayer.h
+   This starts from the setting, then follows the error rate measured,
+   if adaptBlock is set (see adaptBlockSize).
    Return value: the optimum block size, in bytes.  */
 int LL_getOptBlockSize(void)
 {
     if (debug)
         printf("LLGOBS: Optimum size of data block is %d bytes\n",
-               OPT_BLK);
-    return OPT_BLK;
+               blockSize);
+    return blockSize;
+}
+
+// ===========================================================================
+/* Function to get the settings for links in this thread.
+   Argument:  opt - pointer to a structure to fill in.  */
+void LL_getOptions(LL_options *opt)
+{
+    *opt = options;
+}
+
+// ===========================================================================
+/* Function to change the settings for links in this thread.
+   The block size must fit in a frame (see largestBlock).
+   Argument:  opt - pointer to the new settings.
+   Return value: 0 for success, BADUSE if a setting is not valid.  */
+int LL_setOptions(const LL_options *opt)
+{
+    if (connected)  // the other end is using the present settings
+    {
+        printf("LL: Cannot change options while connected\n");
+        return BADUSE;
+    }
+    if ((opt->bitRate <= 0) || (opt->optBlock < 2)
+        || (opt->adaptBlock < FALSE) || (opt->adaptBlock > TRUE)
+        || (opt->headerCheck < FALSE) || (opt->headerCheck > TRUE)
+        || (CHK_size(opt->checksum) == 0) || (opt->optBlock > largestBlock(opt))
+        || (opt->framing < FRM_PLAIN) || (opt->framing > FRM_COBS)
+        || (opt->arq < ARQ_STOPWAIT) || (opt->arq > ARQ_SELECTIVE)
+        || (opt->window < 1) || (opt->window > MAX_WINDOW)
+        || (opt->fec < FEC_OFF) || (opt->fec > FEC_AUTO)
+        || (opt->interleave < 1) || (opt->interleave > MAX_DEPTH)
+        || (opt->harq < FALSE) || (opt->harq > TRUE))
+    {
+        printf("LL: Invalid options, bit rate %d, block size %d, adapt %d, framing %d, header check %d, checksum %d, ARQ %d, window %d, FEC %d, interleave %d, HARQ %d\n",
+               opt->bitRate, opt->optBlock, opt->adaptBlock, opt->framing, opt->headerCheck, opt->checksum,
+               opt->arq, opt->window, opt->fec, opt->interleave, opt->harq);
+        return BADUSE;
+    }
+    options = *opt;
+    blockSize = options.optBlock; // the start, for the next connection
+    return SUCCESS;
+}
+
+// ===========================================================================
+/* Function to get the counters and measurements for the present
+   connection, or the last one if not connected.
+   Argument:  stats - pointer to a structure to fill in.  */
+void LL_getStats(LL_stats *stats)
+{
+    long long endTime = connected ? PHY_timeUs() : disconTime;
+    stats->connTime = (endTime - connectTime) / 1.0e6;
+    stats->framesSent = framesSent;
+    stats->goodFrames = goodFrames;
+    stats->badFrames = badFrames;
+    stats->timeouts = timeouts;
+    stats->resyncs = resyncs;
+    stats->badHeaders = badHeaders;
+    stats->acksSent = acksSent;
+    stats->naksSent = naksSent;
+    stats->acksRX = acksRX;
+    stats->naksRX = naksRX;
+    stats->dataBytesTX = dataBytesTX;
+    stats->dataBytesRX = dataBytesRX;
+    stats->rttSamples = rttSamples;
+    stats->srtt = srtt;
+    stats->rttvar = rttvar;
+    stats->rto = rto;
+    stats->optBlock = blockSize;
+    stats->ber = berEst;
+    stats->fecOn = fecOn;
+    stats->fecFrames = fecFrames;
+    stats->fecFixed = fecFixed;
+    stats->ilvDelay = (ilvWords > 0) ? 10.0 * ilvBytes / ilvWords / options.bitRate : 0.0;
+    stats->harqFrames = harqFrames;
 }
 
 // ==========================================================
@@ -527,7 +1775,11 @@ int LL_getOptBlockSize(void)
 // ===========================================================================
 /* Function to build a frame around a block of data.
    This function puts the header bytes into the frame, then copies in the
-   data bytes.  Then it adds the trailer bytes to the frame.
+   data bytes, working out the check value as it copies them (CHK_copy),
+   so they are only read once.  Then it adds the trailer bytes to the frame.
+   If FEC is on, it codes the data and trailer, interleaves the coded
+   bytes, and puts the coded size, with FECBIT, in the header - the
+   trailer covers the frame without FEC.
    It calculates the total number of bytes in the frame, and returns this
    value to the calling function.
    Arguments: frameTX - pointer to an array to hold the frame,
@@ -537,98 +1789,388 @@ int LL_getOptBlockSize(void)
    Return value: the total number of bytes in the frame.  */
 int buildDataFrame(byte_t *frameTX, byte_t *dataTX, int nDataTX, int seqNumTX)
 {
-    int i = 0; // for use in loop
-
-    byte_t framesize = (byte_t)nDataTX + 2; // The framsize is equal to the number of data bytes + the seq. number + the checksum
+    static _Thread_local byte_t coded[MAX_FRAME]; // the coded bytes, before interleaving
+    int sizeHeader = headerSize(); // number of bytes before the data
+    int sizeFrame = sizeHeader + nDataTX + trailerSize(); // number of bytes in the frame
+    CHK_state check;               // check value for the trailer
 
     // Build the frame header first
     frameTX[0] = STARTBYTE; // start of frame marker bytec
 
-    frameTX[FRAMENUMBERPOS] = framesize; // put the framesize byte in place
+    putFrameSize(frameTX, sizeFrame); // the number of bytes after the size field
 
     frameTX[SEQNUMPOS] = (byte_t)seqNumTX; // sequence number as given
 
-    // Copy the data bytes into the frame, starting after the header
-    for (i = 0; i < nDataTX; i++) // step through the data array
+    if (options.headerCheck)
+        frameTX[HCSPOS] = makeHCS(frameTX); // header check byte, if used
+
+    // Copy the data bytes into the frame, starting after the header,
+    // and add the check value after them
+    CHK_start(&check, options.checksum);
+    CHK_update(&check, frameTX + 1, sizeHeader - 1); // the header, after the start marker
+    CHK_copy(&check, frameTX + sizeHeader, dataTX, nDataTX);
+    CHK_write(options.checksum, CHK_finish(&check), frameTX + sizeHeader + nDataTX);
+
+    // Add the FEC parity bytes, if used, and put the new size in the header
+    if (fecOn)
     {
-        frameTX[HEADERSIZE + i] = dataTX[i]; // copy each data byte
+        memcpy(coded, frameTX + sizeHeader, sizeFrame - sizeHeader);
+        sizeFrame = sizeHeader + FEC_encode(coded, sizeFrame - sizeHeader);
+        FEC_interleave(frameTX + sizeHeader, coded, sizeFrame - sizeHeader, options.interleave);
+        putFrameSize(frameTX, sizeFrame);
+        frameTX[FRAMENUMBERPOS] |= FECBIT;
+        if (options.headerCheck)
+            frameTX[HCSPOS] = makeHCS(frameTX);
     }
 
-    frameTX[HEADERSIZE + nDataTX] = makeCHKSUM(dataTX, nDataTX, framesize, (byte_t)seqNumTX);
-    // create the checksum using the makeCHKSUM function, it takes arguments for the framesize, data bytes and sequence number value
-
     // Return the size of the frame
-    return HEADERSIZE + nDataTX + TRAILERSIZE;
+    return sizeFrame;
 } // end of buildDataFrame
 
 // ===========================================================================
-/* Function to find a frame and extract it from the bytes received.
-   Arguments: frameRX - pointer to an array of bytes to hold the frame,
-              maxSize - maximum number of bytes to receive,
-              timeLimit - time limit for receiving a frame.
-   Return value: the number of bytes in the frame, or zero if time limit
-                 or size limit was reached before the frame was received,
-                 or a negative value if there was some other problem. */
+/* Function to discard bytes from the receive buffer, keeping track of
+   how many of the bytes of a bad frame are still to be searched again.
+   Argument:  n - number of bytes to discard, from the oldest.  */
+static void discardRX(int n)
+{
+    RXB_drop(&rxBuffer, n);
+    resyncLeft = (resyncLeft > n) ? resyncLeft - n : 0;
+}
 
-int getFrame(byte_t *frameRX, int maxSize, float timeLimit)
+// ===========================================================================
+/* Function to find a coded frame (FRM_STUFF or FRM_COBS) and decode it.
+   The start marker cannot appear inside a coded frame, so a frame runs
+   from one start marker to the next, and a start marker that arrives
+   before the frame is complete means it was cut short.  The arguments
+   and return value are as for getFrame.  */
+static int getCodedFrame(byte_t *frameRX, int maxSize, float timeLimit)
 {
-    int bytesRX = 0;  // number of bytes received so far
-    int bytesGot = 0; // return value from PHY_get()
-    byte_t framesize = 0;
+    static _Thread_local byte_t coded[FRM_MAXCODED(MAX_FRAME)]; // coded bytes
+    int skipped = 0;  // number of bytes discarded, seeking the start marker
+    int bytesGot = 0; // return value from RXB_fill()
+    int frameLen;     // number of bytes in the frame, from the size field
+    int nCoded;       // number of coded bytes of this frame received
+    int decoded;      // number of frame bytes decoded, after the start marker
+    int used = 0;     // number of coded bytes used
+    int next;         // position of the next start marker, or -1
+    int waitTime;     // time to wait for more bytes, in ms
+    int pos;          // position of the start marker in the buffer
+    int sizeHead = options.headerCheck ? HCSPOS : FRAMENUMBERPOS + SIZE_BYTES - 1; // header bytes to decode first
+    int checked = 1;  // bytes of the frame added to the check value so far
+    int checkEnd = 0; // position of the trailer in the frame
+    CHK_state check;  // check value of the bytes decoded so far
 
     timerRX = timeSet(timeLimit); // set time limit to wait for frame
+    resyncLeft = 0;   // every start marker is a real one
+    CHK_start(&check, options.checksum);
 
-    // First search for the start of frame marker
-    do
+    while (1)
     {
-        bytesGot = PHY_get(frameRX, 1); // get one byte at a time
-        // Return value is number of bytes received, or negative for problem
+        // Discard any bytes before the start marker
+        pos = RXB_find(&rxBuffer, STARTBYTE, 0);
+        if (pos < 0)
+            pos = rxBuffer.count; // none of these bytes are useful
+        RXB_drop(&rxBuffer, pos);
+        skipped += pos;
+
+        if (rxBuffer.count > 1) // decode what we have of the frame
+        {
+            next = RXB_find(&rxBuffer, STARTBYTE, 1);
+            nCoded = ((next < 0) ? rxBuffer.count : next) - 1;
+            if (nCoded > FRM_MAXCODED(maxSize))
+                nCoded = FRM_MAXCODED(maxSize); // no more could be needed
+            RXB_copy(&rxBuffer, 1, coded, nCoded);
+            frameRX[0] = STARTBYTE;
+            frameLen = maxSize; // until the size is decoded
+
+            /* Decode the size field (and the rest of the header, if it
+               is checked) first, then the rest of the frame.  A damaged
+               header is rejected at once, as in getFrame.  */
+            decoded = FRM_decode(options.framing, coded, nCoded, frameRX + 1,
+                                 sizeHead, &used);
+            if ((decoded == HCSPOS) && options.headerCheck
+                && (inspectHCS(frameRX) == FRAMEBAD))
+            {
+                RXB_drop(&rxBuffer, 1); // the rest goes before the next start marker
+                badHeaders++;
+                printf("LLGF: Header check failed, frame rejected\n");
+                return 1 + decoded; // return the bad header, for the caller to report
+            }
+            if (decoded == sizeHead)
+            {
+                frameLen = frameSize(frameRX);
+                if (frameLen > maxSize) // too big - it must be a bad frame
+                {
+                    RXB_drop(&rxBuffer, 1);
+                    printf("LLGF: Size limit seeking END, frame size %d\n", frameLen);
+                    return 0; // no frame received, but not a failure situation
+                }
+                decoded = FRM_decode(options.framing, coded, nCoded, frameRX + 1,
+                                     frameLen - 1, &used);
+
+                /* Each decode starts from the beginning of the frame, and
+                   gives the same bytes as before, and maybe more.  Only
+                   the new ones are added to the check value - none if
+                   the frame has FEC parity, as it is checked once corrected.  */
+                checkEnd = (frameRX[FRAMENUMBERPOS] & FECBIT) ? 1 : frameLen - trailerSize();
+                if ((decoded > 0) && (1 + decoded > checked) && (checked < checkEnd))
+                {
+                    CHK_update(&check, frameRX + checked,
+                               ((1 + decoded < checkEnd) ? 1 + decoded : checkEnd) - checked);
+                    checked = (1 + decoded < checkEnd) ? 1 + decoded : checkEnd;
+                }
+            }
+            if (decoded == frameLen - 1) // the whole frame is here
+            {
+                RXB_drop(&rxBuffer, 1 + used);
+                if (debug) printf("\n FRAMESIZE :%d", frameLen - FRAMENUMBERPOS - SIZE_BYTES); // print the frame size field
+                checkedFrame = frameRX; // checkFrame need not check it again
+                if (frameRX[FRAMENUMBERPOS] & FECBIT)
+                    checkedStatus = decodeFrame(frameRX, &frameLen, -1);
+                else
+                    checkedStatus = ((checkEnd >= HEADERSIZE)
+                                     && (CHK_finish(&check) == CHK_read(options.checksum, frameRX + checkEnd)))
+                                        ? FRAMEGOOD : FRAMEBAD;
+                checkedSize = frameLen;
+                return frameLen; // return the number of bytes in the frame
+            }
+            if ((decoded < 0) || (next >= 0)) // not valid, or cut short
+            {
+                RXB_drop(&rxBuffer, 1 + nCoded); // up to the next frame
+                if (decoded < 0)
+                    decoded = 0;
+                printf("LLGF: Frame cut short or not valid, %d bytes\n", 1 + decoded);
+                return 1 + decoded; // a bad frame, for the caller to report
+            }
+        }
+
+        // Wait for more bytes, as in getFrame
+        waitTime = TIM_msLeft(timerRX);
+        if ((rxBuffer.count > 0) && (waitTime > RX_GAP))
+            waitTime = RX_GAP;
+        bytesGot = RXB_fill(&rxBuffer, waitTime);
         if (bytesGot < 0)
             return bytesGot; // check for problem and give up
-        else
-            bytesRX += bytesGot; // otherwise update the bytes received count
-    } while (((bytesGot < 1) || (frameRX[0] != STARTBYTE)) && !timeUp(timerRX));
-    // until we get a byte which is a start of frame marker, or timeout
+        if (bytesGot == 0)
+            break; // out of time
+    }
 
     // If we are out of time, without finding the start marker,
     // report the facts, but return 0 - no useful bytes received
-    if (timeUp(timerRX))
+    if (rxBuffer.count == 0)
     {
-        printf("LLGF: Timeout seeking START, %d bytes received\n", bytesRX);
+        printf("LLGF: Timeout seeking START, %d bytes received\n", skipped);
         return 0; // no frame received, but not a failure situation
     }
 
-    bytesRX = 1; // if we found the start marker, we got 1 byte
+    // Otherwise, return as much of the frame as arrived in time
+    nCoded = rxBuffer.count - 1;
+    if (nCoded > FRM_MAXCODED(maxSize))
+        nCoded = FRM_MAXCODED(maxSize);
+    RXB_copy(&rxBuffer, 1, coded, nCoded);
+    RXB_clear(&rxBuffer);
+    decoded = FRM_decode(options.framing, coded, nCoded, frameRX + 1,
+                         maxSize - 1, &used);
+    frameRX[0] = STARTBYTE;
+    return 1 + ((decoded < 0) ? 0 : decoded);
+}
 
-    bytesGot = PHY_get((frameRX + bytesRX), 1);
+// ===========================================================================
+/* Function to find a frame and extract it from the bytes received.
+   Arguments: frameRX - pointer to an array of bytes to hold the frame,
+              maxSize - maximum number of bytes to receive,
+              timeLimit - time limit for receiving a frame.
+   Return value: the number of bytes in the frame, or zero if time limit
+                 or size limit was reached before the frame was received,
+                 or a negative value if there was some other problem. */
 
-    if (bytesGot < 0)
-        return bytesGot; // check for problem and give up
-    else
-        bytesRX += bytesGot; // otherwise update the bytes received count
+int getFrame(byte_t *frameRX, int maxSize, float timeLimit)
+{
+    int skipped = 0;  // number of bytes discarded, seeking the start marker
+    int bytesGot = 0; // return value from RXB_fill()
+    int frameLen;     // number of bytes in the frame, from the size field
+    int sizeFrame;    // number of bytes in the frame, without any FEC parity
+    int coded;        // TRUE if the frame has FEC parity
+    int waitTime;     // time to wait for more bytes, in ms
+    int pos;          // position of the start marker in the buffer
+    int tentative;    // TRUE if the start marker is inside a bad frame
+    int have = 0;     // bytes of the frame copied into frameRX so far
+    int end;          // bytes of the frame here now, up to its end
+    int checkEnd;     // position of the trailer in the frame
+    int n;            // number of bytes to copy and check
+    int status;       // result of checking the trailer
+    CHK_state check;  // check value of the bytes copied so far
+
+    checkedFrame = NULL; // no result for checkFrame yet
+
+    // Coded frames are found in a different way
+    if (options.framing != FRM_PLAIN)
+        return getCodedFrame(frameRX, maxSize, timeLimit);
 
-    framesize = frameRX[FRAMENUMBERPOS]; // get the framesize byte
-    printf("\n FRAMESIZE :%d", framesize); // print the framesize byte
-    bytesGot = PHY_get((frameRX + bytesRX), framesize); // get framesize bytes at a time
-    if (bytesGot < 0)
-        return bytesGot; // check for problem and give up
-    else
-        bytesRX += bytesGot; // otherwise update the bytes received count
+    timerRX = timeSet(timeLimit); // set time limit to wait for frame
 
-    /* Now collect more bytes, until we find the end marker.
-       If we had the frame size, we could do this more efficiently, by
-       asking PHY_get() to collect all the remaining bytes in one call. */
+    /* Look for a frame in the bytes already received, and read more
+       bytes into the receive buffer until one is complete.  Each read
+       takes all the bytes waiting, so bytes after the end of this frame
+       stay in the buffer, for the next call.
+
+       When a frame fails the checksum, its size field may be wrong, so
+       it may have swallowed the start of the next frame.  Only its start
+       marker is discarded, and the rest of its bytes are searched again
+       (see discardRX).  A start marker found in them is tentative: it is
+       only a frame if it passes the checksum - otherwise it is a data
+       byte that happened to look like one, and is discarded quietly.
+
+       The bytes of a frame are copied into frameRX as they arrive, and
+       added to the check value at the same time, so the result is ready
+       as soon as the trailer arrives, without going through the whole
+       frame again.  Whenever the start marker is dropped, this starts
+       again with the next one (have = 0).  A frame with FEC parity is
+       only checked once it has been corrected, so its bytes are just
+       copied as they arrive.  */
+    while (1)
+    {
+        // Discard any bytes before the start marker
+        pos = RXB_find(&rxBuffer, STARTBYTE, 0);
+        if (pos < 0)
+            pos = rxBuffer.count; // none of these bytes are useful
+        discardRX(pos);
+        skipped += pos;
+        tentative = (resyncLeft > 0);
+
+        /* With the header check, a damaged header is rejected as soon
+           as it arrives, instead of trusting its size field and waiting
+           for bytes that may never come.  */
+        if (options.headerCheck && (rxBuffer.count > HCSPOS))
+        {
+            RXB_copy(&rxBuffer, 0, frameRX, HCSPOS + 1);
+            if (inspectHCS(frameRX) == FRAMEBAD)
+            {
+                discardRX(1); // drop the start marker only
+                have = 0;
+                if (tentative)
+                    continue; // not a frame after all
+                badHeaders++;
+                resyncLeft = HCSPOS; // search the rest of the header again
+                printf("LLGF: Header check failed, frame rejected\n");
+                return HCSPOS + 1; // return the bad header, for the caller to report
+            }
+        }
 
-    // If we filled the frame array, without finding the end marker,
-    // this will be a bad frame, so so report the facts but return 0
-    if (bytesRX >= maxSize)
+        // Once the size field is here, we know how long the frame is
+        if (rxBuffer.count > (options.headerCheck ? HCSPOS : FRAMENUMBERPOS + SIZE_BYTES - 1))
+        {
+            coded = RXB_peek(&rxBuffer, FRAMENUMBERPOS) & FECBIT;
+            frameLen = FRAMENUMBERPOS + SIZE_BYTES
+                       + (((RXB_peek(&rxBuffer, FRAMENUMBERPOS) & (FECBIT - 1)) << 8)
+                          | RXB_peek(&rxBuffer, FRAMENUMBERPOS + 1));
+
+            // If the frame will not fit in the array, it must be a bad
+            // frame, so drop the start marker, report the facts, return 0
+            if (frameLen > maxSize)
+            {
+                discardRX(1);
+                have = 0;
+                if (tentative)
+                    continue; // not a frame after all
+                printf("LLGF: Size limit seeking END, frame size %d\n", frameLen);
+                return 0; // no frame received, but not a failure situation
+            }
+
+            // Copy and check the bytes that have arrived since last time
+            if (have == 0) // a new frame - the start marker is not checked
+            {
+                CHK_start(&check, options.checksum);
+                frameRX[0] = STARTBYTE;
+                have = 1;
+            }
+            end = (rxBuffer.count < frameLen) ? rxBuffer.count : frameLen;
+            checkEnd = coded ? 1 : frameLen - trailerSize(); // none are checked yet, with FEC
+            if ((end > have) && (have < checkEnd)) // bytes before the trailer
+            {
+                n = ((end < checkEnd) ? end : checkEnd) - have;
+                RXB_copyCheck(&rxBuffer, have, frameRX + have, n, &check);
+                have += n;
+            }
+            if (end > have) // bytes of the trailer
+            {
+                RXB_copy(&rxBuffer, have, frameRX + have, end - have);
+                have = end;
+            }
+
+            if (have == frameLen) // the whole frame is here
+            {
+                sizeFrame = frameLen;
+                if (coded)
+                    status = decodeFrame(frameRX, &sizeFrame, -1);
+                else
+                    status = ((checkEnd >= HEADERSIZE)
+                              && (CHK_finish(&check) == CHK_read(options.checksum, frameRX + checkEnd)))
+                                 ? FRAMEGOOD : FRAMEBAD;
+                if (status == FRAMEGOOD)
+                {
+                    if (tentative)
+                        resyncs++; // found a frame inside a bad one
+                    resyncLeft = 0;
+                    discardRX(frameLen);
+                    if (debug) printf("\n FRAMESIZE :%d", frameLen - FRAMENUMBERPOS - SIZE_BYTES); // print the frame size field
+                    checkedFrame = frameRX; // checkFrame need not check it again
+                    checkedSize = sizeFrame;
+                    checkedStatus = FRAMEGOOD;
+                    return sizeFrame; // return the number of bytes in the frame
+                }
+                discardRX(1); // drop the start marker only
+                have = 0;
+                if (tentative)
+                    continue; // not a frame after all
+                resyncLeft = frameLen - 1; // search the rest again
+                checkedFrame = frameRX;
+                checkedSize = frameLen;
+                checkedStatus = FRAMEBAD;
+                return frameLen; // return the bad frame, for the caller to report
+            }
+        }
+
+        /* Wait for more bytes.  Until the start marker is found, wait
+           until the time limit for the frame; after that, the bytes of
+           the frame should follow each other, so wait no longer than
+           RX_GAP for the next ones.  */
+        waitTime = TIM_msLeft(timerRX);
+        if ((rxBuffer.count > 0) && (waitTime > RX_GAP))
+            waitTime = RX_GAP;
+        bytesGot = RXB_fill(&rxBuffer, waitTime);
+        // Return value is number of bytes received, or negative for problem
+        if (bytesGot < 0)
+            return bytesGot; // check for problem and give up
+        if (bytesGot == 0)
+        {
+            if (tentative && (rxBuffer.count > 0))
+            {
+                discardRX(1); // the rest never came - not a frame after all
+                have = 0;
+                continue;
+            }
+            break; // out of time
+        }
+    }
+
+    // If we are out of time, without finding the start marker,
+    // report the facts, but return 0 - no useful bytes received
+    if (rxBuffer.count == 0)
     {
-        printf("LLGF: Size limit seeking END, %d bytes received\n", bytesRX);
+        printf("LLGF: Timeout seeking START, %d bytes received\n", skipped);
         return 0; // no frame received, but not a failure situation
     }
 
-    // Otherwise, we found the end marker
-    return bytesRX; // return the number of bytes in the frame
+    /* Otherwise, return as much of the frame as arrived in time.  It is
+       a bad frame, so its bytes are searched again, as above.  */
+    frameLen = rxBuffer.count;
+    if (frameLen > maxSize)
+        frameLen = maxSize;
+    RXB_copy(&rxBuffer, 0, frameRX, frameLen);
+    discardRX(1); // drop the start marker only
+    resyncLeft = frameLen - 1; // search the rest again
+    return frameLen; // return the number of bytes in the frame
 } // end of getFrame
 
 // ===========================================================================
@@ -649,8 +2191,18 @@ int checkFrame(byte_t *frameRX, int sizeFrame)
         frameStatus = FRAMEBAD;
     }
 
-    // inspect the checksum
-    frameStatus = inspectCHKSUM(frameRX, sizeFrame);
+    // inspect the check value in the trailer, unless getFrame has done so
+    if ((frameRX == checkedFrame) && (sizeFrame == checkedSize))
+        frameStatus = checkedStatus;
+    else
+        frameStatus = checkTrailer(frameRX, sizeFrame);
+    checkedFrame = NULL; // the result is only used once
+
+    // If the header check is used, the header and size must be right too
+    if (options.headerCheck
+        && ((sizeFrame < headerSize() + trailerSize()) || (inspectHCS(frameRX) == FRAMEBAD)
+            || (sizeFrame != frameSize(frameRX))))
+        frameStatus = FRAMEBAD;
 
     // In debug mode, if frame is bad, print start and end bytes
     if (debug && (frameStatus == FRAMEBAD))
@@ -673,28 +2225,65 @@ int checkFrame(byte_t *frameRX, int sizeFrame)
 int processFrame(byte_t *frameRX, int sizeFrame,
                  byte_t *dataRX, int maxData, int *seqNumRX)
 {
-    int i = 0;   // for use in loop
     int nRXdata; // number of data bytes in the frame
 
     // First get the sequence number from its place in the header
     *seqNumRX = (int)frameRX[SEQNUMPOS];
 
     // Calculate the number of data bytes, based on the frame size
-    nRXdata = sizeFrame - HEADERSIZE - TRAILERSIZE;
+    nRXdata = sizeFrame - headerSize() - trailerSize();
 
     // Check if the number of data bytes is within the limit given
     if (nRXdata > maxData)
         nRXdata = maxData; // limit to the max allowed
 
     // Now copy the data bytes from the middle of the frame
-    for (i = 0; i < nRXdata; i++)
-    {
-        dataRX[i] = frameRX[HEADERSIZE + i]; // copy one byte
-    }
+    if (nRXdata > 0)
+        memcpy(dataRX, frameRX + headerSize(), nRXdata);
 
     return nRXdata; // return the size of the data block extracted
 } // end of processFrame
 
+// ===========================================================================
+/* Function to send a frame, coded for the framing mode in use.
+   The start marker is sent as it is, then the rest of the frame, coded
+   so that the start marker does not appear in it (see framing.h).
+   Arguments: frame - pointer to an array holding the frame,
+              sizeFrame - number of bytes in the frame.
+   Return value: sizeFrame if the frame was sent, otherwise negative. */
+int sendFrame(byte_t *frame, int sizeFrame)
+{
+    static _Thread_local byte_t coded[1 + FRM_MAXCODED(MAX_FRAME)]; // coded frame
+    int sizeCoded; // number of bytes in the coded frame
+    int retVal;    // return value from PHY_send
+
+    if (options.framing == FRM_PLAIN) // nothing to code
+        return PHY_send(frame, sizeFrame);
+
+    coded[0] = frame[0]; // the start marker
+    sizeCoded = 1 + FRM_encode(options.framing, frame + 1, sizeFrame - 1, coded + 1);
+    retVal = PHY_send(coded, sizeCoded);
+    if (retVal != sizeCoded)
+        return (retVal < 0) ? retVal : FAILURE;
+    return sizeFrame;
+}
+
+// ===========================================================================
+/* Function to put the number of bytes corrected by FEC, not yet reported,
+   in a response, after its type byte or bitmap, if there are any.
+   Arguments: frame - pointer to the response,
+              pos - where the number goes.
+   Return value: the number of bytes added to the response, 0 or 1.  */
+static int addFixed(byte_t *frame, int pos)
+{
+    int count = (fixedToReport < 255) ? fixedToReport : 255; // the rest goes in the next one
+    if (count == 0)
+        return 0;
+    frame[pos] = (byte_t)count;
+    fixedToReport -= count;
+    return 1;
+}
+
 // ===========================================================================
 /* Function to send an acknowledgement - positive or negative.
    Arguments: type - type of acknowledgement (POSACK or NEGACK),
@@ -704,33 +2293,36 @@ int processFrame(byte_t *frameRX, int sizeFrame,
    is needed even if its value is not included in the ack frame. */
 int sendAck(int type, int seqNum)
 {
-    byte_t ackFrame[ACK_SIZE + 2]; // allow extra bytes for byte stuff
-    int sizeAck = ACK_SIZE;        // number of bytes in the ack frame so far
+    byte_t ackFrame[ACK_MAXSIZE];  // array large enough for any ack
+    int sizeHeader = headerSize(); // number of bytes before the ack type
+    int sizeAck = sizeHeader + 1 + trailerSize(); // number of bytes in the ack frame
     int retVal;                    // return value from functions
 
     // First build the frame
     ackFrame[0] = STARTBYTE; 
-    ackFrame[FRAMENUMBERPOS] = (ACK_SIZE - 1);
-    ackFrame[SEQNUMPOS] = seqNum;
     switch (type)
     {
     case POSACK:
-        ackFrame[SEQNUMPOS + 1] = FRAMEGOOD;
+        ackFrame[sizeHeader] = FRAMEGOOD;
         break;
 
     default:
-        ackFrame[SEQNUMPOS + 1] = FRAMEBAD;
+        ackFrame[sizeHeader] = FRAMEBAD;
         break;
     }
-    byte_t *dataptr = &ackFrame[SEQNUMPOS + 1];
-    ackFrame[ACK_SIZE - 1] = makeCHKSUM(dataptr, 1, (byte_t)(ACK_SIZE - 1), (byte_t)seqNum);
+    sizeAck += addFixed(ackFrame, sizeHeader + 1); // bytes corrected by FEC, if any
+    putFrameSize(ackFrame, sizeAck);
+    ackFrame[SEQNUMPOS] = seqNum;
+    if (options.headerCheck)
+        ackFrame[HCSPOS] = makeHCS(ackFrame);
+    addTrailer(ackFrame, sizeAck - trailerSize());
     if(debug)
         printf("ACKFRAME : %s, SIZEACK : %d", ackFrame, sizeAck);
 
     // Add more bytes to the frame, and update sizeAck
 
     // Then send the frame and check for problems
-    retVal = PHY_send(ackFrame, sizeAck); // send the frame
+    retVal = sendFrame(ackFrame, sizeAck); // send the frame
     if (retVal != sizeAck)                // problem!
     {
         printf("LLSA: Failed to send response, seq. %d\n", seqNum);
@@ -750,6 +2342,44 @@ int sendAck(int type, int seqNum)
     }
 } // end of sendAck
 
+// ===========================================================================
+/* Function to send a selective acknowledgement (ARQ_SELECTIVE).
+   It is built like the ack frame above, with the bitmap in place of the
+   type byte, and the number of bytes corrected by FEC after it, if any.
+   Arguments: seqNum - sequence number of the last block received in order,
+              sack - SACK_BYTES bytes, a bit for each block after that.
+   Return value:  indicates success or failure.  */
+int sendSack(int seqNum, const byte_t *sack)
+{
+    byte_t ackFrame[ACK_MAXSIZE];  // array large enough for any ack
+    int sizeHeader = headerSize(); // number of bytes before the bitmap
+    int sizeAck = sizeHeader + SACK_BYTES + trailerSize(); // number of bytes in the ack frame
+
+    ackFrame[0] = STARTBYTE;
+    memcpy(ackFrame + sizeHeader, sack, SACK_BYTES);
+    sizeAck += addFixed(ackFrame, sizeHeader + SACK_BYTES);
+    putFrameSize(ackFrame, sizeAck);
+    ackFrame[SEQNUMPOS] = (byte_t)seqNum;
+    if (options.headerCheck)
+        ackFrame[HCSPOS] = makeHCS(ackFrame);
+    addTrailer(ackFrame, sizeAck - trailerSize());
+
+    if (sendFrame(ackFrame, sizeAck) != sizeAck) // problem!
+    {
+        printf("LLSA: Failed to send selective ACK, seq. %d\n", seqNum % MOD_SEQNUM);
+        return FAILURE; // problem code
+    }
+    acksSent++; // update the counter for the report
+    if (debug)
+    {
+        printf("LLSA: Sent selective ACK, seq %d, bitmap", seqNum % MOD_SEQNUM);
+        for (int i = 0; i < SACK_BYTES; i++)
+            printf(" %02x", sack[i]);
+        printf("\n");
+    }
+    return SUCCESS;
+} // end of sendSack
+
 // ==========================================================
 // Helper functions used by various other functions
 
@@ -765,24 +2395,26 @@ int next(int seq)
 
 // ===========================================================================
 /* Function to set a time limit at a point in the future.
+   This uses the monotonic clock, so the limit is in real time (or
+   virtual time in a simulation), not processor time, which does not
+   advance while the program is waiting for bytes.
    Argument:   limit - the time limit in seconds, from now.
-   Return value: the time at which the limit will elapse. */
-long timeSet(float limit)
+   Return value: the time at which the limit will elapse, in us. */
+long long timeSet(float limit)
 {
-    long timeLimit = clock() + (long)(limit * CLOCKS_PER_SEC);
-    return timeLimit;
+    return TIM_deadline(limit);
 } // end of timeSet
 
 // ===========================================================================
 /* Function to check if a time limit has elapsed.
    Argument:  timeLimit - end time from timeSet() function.
    Return value: TRUE if the limit has elapsed, FALSE if not. */
-int timeUp(long timeLimit)
+int timeUp(long long timeLimit)
 {
-    if (clock() < timeLimit)
-        return FALSE; // still within limit
-    else
+    if (TIM_passed(timeLimit))
         return TRUE; // time limit has been reached or exceeded
+    else
+        return FALSE; // still within limit
 } // end of timeUp
 
 // ===========================================================================
@@ -791,8 +2423,10 @@ int timeUp(long timeLimit)
    Return value: TRUE if b is a protocol byte, FALSE if not.*/
 int special(byte_t b)
 {
-
-    return FALSE; // no checking in this version
+    if ((b == STARTBYTE) || (b == ESCBYTE))
+        return TRUE;
+    else
+        return FALSE;
 }
 
 // ===========================================================================
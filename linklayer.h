@@ -10,22 +10,34 @@ typedef unsigned char byte_t; // define type "byte_t" for simplicity
 #ifndef LINKLAYER_H_INCLUDED
 #define LINKLAYER_H_INCLUDED
 
+#include "framing.h"  // framing modes, for LL_options
+#include "checksum.h" // error detecting codes, for LL_options
+#include "fec.h"      // forward error correction, for the frame sizes
+
 // Link Layer Protocol definitions - adjust all these to match your design
-#define MAX_BLK 424   // largest number of data bytes allowed in one frame
-#define OPT_BLK 212    // optimum number of data bytes in a frame
-#define MOD_SEQNUM 16 // modulo for sequence numbers
+#define MAX_BLK 4096  // largest number of data bytes allowed in one frame
+#define OPT_BLK 212    // optimum number of data bytes in a frame, at the start
+#define MIN_OPT_BLK 16 // smallest optimum block size, when it is adjusted
+#define MOD_SEQNUM 256 // modulo for sequence numbers - all values of the byte
+#define MAX_WINDOW 32  // most frames sent and not yet acknowledged (see LL_options)
 
 // Frame marker byte values
 #define STARTBYTE 212 // start of frame marker
+#define ESCBYTE 125   // escape marker, for byte stuffing (see framing.h)
 
 
-// Frame header byte positions
-#define SEQNUMPOS 2 // position of sequence number
-#define FRAMENUMBERPOS 1 //position of frame size
+/* Frame header byte positions.  The frame size is the number of bytes
+   after it, in SIZE_BYTES bytes, most significant first, so a frame can
+   be much longer than 255 bytes.  The top bit of the size is FECBIT.  */
+#define FRAMENUMBERPOS 1 // position of frame size
+#define SIZE_BYTES 2     // number of bytes in the frame size
+#define FECBIT 0x80      // in the first byte of the frame size: FEC parity follows the header
+#define SEQNUMPOS 3 // position of sequence number
+#define HCSPOS 4    // position of header check byte, if used (see checksum.h)
 
-// Header and trailer size
-#define HEADERSIZE 3  // number of bytes in frame header
-#define TRAILERSIZE 1 // number of bytes in frame trailer
+// Header size - the trailer is the check value, CHK_size() bytes
+#define HEADERSIZE 4  // number of bytes in frame header
+#define HCS_SIZE 1    // extra header bytes when the header check is used
 
 // Frame error check results
 #define FRAMEGOOD 1 // the frame has passed the tests
@@ -34,18 +46,118 @@ typedef unsigned char byte_t; // define type "byte_t" for simplicity
 // Acknowledgement values
 #define POSACK 1   // positive acknowledgement
 #define NEGACK 26  // negative acknowledgement
-#define ACK_SIZE 5 // number of bytes in ack frame
+#define SACK_BYTES (MAX_WINDOW / 8) // bytes in the selective ACK bitmap, a bit per block
+#define ACK_MAXSIZE (HEADERSIZE + HCS_SIZE + SACK_BYTES + 1 + CHK_MAXSIZE) // most bytes in an ack frame, with the FEC count
+#define MAX_FRAME (HEADERSIZE + HCS_SIZE + FEC_CODEDSIZE(MAX_BLK + CHK_MAXSIZE)) // most bytes in a data frame
+
+/* ARQ modes - how LL_send_LLC and LL_receive_LLC recover lost frames
+   ARQ_STOPWAIT  send one frame, wait for its ACK before the next
+   ARQ_GOBACKN   send up to a window of frames before waiting; the ACK
+                 carries the last block received in order, so covers all
+                 before it; after a NAK or a timeout, send all the frames
+                 not yet acknowledged again, from the oldest.
+                 LL_send_LLC returns as soon as the frame is sent, and
+                 LL_discon waits for the rest to be acknowledged.
+   ARQ_SELECTIVE as ARQ_GOBACKN, but the receiver keeps good blocks that
+                 arrive after a missing one, and delivers them in order
+                 once it arrives.  Each ACK carries the last block received
+                 in order, then a bitmap of SACK_BYTES bytes in place of the
+                 type byte: bit i (most significant first) is set if the
+                 block i + 1 after that one has been received.  Only the
+                 missing frames are sent again.  */
+#define ARQ_STOPWAIT 0
+#define ARQ_GOBACKN 1
+#define ARQ_SELECTIVE 2
+
+/* Forward error correction (FEC) modes - whether the sender adds parity
+   bytes to its data frames, so the receiver can correct a few errors
+   without sending the frame again (see fec.h).
+   FEC_OFF   never
+   FEC_ON    always
+   FEC_AUTO  when the error rate measured makes it worth the extra
+             bytes: see adjusting the block size, below
+   The data bytes and trailer are coded, and the frame size is then the
+   coded size, with FECBIT set.  So the receiver knows which frames to
+   decode, and the two ends need not agree on the mode.  The header is
+   not coded - the header check, if used, protects it.  The trailer
+   covers the frame as it would be without FEC, so it checks the
+   correction too.  Frames are coded before any byte stuffing, which can
+   turn one wrong byte into several, so FEC works best with FRM_PLAIN.
+   When the receiver has corrected bytes, its next ACK or NAK carries
+   the number (up to 255) in an extra byte, after the type byte or
+   bitmap, so the sender can still measure the error rate.
+   The coded bytes are interleaved, LL_options.interleave codewords at a
+   time, so a burst of errors is shared among them (see fec.h).  */
+#define FEC_OFF 0
+#define FEC_ON 1
+#define FEC_AUTO 2
+#define MAX_DEPTH ((MAX_BLK + CHK_MAXSIZE + FEC_MAXDATA - 1) / FEC_MAXDATA) // most codewords in a frame
+
+/* Combining copies of a bad frame (hybrid ARQ, or HARQ).  A frame sent
+   again is the same as before, so instead of throwing away a frame that
+   fails the check, the receiver keeps it, HARQ_COPIES at most, and tries
+   the next copy with the earlier ones (those with the same sequence
+   number and size):
+   - with FEC, each codeword is taken from a copy in which it can be
+     corrected (FEC_decodeCopies), or from the bitwise majority vote of
+     three copies;
+   - without FEC, and with a CRC, three copies give a bitwise majority
+     vote (a sum misses too many of the mistakes a vote makes), and with
+     CRC-32, two copies that differ in no more than HARQ_FLIPS bytes are
+     tried with each mixture of those bytes - with a shorter check, that
+     many tries would pass too many wrong frames.
+   The trailer checks the result, as it does any frame.  The sender does
+   nothing differently, so the two ends need not agree on this.  */
+#define HARQ_COPIES 2 // most copies of a bad frame kept
+#define HARQ_FLIPS 8  // most bytes that differ, to try each mixture of two copies
 
 // Time limits
 #define TX_WAIT 4.0 // sender waiting time in seconds
 #define RX_WAIT 6.0 // receiver waiting time in seconds
+#define RX_GAP 50   // longest gap between bytes of a frame, in ms
 #define MAX_TRIES 5 // number of times to re-try (either end)
+#define TIMER_TICK 10 // resolution of the retransmission timers in ms
+
+/* Retransmission timeout (RTO) - the time the sender waits for a response
+   after a frame has left the line.  It is worked out from the round trip
+   times measured on the link, so it suits the line in use: see linklayer.c.  */
+#define RTO_INIT (2 * TX_WAIT) // RTO before any round trip is measured, in seconds
+#define RTO_MIN 0.1   // shortest RTO, in seconds - longer than RX_GAP, so the receiver
+                      // finds a frame cut short, and asks for it, before it is sent again
+#define RTO_MAX 60.0  // longest RTO, after backing off, in seconds
 
 // Physical Layer settings to be used
 #define PORTNUM 1       // default port number: COM1
 #define BIT_RATE 4800   // use a low speed for initial tests
+#define FRAMING FRM_PLAIN // framing mode, see framing.h
+#define HEADER_CHECK FALSE // TRUE to add a header check byte to every frame
+#define CHECKSUM CHK_SUM250 // error detecting code in the trailer, see checksum.h
+#define ARQ ARQ_STOPWAIT // ARQ mode, see above
+#define WINDOW 8        // window size, in frames, for ARQ_GOBACKN and ARQ_SELECTIVE
+#define ADAPT_BLOCK TRUE // TRUE to adjust the optimum block size to the line, see below
+#define FEC FEC_AUTO    // FEC mode, see above
+#define INTERLEAVE 8    // FEC codewords interleaved together, 1 for none
+#define HARQ TRUE       // TRUE to combine copies of a bad frame, see above
 #define PROB_ERR 8E-5   //probability of simulated error on receive
 
+/* Adjusting the optimum block size.  The sender counts the frames it has
+   to send again, and from that and the frame sizes it works out the bit
+   error rate of the line.  Every ADAPT_FRAMES frames (or sooner, once
+   ADAPT_RESENT have been sent again, on a noisy line), it finds the block
+   size that should carry the most data, allowing for the header, trailer
+   and ACK of each frame, the round trip time and the window.  Long blocks
+   are more likely to be hit by an error, short ones waste more time on
+   overheads.  The block size only changes if the new one should be better
+   by ADAPT_GAIN, so it does not swing to and fro.  The error rate is kept
+   for the next connection, which starts with the block size that suits it.
+   With FEC_AUTO, FEC is switched on or off in the same way, by comparing
+   the best block size with FEC and without it.  While it is on, the error
+   rate comes from the bytes the receiver corrects - or from the frames
+   sent again, if there are more of them than that would explain.  */
+#define ADAPT_FRAMES 32 // frames sent between checks of the block size
+#define ADAPT_RESENT 4  // frames sent again that bring the check forward
+#define ADAPT_GAIN 0.02 // fraction by which a new block size must be better
+
 // Logical values
 #define TRUE 1
 #define FALSE 0
@@ -56,6 +168,54 @@ typedef unsigned char byte_t; // define type "byte_t" for simplicity
 #define FAILURE -12 // function has failed for some reason
 #define GIVEUP -15  // function has failed MAX_TRIES times
 
+/* Settings that can be changed while the program runs, for example to
+   compare designs in a simulation.  The default values are the
+   constants above.  */
+typedef struct
+{
+    int bitRate;   // bit rate for the physical layer
+    int optBlock;  // optimum data block size, given by LL_getOptBlockSize
+    int framing;   // framing mode: FRM_PLAIN, FRM_STUFF or FRM_COBS
+    int headerCheck; // TRUE to add a header check byte (both ends must agree)
+    int checksum;  // error detecting code: CHK_SUM250, CHK_CRC32 etc.
+    int arq;       // ARQ mode: ARQ_STOPWAIT, ARQ_GOBACKN or ARQ_SELECTIVE (both ends must agree)
+    int window;    // frames that can be sent before an ACK, 1 to MAX_WINDOW
+    int adaptBlock; // TRUE to adjust the optimum block size to the error rate measured
+    int fec;       // FEC mode: FEC_OFF, FEC_ON or FEC_AUTO
+    int interleave; // FEC codewords interleaved together, 1 to MAX_DEPTH (both ends must agree)
+    int harq;      // TRUE to combine copies of a bad frame
+} LL_options;
+
+/* Counters and measurements for a connection, for reports.
+   These are kept after LL_discon, until the next LL_connect.  */
+typedef struct
+{
+    double connTime;    // time connected, in seconds
+    int framesSent;     // data frames sent, including re-transmissions
+    int goodFrames;     // good frames received
+    int badFrames;      // bad frames received
+    int timeouts;       // timeouts, at either end
+    int resyncs;        // frames found by searching the bytes of a bad frame
+    int badHeaders;     // frames rejected by the header check, before the rest arrived
+    int acksSent;       // ACKs sent
+    int naksSent;       // NAKs sent
+    int acksRX;         // ACKs received
+    int naksRX;         // NAKs received
+    long dataBytesTX;   // data bytes sent and acknowledged
+    long dataBytesRX;   // data bytes delivered to the application
+    int rttSamples;     // round trip times measured, by the sender
+    double srtt;        // smoothed round trip time, in seconds (0 if none measured)
+    double rttvar;      // mean deviation of the round trip time, in seconds
+    double rto;         // retransmission timeout in use, in seconds
+    int optBlock;       // optimum block size, from LL_getOptBlockSize
+    double ber;         // bit error rate measured by the sender (negative if not measured)
+    int fecOn;          // TRUE if the sender is adding FEC parity to its frames
+    int fecFrames;      // frames received with FEC parity
+    int fecFixed;       // bytes corrected by FEC in those frames
+    double ilvDelay;    // average time interleaving held back the end of each codeword received, in seconds
+    int harqFrames;     // bad frames put right by combining them with earlier copies
+} LL_stats;
+
 /* Functions to implement the link layer protocol.
    All functions take a debug argument - if non-zero, they print
    messages explaining what is happening.  Regardless of debug,
@@ -69,6 +229,7 @@ typedef unsigned char byte_t; // define type "byte_t" for simplicity
 int LL_connect(int portNum, int debugIn);
 
 /* Function to disconnect from the other computer.
+   First it waits for any frames not yet acknowledged (with a window).
    It also prints a report of what happened while connected.
    Return value: 0 for success, negative for failure  */
 int LL_discon(void);
@@ -80,6 +241,8 @@ int LL_discon(void);
 int LL_send_basic(byte_t *dataTX, int nTXdata);
 
 /* Function to send a block of data in a frame with full LLC protocol.
+   With a window, success means the frame is sent and kept to send
+   again - it may not be acknowledged until a later call, or LL_discon.
    Arguments:  dataTX - pointer to array of data bytes to send,
                nTXdata - number of data bytes to send.
    Return value:  0 for success, negative for failure  */
@@ -98,14 +261,34 @@ int LL_receive_basic(byte_t *dataRX, int maxData);
 int LL_receive_LLC(byte_t *dataRX, int maxData);
 
 /* Function to return the optimum size of a data block.
-   This is currently specified as a constant in linklayer.h
+   This starts as OPT_BLK, unless changed by LL_setOptions, then (with
+   adaptBlock) follows the error rate measured - it can be asked again
+   at any time, and the value may differ from one block to the next.
    Return value: the optimum block size, in bytes.  */
 int LL_getOptBlockSize(void);
 
+/* Function to get the settings for links in this thread.
+   Argument:  options - pointer to a structure to fill in.  */
+void LL_getOptions(LL_options *options);
+
+/* Function to change the settings for links in this thread.
+   The new settings are used from the next LL_connect, so they cannot
+   be changed while connected - both ends must use the same settings.
+   Argument:  options - pointer to the new settings.
+   Return value: 0 for success, BADUSE if a setting is not valid,
+                 or if connected.  */
+int LL_setOptions(const LL_options *options);
+
+/* Function to get the counters and measurements for the present
+   connection, or the last one if not connected.
+   Argument:  stats - pointer to a structure to fill in.  */
+void LL_getStats(LL_stats *stats);
+
 // ==========================================================
 // Functions called by the main link layer functions above
 
-/* Function to build a frame around a block of data.
+/* Function to build a frame around a block of data, and add the FEC
+   parity if it is on.
    Arguments: frameTX - pointer to an array to hold the frame,
               dataTX - array of data bytes to be put in the frame,
               nDataTX - number of data bytes to be put in the frame,
@@ -138,12 +321,24 @@ int checkFrame(byte_t *frameRX, int sizeFrame);
 int processFrame(byte_t *frameRX, int sizeFrame,
                  byte_t *dataRX, int maxData, int *seqNumRX);
 
+/* Function to send a frame, coded for the framing mode in use.
+   Arguments: frame - pointer to an array holding the frame,
+              sizeFrame - number of bytes in the frame.
+   Return value: sizeFrame if the frame was sent, otherwise negative. */
+int sendFrame(byte_t *frame, int sizeFrame);
+
 /* Function to send an acknowledgement - positive or negative.
    Arguments: type - type of acknowledgement (POSACK or NEGACK),
               seqNum - sequence number that the ack should carry.
    Return value:  indicates success or failure.  */
 int sendAck(int type, int seqNum);
 
+/* Function to send a selective acknowledgement (ARQ_SELECTIVE).
+   Arguments: seqNum - sequence number of the last block received in order,
+              sack - SACK_BYTES bytes, a bit for each block after that.
+   Return value:  indicates success or failure.  */
+int sendSack(int seqNum, const byte_t *sack);
+
 // ==========================================================
 // Helper functions used by various other functions
 
@@ -155,13 +350,14 @@ int next(int seq);
 
 /* Function to set a time limit at a point in the future.
    Argument:   limit - the time limit in seconds, from now.
-   Return value: the time at which the limit will elapse. */
-long timeSet(float limit);
+   Return value: the time at which the limit will elapse, in us
+   on the monotonic clock (see timer.h). */
+long long timeSet(float limit);
 
 /* Function to check if a time limit has elapsed.
    Argument:  timeLimit - end time from timeSet() function.
    Return value: TRUE if the limit has elapsed, FALSE if not. */
-int timeUp(long timeLimit);
+int timeUp(long long timeLimit);
 
 /* Function to check if a byte is one of the protocol bytes.
    Argument:  b - byte value to check
@@ -0,0 +1,565 @@
+/*  Physical Layer driver registry and link functions.
+       PHY_registerDriver  adds a driver to the registry
+       PHY_findDriver      finds a driver by name
+       PHY_linkOpen        checks settings and opens a link with a driver
+       PHY_linkClose       closes a link
+       PHY_linkSend        sends bytes on a link
+       PHY_linkGet         gets received bytes from a link
+       PHY_linkPoll        waits for received bytes on a link
+       PHY_linkRead        waits for received bytes, then gets them all
+       PHY_linkSetErrors   chooses the simulated errors on a link
+       PHY_linkSetEmulator puts a channel emulator on a link
+    This file also has PHY_open, PHY_close, PHY_send, PHY_get and
+    PHY_read, from physical.h, which use a single default link.
+    The parts that are different for each kind of channel are in the
+    drivers - see physical_real.c (Windows) or physical_posix.c (Linux).  */
+
+#include <stdio.h>   // needed for printf
+#include <stdlib.h>  // for malloc, getenv and strtoull
+#include <string.h>  // for strcmp and memcpy
+#include <time.h>    // for time function, used to choose a seed
+#include <stdatomic.h> // to choose the first seed once, in any thread
+#include "physical.h"  // the functions using the default link
+#include "phydriver.h" // header file for functions in this file
+
+/* Creating a variable this way allows it to be shared
+   by the functions in this file only.  */
+static const PHY_driver *drivers[PHY_MAX_DRIVERS];  // the registry
+static int nDrivers = 0;          // number of drivers in the registry
+static _Atomic long nSeeds = 0;   // count of seeds chosen, to make each different
+static _Atomic uint64_t firstSeed = 0;  // seed for the first link, 0 until chosen
+static _Thread_local PHY_link *defaultLink = NULL;  // link used by PHY_open etc.
+static const char *defaultDriver = NULL;  // driver chosen for default link
+static const char *defaultAddress = NULL; // address chosen for default link
+
+// Simulated errors chosen for the default link in this thread
+static _Thread_local int errDefaultsSet = 0;  // set by PHY_setErrorDefaults
+static _Thread_local ERR_config rxDefault;    // receive errors
+static _Thread_local ERR_config txDefault;    // transmit errors
+static _Thread_local uint64_t seedDefault;    // seed, or 0 to choose one
+static _Thread_local long seedIndex = -1;     // set by PHY_setSeedIndex, or -1
+static _Thread_local int emuDefaultSet = 0;   // set by PHY_setEmulatorDefaults
+static _Thread_local EMU_config emuDefault;   // channel emulator settings
+
+// Drivers that are always available
+static const PHY_driver *builtIn[] =
+{
+    &PHY_serialDriver,
+#ifndef _WIN32
+    &PHY_ptyDriver,
+    &PHY_loopbackDriver,
+    &PHY_socketDriver,
+    &PHY_shmDriver,
+#endif
+};
+
+/* Helper function to get the first seed, choosing it the first time:
+   from PHY_SEED if it is set, otherwise from the time.  If two threads
+   get here at once, both use the seed stored first.  */
+static uint64_t getFirstSeed(void)
+{
+    uint64_t seed = atomic_load(&firstSeed);
+    uint64_t none = 0;  // value expected if no seed is stored yet
+    const char *text;   // PHY_SEED value
+
+    if (seed != 0) return seed;  // already chosen
+    text = getenv("PHY_SEED");
+    if ((text != NULL) && (text[0] != '\0'))
+        seed = strtoull(text, NULL, 0);
+    else
+        seed = (uint64_t) time(NULL) ^ (uint64_t) PHY_timeUs();
+    if (seed == 0) seed = 1;  // 0 means no seed given
+    if (!atomic_compare_exchange_strong(&firstSeed, &none, seed))
+        seed = none;  // another thread stored one first
+    return seed;
+}
+
+/* Helper function to choose a seed for the random numbers on a link.
+   Links opened by a thread that has called PHY_setSeedIndex get the
+   first seed plus that index.  Other links get the seeds that follow
+   the first seed, in the order they ask for them.  */
+static uint64_t chooseSeed(void)
+{
+    long n = (seedIndex >= 0) ? seedIndex : nSeeds++;  // number of this seed
+    return getFirstSeed() + (uint64_t) n;
+}
+
+// Helper function to put the built-in drivers in the registry, once.
+static void registerBuiltIn(void)
+{
+    static int done = 0;
+    int i;
+    if (done) return;
+    done = 1;
+    for (i = 0; i < (int)(sizeof(builtIn)/sizeof(builtIn[0])); i++)
+        PHY_registerDriver(builtIn[i]);
+}
+
+//===================================================================
+/* Function to add a driver to the registry.
+   Returns 0 if it succeeds, negative if the registry is full
+   or a driver of the same name is already registered.  */
+int PHY_registerDriver(const PHY_driver *driver)
+{
+    int i;
+    registerBuiltIn();  // make sure built-in drivers come first
+    if ((driver == NULL) || (driver->name == NULL)) return -1;
+    for (i = 0; i < nDrivers; i++)
+    {
+        if (strcmp(drivers[i]->name, driver->name) == 0)
+            return (drivers[i] == driver) ? 0 : -2;  // name already used
+    }
+    if (nDrivers >= PHY_MAX_DRIVERS)
+    {
+        printf("PHY: Driver registry full, cannot add %s\n", driver->name);
+        return -3;
+    }
+    drivers[nDrivers++] = driver;
+    return 0;
+}
+
+//===================================================================
+/* Function to find a driver in the registry, by name.
+   Returns a pointer to the driver, or NULL if not found.  */
+const PHY_driver *PHY_findDriver(const char *name)
+{
+    int i;
+    registerBuiltIn();
+    if (name == NULL) return NULL;
+    for (i = 0; i < nDrivers; i++)
+    {
+        if (strcmp(drivers[i]->name, name) == 0)
+            return drivers[i];
+    }
+    return NULL;  // not found
+}
+
+//===================================================================
+// Function to print the names of the drivers in the registry.
+void PHY_listDrivers(void)
+{
+    int i;
+    registerBuiltIn();
+    printf("PHY: Drivers available:");
+    for (i = 0; i < nDrivers; i++)
+        printf(" %s", drivers[i]->name);
+    printf("\n");
+}
+
+//===================================================================
+/* Function to choose the driver and address for the default link.
+   Returns 0 if it succeeds, PHY_NODRIVER if the driver is not known.  */
+int PHY_selectDriver(const char *driverName, const char *address)
+{
+    if (driverName != NULL)
+    {
+        if (PHY_findDriver(driverName) == NULL)
+        {
+            printf("PHY: Unknown driver requested: %s\n", driverName);
+            PHY_listDrivers();
+            return PHY_NODRIVER;
+        }
+        defaultDriver = driverName;
+    }
+    if (address != NULL) defaultAddress = address;
+    return 0;
+}
+
+//===================================================================
+/* Function to open a link using a driver from the registry.
+   It checks the settings, works out the timing values, then asks
+   the driver to open the channel.
+   Returns zero if it succeeds - anything non-zero is a problem. */
+int PHY_linkOpen(const char *driverName, int portNum, const char *address,
+                 int bitRate, int nDataBits, int parity,
+                 int rxTimeConst, int rxTimeIntv, double probErr,
+                 PHY_link **linkOut)
+{
+    // Define variables
+    int bitRatio, bitRatioValid, i;  // for bit rate checking
+    const PHY_driver *driver;  // the driver to use
+    PHY_link *link;            // the new link
+    PHY_params *p;             // pointer to its settings
+    int status;                // return value from driver
+
+    *linkOut = NULL;  // nothing open yet
+
+    // Find the driver to use
+    if (driverName == NULL) driverName = PHY_DEFAULT_DRIVER;
+    driver = PHY_findDriver(driverName);
+    if (driver == NULL)
+    {
+        printf("PHY: Unknown driver requested: %s\n", driverName);
+        PHY_listDrivers();
+        return PHY_NODRIVER;
+    }
+
+    // First check that parameters given are valid - first bit rate
+    // This code only allows 1200, 2400, 4800, 9600, 19200, 38400 bit/s
+    bitRatio = bitRate/1200;  // all valid rates are multiples of 1200
+    if (bitRate != bitRatio*1200) // bit rate is not multiple of 1200
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+    bitRatioValid = 0;
+    for (i=1; i<=32; i*=2)
+    {
+        if (bitRatio == i)   // restrict to ratios that are powers of 2
+            bitRatioValid = 1;
+    }
+    if (bitRatioValid==0)
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+
+    // Now check the number of data bits requested
+    // Only 7 or 8 data bits allowed
+    if ((nDataBits!=7) && (nDataBits!= 8))
+    {
+        printf("PHY: Invalid number of data bits: %d\n", nDataBits);
+        return 3;
+    }
+
+    // Now check parity - only 0, 1, 2 allowed
+    if ((parity<0) || (parity>2))
+    {
+        printf("PHY: Invalid parity requested: %d\n", parity);
+        return 3;
+    }
+
+    // Get memory for the link
+    link = (PHY_link *) calloc(1, sizeof(PHY_link));
+    if (link == NULL)
+    {
+        printf("PHY: No memory for new link\n");
+        return PHY_NOMEMORY;
+    }
+    link->driver = driver;
+    p = &link->params;
+
+    // Store the settings for the driver to use
+    p->bitRate = bitRate;
+    p->nDataBits = nDataBits;
+    p->parity = parity;
+    p->rxTimeConst = rxTimeConst;
+    p->rxTimeIntv = rxTimeIntv;
+
+    /* Calculate time per byte, based on bit rate, number of data bits,
+	   and parity.  timePerByte is in units of 0.1 ms.  timeMult is in ms.   */
+	p->bitsPerGroup = nDataBits + 2 + (parity ? 1 : 0);
+
+	// Calculate time to send each group, in units of 0.1 ms, rounding up
+	// For a 10-bit group, this gives 8.4 ms at 1200 bit/s, 0.3 ms at 38400 bit/s
+    p->timePerByte = 1 + 10000*p->bitsPerGroup/bitRate;
+
+	// Calculate the multiplier to use, in ms, with minimum 1 ms
+	p->timeMult = 1 + 1000*p->bitsPerGroup/bitRate;
+
+    /* Set up simulated errors on the receive path:
+       check the probability of error value, then use it
+       as the bit error probability for independent errors. */
+    if ((probErr>=0.0) && (probErr<=1.0))  // check valid
+        p->probErr = probErr;
+
+    // Now ask the driver to open the channel
+    status = driver->open(link, portNum, address);
+    if (status != 0)
+    {
+        free(link);
+        return status;
+    }
+
+    // If we get this far, the link is open and configured
+    *linkOut = link;
+    if (p->probErr > 0.0)
+    {
+        ERR_config rxConfig = { ERR_BER, 0.0, 0.0, 0.0, 0.0 };
+        rxConfig.ber = p->probErr;
+        PHY_linkSetErrors(link, &rxConfig, NULL, 0);
+    }
+    else PHY_linkSetErrors(link, NULL, NULL, 0);
+    return 0;
+}
+
+//===================================================================
+/* Function to set the simulated errors for a link.
+   The transmit model gets a different seed from the receive model,
+   so the two do not produce the same pattern of errors.  */
+void PHY_linkSetErrors(PHY_link *link, const ERR_config *rx,
+                       const ERR_config *tx, uint64_t seed)
+{
+    int rxOn = (rx != NULL) && (rx->type != ERR_NONE);
+    int txOn = (tx != NULL) && (tx->type != ERR_NONE);
+
+    if (link == NULL) return;
+    if ((seed == 0) && (rxOn || txOn)) seed = chooseSeed();
+    ERR_init(&link->rxErrors, rxOn ? rx : NULL, seed);
+    ERR_init(&link->txErrors, txOn ? tx : NULL, ~seed);
+
+    // Print the seed, so the errors can be repeated
+    if (rxOn || txOn)
+        printf("PHY: Simulated errors on %s%s%s, seed %llu\n",
+               rxOn ? "receive" : "", (rxOn && txOn) ? " and " : "",
+               txOn ? "transmit" : "", (unsigned long long) seed);
+}
+
+//===================================================================
+/* Function to choose the simulated errors for the default link. */
+void PHY_setErrorDefaults(const ERR_config *rx, const ERR_config *tx,
+                          uint64_t seed)
+{
+    ERR_config none = { ERR_NONE, 0.0, 0.0, 0.0, 0.0 };
+    rxDefault = (rx != NULL) ? *rx : none;
+    txDefault = (tx != NULL) ? *tx : none;
+    seedDefault = seed;
+    errDefaultsSet = 1;
+}
+
+//===================================================================
+/* Function to choose the seed for links opened by this thread. */
+void PHY_setSeedIndex(long index)
+{
+    seedIndex = (index >= 0) ? index : -1;
+}
+
+//===================================================================
+/* Function to put a channel emulator on the bytes received on a link.
+   Its random numbers start from a different point from the error
+   models, so the same seed can be used for both.
+   Returns 0 if it succeeds, 3 if there is no memory or the trace
+   file cannot be read.  */
+int PHY_linkSetEmulator(PHY_link *link, const EMU_config *config, uint64_t seed)
+{
+    if (link == NULL) return 0;
+    EMU_free(link->emu);  // remove any emulator already there
+    link->emu = NULL;
+    if ((config == NULL) || !EMU_active(config)) return 0;
+
+    if (seed == 0) seed = chooseSeed();
+    link->emu = EMU_create(config, seed ^ 0x454D554C41544F52ULL);
+    if (link->emu == NULL)
+    {
+        printf("PHY: Failed to set up channel emulator\n");
+        return 3;
+    }
+    printf("PHY: Channel emulator on receive, seed %llu\n",
+           (unsigned long long) seed);
+    return 0;
+}
+
+//===================================================================
+/* Function to choose the channel emulator for the default link. */
+void PHY_setEmulatorDefaults(const EMU_config *config)
+{
+    memset(&emuDefault, 0, sizeof(EMU_config));
+    if (config != NULL) emuDefault = *config;
+    emuDefaultSet = 1;
+}
+
+//===================================================================
+/* Function to close a link and free its memory.
+   Returns 0 always.  */
+int PHY_linkClose(PHY_link *link)
+{
+    if (link == NULL) return 0;
+    EMU_free(link->emu);  // reports what it did
+    link->driver->close(link);
+    free(link);
+    return 0;
+}
+
+//===================================================================
+/* Function to send bytes on a link, adding simulated errors.
+   Returns number of bytes actually sent, or a negative value on failure.  */
+int PHY_linkSend(PHY_link *link, byte_t *dataTX, int nBytesToSend)
+{
+    byte_t copy[256];   // bytes with errors added, as the caller's are not changed
+    int nBytesSent = 0; // number of bytes sent so far
+    int nCopy;          // number of bytes in copy
+    int retVal;         // return value from driver
+
+    // First check if the link is open
+    if (link == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    if (link->txErrors.config.type == ERR_NONE)  // no errors - send as they are
+        return link->driver->send(link, dataTX, nBytesToSend);
+
+    // Copy the bytes in blocks, add errors and send each block
+    while (nBytesSent < nBytesToSend)
+    {
+        nCopy = nBytesToSend - nBytesSent;
+        if (nCopy > (int) sizeof(copy)) nCopy = (int) sizeof(copy);
+        memcpy(copy, dataTX + nBytesSent, nCopy);
+        if (ERR_apply(&link->txErrors, copy, nCopy) > 0)
+            printf("PHY_send:  ####  Simulated bit error...  ####\n");
+        retVal = link->driver->send(link, copy, nCopy);
+        if (retVal < 0) return retVal;
+        nBytesSent += retVal;
+        if (retVal < nCopy) break;  // timeout - do not send any more
+    }
+    return nBytesSent;
+}
+
+//===================================================================
+/* Function to get received bytes from a link, adding simulated errors.
+   Returns number of bytes actually received, or a negative value on failure.  */
+int PHY_linkGet(PHY_link *link, byte_t *dataRX, int nBytesToGet)
+{
+     int nBytesGot;      // number of bytes got from the driver
+
+    // First check if the link is open
+    if (link == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+
+    // Check for a sensible number of bytes to get
+    if (nBytesToGet <= 0) return 0;
+
+    // Try to get bytes as requested, through the emulator if there is one
+    if (link->emu != NULL)
+        nBytesGot = EMU_get(link, link->emu, dataRX, nBytesToGet);
+    else
+        nBytesGot = link->driver->get(link, dataRX, nBytesToGet);
+    if (nBytesGot <= 0) return nBytesGot;  // nothing to add errors to
+
+    // Add bit errors, as the error model decides
+    if (ERR_apply(&link->rxErrors, dataRX, nBytesGot) > 0)
+        printf("PHY_get:  ####  Simulated bit error...  ####\n");
+
+    return nBytesGot; // if no problem, return the number of bytes received
+}
+
+//===================================================================
+/* Function to wait for received bytes on a link.
+   Returns positive if bytes are waiting, 0 if time ran out,
+   negative on failure.  */
+int PHY_linkPoll(PHY_link *link, int timeout_ms)
+{
+    if (link == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    if (link->emu != NULL) return EMU_poll(link, link->emu, timeout_ms);
+    return link->driver->poll(link, timeout_ms);
+}
+
+//===================================================================
+/* Function to wait for received bytes on a link, then get all that
+   are waiting, up to maxBytes.  The poll gives the number waiting,
+   so the get has them all at once and does not wait for more.
+   Returns number of bytes got, 0 if time ran out, negative on failure.  */
+int PHY_linkRead(PHY_link *link, byte_t *dataRX, int maxBytes, int timeout_ms)
+{
+    int waiting = PHY_linkPoll(link, timeout_ms);  // bytes waiting
+    if (waiting <= 0) return waiting;  // time ran out, or failed
+    if (waiting > maxBytes) waiting = maxBytes;
+    return PHY_linkGet(link, dataRX, waiting);
+}
+
+//===================================================================
+/* PHY_open function - to open and configure the default link.
+   The driver is chosen by PHY_selectDriver, or the PHY_DRIVER
+   environment variable, and the address by PHY_ADDRESS.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_open(int portNum,       // port number: e.g. 1 for COM1 or /dev/ttyS0
+             int bitRate,       // bit rate: e.g. 1200, 4800, etc.
+             int nDataBits,     // number of data bits: 7 or 8
+             int parity,        // parity: 0 = none, 1 = odd, 2 = even
+             int rxTimeConst,   // rx timeout constant in ms: 0 waits forever
+             int rxTimeIntv,    // rx timeout interval in ms: 0 waits forever
+             double probErr)    // rx probability of error: 0.0 for none
+{
+    const char *driverName = defaultDriver;  // driver to use
+    const char *address = defaultAddress;    // address to use
+    ERR_config rx, tx;  // simulated errors to use
+    EMU_config emu;     // channel emulator to use
+    int status;         // return value from PHY_linkOpen
+
+    if (defaultLink != NULL) PHY_close();  // only one default link
+
+    // If nothing was chosen in the program, look in the environment
+    if (driverName == NULL) driverName = getenv("PHY_DRIVER");
+    if (address == NULL) address = getenv("PHY_ADDRESS");
+    if ((driverName != NULL) && (driverName[0] == '\0')) driverName = NULL;
+    if ((address != NULL) && (address[0] == '\0')) address = NULL;
+
+    /* Choose the simulated errors: those chosen in the program, or in the
+       environment, or independent errors on receive using probErr.  */
+    if (errDefaultsSet)
+    {
+        rx = rxDefault;
+        tx = txDefault;
+    }
+    else if ((ERR_parse(getenv("PHY_RXERR"), &rx) != 0)
+             || (ERR_parse(getenv("PHY_TXERR"), &tx) != 0))
+    {
+        printf("PHY: Invalid error model in PHY_RXERR or PHY_TXERR\n");
+        return 3;
+    }
+    else if ((getenv("PHY_RXERR") == NULL) && (probErr > 0.0) && (probErr <= 1.0))
+    {
+        rx.type = ERR_BER;  // keep probErr on receive
+        rx.ber = probErr;
+    }
+
+    // Choose the channel emulator in the same way
+    if (emuDefaultSet) emu = emuDefault;
+    else if (EMU_parse(getenv("PHY_EMU"), &emu) != 0)
+    {
+        printf("PHY: Invalid channel emulator settings in PHY_EMU\n");
+        return 3;
+    }
+
+    // Open the link without errors, then set the errors chosen
+    status = PHY_linkOpen(driverName, portNum, address, bitRate, nDataBits,
+                          parity, rxTimeConst, rxTimeIntv, 0.0, &defaultLink);
+    if (status != 0) return status;
+    defaultLink->params.probErr = (rx.type == ERR_BER) ? rx.ber : 0.0;
+    PHY_linkSetErrors(defaultLink, &rx, &tx, errDefaultsSet ? seedDefault : 0);
+    status = PHY_linkSetEmulator(defaultLink, &emu, errDefaultsSet ? seedDefault : 0);
+    if (status != 0) PHY_close();
+    return status;
+}
+
+//===================================================================
+/* PHY_close function, to close the default link.
+   Takes no arguments, returns 0 always.  */
+int PHY_close()
+{
+    PHY_linkClose(defaultLink);
+    defaultLink = NULL;
+    return 0;
+}
+
+//===================================================================
+/* PHY_send function, to send bytes on the default link.
+   Returns number of bytes actually sent, or a negative value on failure.  */
+int PHY_send(byte_t *dataTX, int nBytesToSend)
+{
+    return PHY_linkSend(defaultLink, dataTX, nBytesToSend);
+}
+
+//===================================================================
+/* PHY_get function, to get received bytes from the default link.
+   Returns number of bytes actually received, or a negative value on failure.  */
+int PHY_get(byte_t *dataRX, int nBytesToGet)
+{
+    return PHY_linkGet(defaultLink, dataRX, nBytesToGet);
+}
+
+//===================================================================
+/* PHY_read function, to wait for received bytes on the default link,
+   then get all that are waiting, up to the number given.
+   Returns number of bytes got, 0 if time ran out, negative on failure.  */
+int PHY_read(byte_t *dataRX, int maxBytes, int timeout_ms)
+{
+    return PHY_linkRead(defaultLink, dataRX, maxBytes, timeout_ms);
+}
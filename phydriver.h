@@ -0,0 +1,212 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef PHYDRIVER_H_INCLUDED
+#define PHYDRIVER_H_INCLUDED
+
+#include "errmodel.h"  // for simulated errors on each link
+#include "emulator.h"  // for the channel emulator on each link
+
+/*  Physical Layer drivers.
+    Each kind of physical channel (serial port, pty, loopback, socket,
+    shared memory) is a driver: a set of functions that work on one link
+    at a time.
+    Everything a driver knows about a link is kept in a PHY_link
+    structure, so one program can have many links open at once, using
+    the same or different drivers.  Drivers are found by name in a
+    registry, so the channel can be chosen when the program runs.
+
+    The PHY_open, PHY_close, PHY_send and PHY_get functions in physical.h
+    use a single default link.  Its driver is taken from the PHY_DRIVER
+    environment variable (or PHY_selectDriver), and its address from
+    PHY_ADDRESS.  If neither is set, the serial driver is used.
+
+    Simulated errors can be added to the bytes sent and received on a link,
+    using the models in errmodel.h.  PHY_linkOpen sets up independent errors
+    on receive, using the probErr value as bit error probability.  Other
+    models can be set with PHY_linkSetErrors, or for the default link with
+    PHY_setErrorDefaults or the PHY_RXERR and PHY_TXERR environment
+    variables (see ERR_parse for the form).  The seed for the random
+    numbers is printed, and can be given in PHY_SEED to repeat a run.
+    If links are opened by several threads at once, each thread should
+    choose its seed with PHY_setSeedIndex, so the seeds do not depend on
+    which thread is first.
+
+    The channel emulator (emulator.h) can add delay, lost, extra and
+    garbage bytes to the bytes received on a link, in front of any driver.
+    It is set with PHY_linkSetEmulator, or for the default link with
+    PHY_setEmulatorDefaults or the PHY_EMU environment variable.  */
+
+#define PHY_MAX_DRIVERS 16  // maximum number of drivers in the registry
+#define PHY_DEFAULT_DRIVER "serial"  // driver used if none selected
+
+// Return codes from PHY_linkOpen, in addition to those from PHY_open
+#define PHY_NODRIVER 7   // no driver with the name given
+#define PHY_NOMEMORY 8   // could not allocate memory for the link
+
+/* Settings for a link, checked and filled in by PHY_linkOpen
+   before the driver is asked to open the link.  */
+typedef struct
+{
+    int bitRate;       // bit rate: e.g. 1200, 4800, etc.
+    int nDataBits;     // number of data bits: 7 or 8
+    int parity;        // parity: 0 = none, 1 = odd, 2 = even
+    int rxTimeConst;   // rx timeout constant in ms: 0 waits forever
+    int rxTimeIntv;    // rx timeout interval in ms: 0 waits forever
+    double probErr;    // rx probability of error: 0.0 for none
+    int bitsPerGroup;  // number of bits in each group (start to stop)
+    int timePerByte;   // approx. time to send a byte, in tenths of ms
+    int timeMult;      // time per byte, in ms, rounded up, minimum 1 ms
+} PHY_params;
+
+typedef struct PHY_link PHY_link;
+
+/* The functions that make up a driver.  Each one works on the link given.
+   open    - opens the channel, using the port number or address string
+             (address may be NULL), returns 0 or a PHY_open problem code;
+   close   - closes the channel and frees its state, returns 0;
+   send    - as PHY_send;
+   get     - as PHY_get, with time limits from the link settings,
+             but without simulated errors (they are added by PHY_linkGet);
+   poll    - waits up to timeout_ms (negative waits forever) for bytes,
+             returns the number of bytes waiting (or 1 if the number
+             is not known), 0 if time ran out, or a negative value on
+             failure.  A get for that number of bytes should not wait.  */
+typedef struct
+{
+    const char *name;  // name used to select the driver
+    int (*open)(PHY_link *link, int portNum, const char *address);
+    int (*close)(PHY_link *link);
+    int (*send)(PHY_link *link, byte_t *dataTX, int nBytesToSend);
+    int (*get)(PHY_link *link, byte_t *dataRX, int nBytesToGet);
+    int (*poll)(PHY_link *link, int timeout_ms);
+} PHY_driver;
+
+// Everything about one link
+struct PHY_link
+{
+    const PHY_driver *driver;  // the driver used by this link
+    PHY_params params;         // settings for this link
+    void *state;               // driver's own data for this link
+    ERR_model rxErrors;        // simulated errors on bytes received
+    ERR_model txErrors;        // simulated errors on bytes sent
+    EMU_state *emu;            // channel emulator on bytes received, or NULL
+};
+
+/* Function to add a driver to the registry.
+   The driver structure must stay valid while the program runs.
+   Returns 0 if it succeeds, negative if the registry is full
+   or a driver of the same name is already registered.  */
+int PHY_registerDriver(const PHY_driver *driver);
+
+/* Function to find a driver in the registry, by name.
+   Returns a pointer to the driver, or NULL if not found.  */
+const PHY_driver *PHY_findDriver(const char *name);
+
+/* Function to print the names of the drivers in the registry. */
+void PHY_listDrivers(void);
+
+/* Function to choose the driver and address for the default link,
+   used by PHY_open.  Either may be NULL to keep the current choice.
+   Returns 0 if it succeeds, PHY_NODRIVER if the driver is not known.  */
+int PHY_selectDriver(const char *driverName, const char *address);
+
+/* Function to open a link using a driver from the registry.
+   Arguments are driver name (NULL for the default), port number,
+   address string (NULL to use port number), then as for PHY_open,
+   and finally a pointer to where the new link pointer will be put.
+   Returns zero if it succeeds - anything non-zero is a problem. */
+int PHY_linkOpen(const char *driverName, int portNum, const char *address,
+                 int bitRate, int nDataBits, int parity,
+                 int rxTimeConst, int rxTimeIntv, double probErr,
+                 PHY_link **linkOut);
+
+/* Function to set the simulated errors for a link.
+   Arguments: link - the link,
+              rx, tx - error models for receive and transmit,
+                       NULL for no errors,
+              seed - seed for the random numbers, 0 to choose one.  */
+void PHY_linkSetErrors(PHY_link *link, const ERR_config *rx,
+                       const ERR_config *tx, uint64_t seed);
+
+/* Function to choose the simulated errors for the default link, opened
+   by PHY_open in this thread.  These replace the probErr value given
+   to PHY_open.  Arguments as for PHY_linkSetErrors.  */
+void PHY_setErrorDefaults(const ERR_config *rx, const ERR_config *tx,
+                          uint64_t seed);
+
+/* Function to choose the seed for the random numbers on links opened by
+   this thread, when no seed is given: PHY_SEED (or the seed chosen from
+   the time) plus the index.  Threads that open links at the same time
+   should use different indexes, e.g. 0 for the sending end and 1 for
+   the receiving end.
+   Argument: index - 0 or more, or negative to take the next seed
+                     in the order links are opened (the default).  */
+void PHY_setSeedIndex(long index);
+
+/* Function to put a channel emulator on the bytes received on a link,
+   replacing any emulator already there.
+   Arguments: link - the link,
+              config - the emulator settings, or NULL for none,
+              seed - seed for the random numbers, or 0 to choose one.
+   Returns 0 if it succeeds, 3 if there is no memory or the trace file
+   cannot be read.  */
+int PHY_linkSetEmulator(PHY_link *link, const EMU_config *config, uint64_t seed);
+
+/* Function to choose the channel emulator for the default link, opened
+   by PHY_open in this thread, instead of PHY_EMU.  It uses the seed
+   given to PHY_setErrorDefaults, if any.
+   Argument: config - the emulator settings, or NULL for none.  */
+void PHY_setEmulatorDefaults(const EMU_config *config);
+
+/* Function to close a link and free its memory.  Returns 0 always. */
+int PHY_linkClose(PHY_link *link);
+
+/* Functions to send and get bytes on a link, as PHY_send and PHY_get. */
+int PHY_linkSend(PHY_link *link, byte_t *dataTX, int nBytesToSend);
+int PHY_linkGet(PHY_link *link, byte_t *dataRX, int nBytesToGet);
+
+/* Function to wait for received bytes on a link.
+   Argument timeout_ms is the longest time to wait, negative waits forever.
+   Returns positive if bytes are waiting (the number waiting, if known),
+   0 if time ran out, negative on failure.  */
+int PHY_linkPoll(PHY_link *link, int timeout_ms);
+
+/* Function to wait for received bytes on a link, then get all that
+   are waiting, up to the number given, as PHY_read.  */
+int PHY_linkRead(PHY_link *link, byte_t *dataRX, int maxBytes, int timeout_ms);
+
+/* Function to get the time in microseconds, from a clock that only
+   goes forward, for measuring time intervals.  It is in the same
+   file as the serial driver, as it depends on the operating system.  */
+long long PHY_timeUs(void);
+
+#ifndef _WIN32
+/* Drivers that use a POSIX file descriptor (serial, pty, socket) keep
+   this structure as their state, and share the send, get and poll
+   functions from physical_posix.c.  */
+typedef struct
+{
+    int fd;       // file descriptor for the channel
+    int slaveFd;  // pty driver only: our copy of the slave side, or -1
+} PHY_fdState;
+
+int PHY_fdSend(PHY_link *link, byte_t *dataTX, int nBytesToSend);
+int PHY_fdGet(PHY_link *link, byte_t *dataRX, int nBytesToGet);
+int PHY_fdPoll(PHY_link *link, int timeout_ms);
+#endif
+
+// Drivers built in to the program, registered automatically
+extern const PHY_driver PHY_serialDriver;  // serial port, in physical_*.c
+#ifndef _WIN32
+extern const PHY_driver PHY_ptyDriver;     // new pty pair, in physical_posix.c
+extern const PHY_driver PHY_loopbackDriver; // in-process channel, in physical_loopback.c
+extern const PHY_driver PHY_socketDriver;  // local stream socket, in physical_socket.c
+extern const PHY_driver PHY_shmDriver;     // shared memory, in physical_shm.c
+#endif
+
+#endif // PHYDRIVER_H_INCLUDED
@@ -15,16 +15,21 @@ typedef unsigned char byte_t;  // define type "byte_t" for simplicity
        PHY_open        opens and configures the port
        PHY_close       closes the port
        PHY_send        sends bytes
-       PHY_receive     gets received bytes
+       PHY_get         gets received bytes
+       PHY_read        waits for received bytes, then gets them all
     All functions print explanatory messages if there is
-    a problem, and return values to indicate failure. */
+    a problem, and return values to indicate failure.
+    These functions use a single default link, through the driver
+    registry in phydriver.c - see phydriver.h to use more links, or
+    to choose a different kind of channel.  The serial port driver is
+    in physical_real.c for Windows, and physical_posix.c for Linux. */
 
 /* PHY_open function - to open and configure the serial port.
    Arguments are port number, bit rate, number of data bits, parity,
    receive timeout constant, rx timeout interval, rx probability of error.
    See comments in function for more details of timeouts.
    Returns zero if it succeeds - anything non-zero is a problem.*/
-int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
+int PHY_open(int portNum,       // port number: e.g. 1 for COM1 or /dev/ttyS0
              int bitRate,       // bit rate: e.g. 1200, 4800, etc.
              int nDataBits,     // number of data bits: 7 or 8
              int parity,        // parity: 0 = none, 1 = odd, 2 = even
@@ -48,6 +53,16 @@ int PHY_send(byte_t *dataTX, int nBytesToSend);
    Returns number of bytes actually got, or negative value on failure. */
 int PHY_get(byte_t *dataRX, int nBytesToGet);
 
+/* PHY_read function, to wait for received bytes, then get them.
+   It sleeps until bytes arrive or the time limit passes, then gets
+   all the bytes waiting, up to the maximum, without waiting for more.
+   Arguments: pointer to array to hold received bytes;
+              maximum number of bytes to get;
+              longest time to wait in ms, 0 to only check, negative
+              to wait forever.
+   Returns number of bytes got, 0 if time ran out, negative on failure. */
+int PHY_read(byte_t *dataRX, int maxBytes, int timeout_ms);
+
 /* Function to print informative messages
    when something goes wrong...  */
 void printProblem(void);
@@ -0,0 +1,362 @@
+/*  Physical Layer driver for a loopback channel inside one program.
+       loopback driver   joins two links opened with the same address,
+                         so bytes sent on one are received on the other
+    The channel behaves like a serial line at the bit rate chosen:
+    each byte takes timePerByte to send, bytes queue up behind each other,
+    and a byte cannot be received until it has been completely sent.
+    This allows the link layer to be tested and measured at any bit rate
+    with no hardware, with the two ends of the link in separate threads.
+    If the two ends are tasks in a simulation (see sim.h), all the times
+    are virtual: waiting for bytes lets the other end run, instead of
+    taking real time.
+    This version uses POSIX threads.  */
+
+#define _POSIX_C_SOURCE 200809L  // needed for pthread_condattr_setclock
+
+#include <stdio.h>    // needed for printf
+#include <stdlib.h>   // for malloc
+#include <string.h>   // for strcmp
+#include <time.h>     // for clock values used by pthread
+#include <pthread.h>  // for mutex and condition variables
+#include "phydriver.h" // driver functions in this file
+#include "sim.h"       // for waiting in virtual time
+
+#define LOOP_BUFSIZE 16384  // size of the byte queue in each direction
+#define LOOP_NAMESIZE 32    // longest channel name
+
+// One direction of the channel: a queue of bytes and their arrival times
+typedef struct
+{
+    byte_t data[LOOP_BUFSIZE];      // bytes in the queue
+    long long arrive[LOOP_BUFSIZE]; // time when each byte can be received, in us
+    int head;          // position of the oldest byte
+    int count;         // number of bytes in the queue
+    long long lineFree; // time when the last byte queued will be completely sent
+} loopQueue;
+
+// A channel joining two links
+typedef struct loopChannel
+{
+    char name[LOOP_NAMESIZE];  // address used to find the channel
+    int users;                 // number of links using the channel (0 to 2)
+    int sideUsed[2];           // set when each end is in use
+    loopQueue queue[2];        // queue[i] carries bytes sent by end i
+    pthread_cond_t changed;    // signalled when bytes are added or removed
+    int waiter[2];             // simulation task waiting at each end, or -1
+    struct loopChannel *nextChan;  // list of channels
+} loopChannel;
+
+// Data kept for each link using this driver
+typedef struct
+{
+    loopChannel *chan;  // the channel
+    int side;           // which end of the channel this link is: 0 or 1
+} loopState;
+
+/* Creating a variable this way allows it to be shared
+   by the functions in this file only.  One lock protects all channels. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static loopChannel *channels = NULL;  // list of channels in use
+
+// Helper function to convert a time in us to the form used by pthread.
+static struct timespec toTimespec(long long timeUs)
+{
+    struct timespec t;
+    t.tv_sec = (time_t)(timeUs / 1000000);
+    t.tv_nsec = (long)(timeUs % 1000000) * 1000;
+    return t;
+}
+
+/* Helper function to wait until the channel changes or a time is reached.
+   In a simulation, the task waits in virtual time, and the other end
+   wakes it when something changes, using notify.  */
+static void waitChange(loopChannel *chan, int side, long long untilUs)
+{
+    struct timespec t;
+    if (SIM_active())
+    {
+        chan->waiter[side] = SIM_self();
+        pthread_mutex_unlock(&lock);  // the other end needs the lock to run
+        SIM_wait((untilUs < 0) ? SIM_FOREVER : untilUs);
+        pthread_mutex_lock(&lock);
+        chan->waiter[side] = -1;
+    }
+    else if (untilUs < 0)
+        pthread_cond_wait(&chan->changed, &lock);  // wait forever
+    else
+    {
+        t = toTimespec(untilUs);
+        pthread_cond_timedwait(&chan->changed, &lock, &t);
+    }
+}
+
+/* Helper function to tell the link at one end that the channel has changed.
+   A simulation task waiting there is woken at time atUs, at the latest.  */
+static void notify(loopChannel *chan, int side, long long atUs)
+{
+    pthread_cond_broadcast(&chan->changed);
+    if (chan->waiter[side] >= 0) SIM_wake(chan->waiter[side], atUs);
+}
+
+//===================================================================
+/* Function to open one end of a loopback channel.  The channel is named
+   by the address, or made from the port number if no address is given.
+   The first link to open a name gets one end, the second gets the other.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int loopOpen(PHY_link *link, int portNum, const char *address)
+{
+    char name[LOOP_NAMESIZE];   // channel name
+    loopChannel *chan;          // the channel
+    loopState *st;              // data for this link
+    pthread_condattr_t attr;    // so the condition uses the same clock as PHY_timeUs
+
+    if (address != NULL)
+        snprintf(name, sizeof(name), "%s", address);
+    else
+        snprintf(name, sizeof(name), "loop%d", portNum);
+
+    st = (loopState *) malloc(sizeof(loopState));
+    if (st == NULL) return PHY_NOMEMORY;
+
+    pthread_mutex_lock(&lock);
+
+    // Look for a channel with this name, that has a free end
+    for (chan = channels; chan != NULL; chan = chan->nextChan)
+        if (strcmp(chan->name, name) == 0) break;
+
+    if (chan == NULL)  // not found, so make a new channel
+    {
+        chan = (loopChannel *) calloc(1, sizeof(loopChannel));
+        if (chan == NULL)
+        {
+            pthread_mutex_unlock(&lock);
+            free(st);
+            return PHY_NOMEMORY;
+        }
+        snprintf(chan->name, sizeof(chan->name), "%s", name);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&chan->changed, &attr);
+        pthread_condattr_destroy(&attr);
+        chan->waiter[0] = -1;
+        chan->waiter[1] = -1;
+        chan->nextChan = channels;
+        channels = chan;
+    }
+    else if (chan->users >= 2)
+    {
+        pthread_mutex_unlock(&lock);
+        printf("PHY: Loopback channel |%s| already has two ends\n", name);
+        free(st);
+        return 1;
+    }
+
+    st->chan = chan;
+    st->side = chan->sideUsed[0] ? 1 : 0;  // take the free end
+    chan->sideUsed[st->side] = 1;
+    chan->users++;
+    /* The receive queue is not cleared - the channel is new, so any bytes
+       waiting were sent by the other end, and should be received.  */
+
+    pthread_mutex_unlock(&lock);
+
+    link->state = st;
+    return 0;
+}
+
+//===================================================================
+/* Function to close one end of a loopback channel.  When both ends
+   are closed, the channel is removed.  Returns 0 always.  */
+static int loopClose(PHY_link *link)
+{
+    loopState *st = (loopState *) link->state;
+    loopChannel *chan, **prev;
+
+    if (st == NULL) return 0;
+    chan = st->chan;
+
+    pthread_mutex_lock(&lock);
+    chan->sideUsed[st->side] = 0;
+    chan->users--;
+    if (chan->users == 0)  // last one out - remove the channel
+    {
+        for (prev = &channels; *prev != NULL; prev = &(*prev)->nextChan)
+        {
+            if (*prev == chan)
+            {
+                *prev = chan->nextChan;
+                break;
+            }
+        }
+        pthread_cond_destroy(&chan->changed);
+        free(chan);
+    }
+    else notify(chan, 1 - st->side, PHY_timeUs());  // wake the other end
+    pthread_mutex_unlock(&lock);
+
+    free(st);
+    link->state = NULL;
+    return 0;
+}
+
+//===================================================================
+/* Function to send bytes on a loopback channel.
+   The bytes are put in the queue with the time each one will arrive,
+   one byte time apart, after any bytes already being sent.
+   Like a serial port with a transmit buffer, this returns without
+   waiting for the bytes to be sent, unless the queue is full.
+   Returns number of bytes actually sent, or a negative value on failure.  */
+static int loopSend(PHY_link *link, byte_t *dataTX, int nBytesToSend)
+{
+    loopState *st = (loopState *) link->state;
+    loopQueue *q;        // queue for this direction
+    long long byteTime;  // time to send one byte, in us
+    long long now;       // time now, in us
+    long long first = -1; // arrival time of the first byte sent, in us
+    int i, pos;
+
+    if (st == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    q = &st->chan->queue[st->side];
+    byteTime = 100LL * link->params.timePerByte;  // timePerByte is in 0.1 ms
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < nBytesToSend; i++)
+    {
+        while (q->count >= LOOP_BUFSIZE)  // queue full - wait for space
+        {
+            if (!st->chan->sideUsed[1 - st->side])  // no one to read it - lose the oldest byte
+            {
+                q->head = (q->head + 1) % LOOP_BUFSIZE;
+                q->count--;
+                break;
+            }
+            if (first >= 0) notify(st->chan, 1 - st->side, first);
+            waitChange(st->chan, st->side, -1);
+        }
+        now = PHY_timeUs();
+        if (q->lineFree < now) q->lineFree = now;  // line is idle
+        q->lineFree += byteTime;  // this byte arrives one byte time later
+        pos = (q->head + q->count) % LOOP_BUFSIZE;
+        q->data[pos] = dataTX[i];
+        q->arrive[pos] = q->lineFree;
+        q->count++;
+        if (first < 0) first = q->lineFree;
+    }
+    if (first >= 0) notify(st->chan, 1 - st->side, first);
+    pthread_mutex_unlock(&lock);
+
+    return nBytesToSend;
+}
+
+//===================================================================
+/* Function to get received bytes from a loopback channel.
+   Uses the same time limits as the serial driver: a total limit of
+   rxTimeConst + timeMult * bytes requested, and after the first byte,
+   a limit of rxTimeIntv between bytes.
+   Returns number of bytes actually received, or a negative value on failure.  */
+static int loopGet(PHY_link *link, byte_t *dataRX, int nBytesToGet)
+{
+    loopState *st = (loopState *) link->state;
+    PHY_params *p = &link->params;
+    loopQueue *q;              // queue for this direction
+    int nBytesGot = 0;         // number of bytes got so far
+    long long now;             // time now, in us
+    long long endTime = -1;    // time limit for the whole read, or -1
+    long long limit;           // time limit for the next byte, or -1
+    long long lastByte = 0;    // time when the last byte was received
+
+    if (st == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    q = &st->chan->queue[1 - st->side];
+
+    now = PHY_timeUs();
+    if (p->rxTimeConst != 0)
+        endTime = now + 1000LL * (p->rxTimeConst + (long long)p->timeMult * nBytesToGet);
+
+    pthread_mutex_lock(&lock);
+    while (nBytesGot < nBytesToGet)
+    {
+        now = PHY_timeUs();
+
+        // Take all the bytes that have arrived by now
+        while ((nBytesGot < nBytesToGet) && (q->count > 0)
+               && (q->arrive[q->head] <= now))
+        {
+            dataRX[nBytesGot++] = q->data[q->head];
+            q->head = (q->head + 1) % LOOP_BUFSIZE;
+            q->count--;
+            lastByte = now;
+        }
+        if (nBytesGot == nBytesToGet) break;
+
+        // Work out how long we may wait for the next byte
+        limit = endTime;
+        if ((nBytesGot > 0) && (p->rxTimeIntv != 0))
+        {
+            long long intvEnd = lastByte + 1000LL * p->rxTimeIntv;
+            if ((limit < 0) || (intvEnd < limit)) limit = intvEnd;
+        }
+        if ((limit >= 0) && (now >= limit)) break;  // out of time
+
+        // Wait until the next byte arrives, or something changes
+        if ((q->count > 0) && ((limit < 0) || (q->arrive[q->head] < limit)))
+            waitChange(st->chan, st->side, q->arrive[q->head]);
+        else
+            waitChange(st->chan, st->side, limit);
+    }
+    if (nBytesGot > 0)  // there is space in the queue
+        notify(st->chan, 1 - st->side, PHY_timeUs());
+    pthread_mutex_unlock(&lock);
+
+    return nBytesGot;
+}
+
+//===================================================================
+/* Function to wait for received bytes on a loopback channel.
+   Returns positive if bytes are waiting, 0 if time ran out,
+   negative on failure.  */
+static int loopPoll(PHY_link *link, int timeout_ms)
+{
+    loopState *st = (loopState *) link->state;
+    loopQueue *q;            // queue for this direction
+    long long now;           // time now, in us
+    long long limit = -1;    // time limit, or -1 to wait forever
+    int ready = 0;           // number of bytes that have arrived
+    int i;
+
+    if (st == NULL) return -9;
+    q = &st->chan->queue[1 - st->side];
+    if (timeout_ms >= 0) limit = PHY_timeUs() + 1000LL * timeout_ms;
+
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        now = PHY_timeUs();
+        for (ready = 0; ready < q->count; ready++)  // count bytes arrived
+        {
+            i = (q->head + ready) % LOOP_BUFSIZE;
+            if (q->arrive[i] > now) break;
+        }
+        if (ready > 0) break;
+        if ((limit >= 0) && (now >= limit)) break;  // time ran out
+        if ((q->count > 0) && ((limit < 0) || (q->arrive[q->head] < limit)))
+            waitChange(st->chan, st->side, q->arrive[q->head]);
+        else
+            waitChange(st->chan, st->side, limit);
+    }
+    pthread_mutex_unlock(&lock);
+    return ready;
+}
+
+// The driver in this file
+const PHY_driver PHY_loopbackDriver =
+{
+    "loopback", loopOpen, loopClose, loopSend, loopGet, loopPoll
+};
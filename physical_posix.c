@@ -0,0 +1,416 @@
+/*  Physical Layer drivers using serial port or pty.
+       serial driver   uses a serial port, or an existing pty slave
+       pty driver      makes a new pty pair, for another program to use
+    Each driver opens, closes, sends and gets bytes, as described
+    in phydriver.h.  The send, get and poll functions are shared with
+    other drivers that use file descriptors.  All functions print explanatory messages if there is
+    a problem, and return values to indicate failure.
+    This version uses standard C functions and POSIX termios functions,
+    for Linux and similar systems.  It will NOT work on Windows - use
+    physical_real.c there.  */
+
+#define _DEFAULT_SOURCE  // needed for cfmakeraw and the Bxxx rate constants
+#define _XOPEN_SOURCE 600  // needed for posix_openpt and ptsname
+
+#include <stdio.h>   // needed for printf
+#include <stdlib.h>  // for malloc and pty functions
+#include <string.h>  // for strerror
+#include <errno.h>   // for errno, to report problems
+#include <time.h>    // for clock_gettime and nanosleep
+#include <fcntl.h>   // for open
+#include <unistd.h>  // for read, write, close
+#include <poll.h>    // for poll, to wait for received bytes
+#include <termios.h> // needed for port functions
+#include <sys/ioctl.h> // for FIONREAD, to count bytes waiting
+#include "physical.h"  // printProblem and waitms are in this file
+#include "phydriver.h" // driver functions in this file
+#include "sim.h"       // for virtual time in simulations
+
+static int configure(int fd, PHY_params *p);  // helper function, below
+
+//===================================================================
+/* Function to open and configure the serial port for a link.
+   Port 1 is the first serial port, /dev/ttyS0, like COM1 on Windows.
+   If an address is given, it is used as the port name instead,
+   for example the slave side of a pty pair, or /dev/ttyUSB0.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int serialOpen(PHY_link *link, int portNum, const char *address)
+{
+    char portName[64];  // string to hold port name
+    PHY_fdState *st;    // data for this link
+    int status;         // return value from configure
+
+    // Make the port name string
+    if (address != NULL)
+        snprintf(portName, sizeof(portName), "%s", address);
+    else
+        snprintf(portName, sizeof(portName), "/dev/ttyS%d", portNum - 1);
+
+    st = (PHY_fdState *) malloc(sizeof(PHY_fdState));
+    if (st == NULL) return PHY_NOMEMORY;
+    st->slaveFd = -1;
+
+    // Try to open the port - not as controlling terminal
+    st->fd = open(portName, O_RDWR | O_NOCTTY);
+    // Check for failure
+    if (st->fd < 0)
+    {
+        printf("PHY: Failed to open port |%s|\n",portName);
+        printProblem();  // give details of the problem
+        free(st);
+        return 1;  // non-zero return value indicates failure
+    }
+
+    status = configure(st->fd, &link->params);
+    if (status != 0)
+    {
+        close(st->fd);
+        free(st);
+        return status;
+    }
+
+    // If we get this far, the port is open and configured
+    link->state = st;
+    return 0;
+}
+
+//===================================================================
+/* Function to make a new pty pair for a link.  This program uses the
+   master side, and the name of the slave side is printed, so another
+   program can open it with the serial driver.  This gives a channel
+   between two programs without any hardware.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int ptyOpen(PHY_link *link, int portNum, const char *address)
+{
+    PHY_fdState *st;    // data for this link
+    char *slaveName;   // name of slave side
+    int status;        // return value from configure
+
+    (void) portNum;  // not used - the system chooses the pty
+    (void) address;
+
+    st = (PHY_fdState *) malloc(sizeof(PHY_fdState));
+    if (st == NULL) return PHY_NOMEMORY;
+
+    // Make the pty pair
+    st->fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((st->fd < 0) || (grantpt(st->fd) != 0) || (unlockpt(st->fd) != 0)
+        || ((slaveName = ptsname(st->fd)) == NULL))
+    {
+        printf("PHY: Failed to make pty pair\n");
+        printProblem();  // give details of the problem
+        if (st->fd >= 0) close(st->fd);
+        free(st);
+        return 1;
+    }
+
+    /* Open the slave side too, and keep it open.  This sets the line
+       settings before the other program opens it, so bytes sent early are
+       not echoed or changed, and reads do not fail while it is closed.  */
+    st->slaveFd = open(slaveName, O_RDWR | O_NOCTTY);
+    if (st->slaveFd < 0)
+    {
+        printf("PHY: Failed to open pty slave |%s|\n", slaveName);
+        printProblem();
+        close(st->fd);
+        free(st);
+        return 1;
+    }
+    status = configure(st->slaveFd, &link->params);
+    if (status != 0)
+    {
+        close(st->slaveFd);
+        close(st->fd);
+        free(st);
+        return status;
+    }
+
+    printf("PHY: pty ready - other end should use address %s\n", slaveName);
+    link->state = st;
+    return 0;
+}
+
+//===================================================================
+/* Helper function to apply the link settings to a terminal device.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int configure(int fd, PHY_params *p)
+{
+    struct termios serialParams;  // terminal settings for serial port
+    speed_t speed;      // bit rate code for termios
+    int vtime;          // interval limit, in tenths of a second
+
+    // Translate the bit rate into the termios code
+    switch (p->bitRate)
+    {
+        case 1200:  speed = B1200;  break;
+        case 2400:  speed = B2400;  break;
+        case 4800:  speed = B4800;  break;
+        case 9600:  speed = B9600;  break;
+        case 19200: speed = B19200; break;
+        default:    speed = B38400; break;  // only remaining valid rate
+    }
+
+    // Fill the structure with the parameters of the port, and check for failure
+    if (tcgetattr(fd, &serialParams) != 0)
+    {
+        printf("PHY: Problem getting port parameters\n");
+        printProblem();  // give details of the problem
+        return 2;
+    }
+
+    /* Change the parameters to configure the port as required,
+       without interpreting or substituting any characters,
+       and with no added flow control.  */
+    cfmakeraw(&serialParams);  // no echo, no line editing, no translation
+    cfsetispeed(&serialParams, speed);  // bit rate for receive
+    cfsetospeed(&serialParams, speed);  // and for transmit
+    serialParams.c_cflag &= ~CSIZE;   // clear the data bits field
+    serialParams.c_cflag |= (p->nDataBits == 7) ? CS7 : CS8;  // number of data bits
+    serialParams.c_cflag &= ~(PARENB | PARODD);  // start with no parity
+    if (p->parity == 1) serialParams.c_cflag |= PARENB | PARODD;  // odd parity
+    if (p->parity == 2) serialParams.c_cflag |= PARENB;           // even parity
+    serialParams.c_cflag &= ~CSTOPB;   // just one stop bit
+    serialParams.c_cflag &= ~CRTSCTS;  // ignore CTS signal
+    serialParams.c_cflag |= CLOCAL | CREAD;  // ignore modem lines, enable receiver
+    serialParams.c_iflag &= ~(IXON | IXOFF | IXANY);  // ignore XON/XOFF
+    serialParams.c_iflag &= ~INPCK;    // ignore parity on receive
+
+/*  Set timeout values for the read function.  termios does not have the
+    total timeout of the Windows version, so it is split in two parts:
+    VTIME is the time interval allowed between bytes, in tenths of a second,
+    and is taken from rxTimeIntv, rounding up.  With VMIN = 0, a read
+    returns as soon as any bytes are available, or when VTIME runs out.
+    The total time allowed for a read, in ms, is given by
+    rxTimeConst + time multiplier * no. bytes requested, as on Windows.
+    The get function enforces both limits using poll() before it reads,
+    so they work the same way on a pty master, which ignores VTIME.
+    If rxTimeConst is zero, timeout is not used - waits forever.
+
+    On Linux, write() does not time out - it waits for buffer space.  */
+    serialParams.c_cc[VMIN] = 0;
+    vtime = (p->rxTimeIntv + 99) / 100;  // interval in tenths of a second, rounded up
+    if (vtime > 255) vtime = 255;        // VTIME is only one byte
+    serialParams.c_cc[VTIME] = (cc_t) vtime;
+
+    // Apply the new parameters to the port
+    if (tcsetattr(fd, TCSANOW, &serialParams) != 0)
+    {
+        printf("PHY: Problem setting port parameters\n");
+        printProblem();  // give details of the problem
+        return 4;
+    }
+
+    // Clear the receive buffer, in case there is rubbish waiting
+    if (tcflush(fd, TCIFLUSH) != 0)
+    {
+        printf("PHY: Problem purging receive buffer\n");
+        printProblem();  // give details of the problem
+        return 6;
+    }
+    return 0;
+}
+
+//===================================================================
+/* Function to close the port or pty for a link.
+   Returns 0 always.  */
+static int posixClose(PHY_link *link)
+{
+    PHY_fdState *st = (PHY_fdState *) link->state;
+    if (st == NULL) return 0;
+    if (st->fd >= 0)
+    {
+        if (st->slaveFd < 0) tcdrain(st->fd);  // let any bytes still in the buffer go out
+        close(st->fd);
+    }
+    if (st->slaveFd >= 0) close(st->slaveFd);
+    free(st);
+    link->state = NULL;
+    return 0;
+}
+
+//===================================================================
+/* Function to send bytes on a link that uses a file descriptor.
+   Arguments: pointer to an array holding the bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes actually sent, or a negative value on failure.  */
+int PHY_fdSend(PHY_link *link, byte_t *dataTX, int nBytesToSend)
+{
+     PHY_fdState *st = (PHY_fdState *) link->state;
+     ssize_t nBytesTX;    // number of bytes sent by one write
+     int nBytesSent = 0;  // total number of bytes sent
+
+    // First check if the port is open
+    if ((st == NULL) || (st->fd < 0))
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+
+    // Try to send the bytes as requested - write may take them in parts
+    while (nBytesSent < nBytesToSend)
+    {
+        nBytesTX = write(st->fd, dataTX + nBytesSent, nBytesToSend - nBytesSent);
+        if (nBytesTX < 0)
+        {
+            if (errno == EINTR) continue;  // interrupted by a signal, try again
+            printf("PHY: Problem sending data\n");
+            printProblem();  // give details of the problem
+            close(st->fd);
+            st->fd = -1;
+            return -5;
+        }
+        nBytesSent += (int) nBytesTX;
+    }
+    return nBytesSent; // if succeeded, return the number of bytes sent
+}
+
+//===================================================================
+/* Function to get received bytes from a link that uses a file descriptor.
+   Arguments: pointer to array to hold received bytes;
+              maximum number of bytes to receive.
+   Returns number of bytes actually received, or a negative value on failure.  */
+int PHY_fdGet(PHY_link *link, byte_t *dataRX, int nBytesToGet)
+{
+     PHY_fdState *st = (PHY_fdState *) link->state;
+     PHY_params *p = &link->params;
+     ssize_t nBytesRX;   // number of bytes got by one read
+     int nBytesGot = 0;  // total number of bytes got
+     long long endTime = 0;  // time limit for the whole read, in ms
+     long long left;     // time left before the limit, in ms
+     int waitTime;       // time to wait for the next byte, in ms
+     struct pollfd pfd;  // for poll, to wait for bytes
+     int ready;          // return value from poll
+
+    // First check if the port is open
+    if ((st == NULL) || (st->fd < 0))
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+
+    // Work out the total time allowed, as the Windows version does
+    if (p->rxTimeConst != 0)
+        endTime = PHY_timeUs()/1000 + p->rxTimeConst + (long long)p->timeMult * nBytesToGet;
+
+    pfd.fd = st->fd;
+    pfd.events = POLLIN;
+
+    // Try to get bytes as requested
+    while (nBytesGot < nBytesToGet)
+    {
+        /* Wait for a byte to arrive.  The total time limit always applies,
+           and after the first byte the interval limit applies as well.  */
+        waitTime = -1;  // wait forever, unless a limit is set
+        if (p->rxTimeConst != 0)
+        {
+            left = endTime - PHY_timeUs()/1000;
+            if (left <= 0) break;  // out of time
+            waitTime = (int) left;
+        }
+        if ((nBytesGot > 0) && (p->rxTimeIntv != 0)
+            && ((waitTime < 0) || (p->rxTimeIntv < waitTime)))
+            waitTime = p->rxTimeIntv;
+
+        ready = poll(&pfd, 1, waitTime);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;  // interrupted by a signal
+            printf("PHY: Problem waiting for data\n");
+            printProblem();  // give details of the problem
+            return -4;
+        }
+        if (ready == 0) break;  // timeout - no more bytes
+
+        nBytesRX = read(st->fd, dataRX + nBytesGot, nBytesToGet - nBytesGot);
+        if (nBytesRX < 0)
+        {
+            if (errno == EINTR) continue;  // interrupted by a signal, try again
+            printf("PHY: Problem receiving data\n");
+            printProblem();  // give details of the problem
+            close(st->fd);
+            st->fd = -1;
+            return -4;
+        }
+        if (nBytesRX == 0) break;  // other end has closed
+        nBytesGot += (int) nBytesRX;
+    }
+    // No need to complain about timeout here - will happen regularly
+
+    return nBytesGot; // if no problem, return the number of bytes received
+}
+
+//===================================================================
+/* Function to wait for received bytes on a link that uses a file descriptor.
+   Returns the number of bytes waiting (or 1 if the channel is ready but
+   the number is not known, e.g. it has closed), 0 if time ran out,
+   negative on failure.  */
+int PHY_fdPoll(PHY_link *link, int timeout_ms)
+{
+    PHY_fdState *st = (PHY_fdState *) link->state;
+    struct pollfd pfd;  // for poll, to wait for bytes
+    int ready;          // return value from poll
+    int waiting = 0;    // number of bytes waiting to be read
+
+    if ((st == NULL) || (st->fd < 0)) return -9;
+    pfd.fd = st->fd;
+    pfd.events = POLLIN;
+    do
+        ready = poll(&pfd, 1, timeout_ms < 0 ? -1 : timeout_ms);
+    while ((ready < 0) && (errno == EINTR));
+    if (ready < 0)
+    {
+        printf("PHY: Problem waiting for data\n");
+        printProblem();  // give details of the problem
+        return -4;
+    }
+    if (ready == 0) return 0;  // time ran out
+    if ((ioctl(st->fd, FIONREAD, &waiting) == 0) && (waiting > 0))
+        return waiting;
+    return 1;
+}
+
+// The drivers in this file
+const PHY_driver PHY_serialDriver =
+{
+    "serial", serialOpen, posixClose, PHY_fdSend, PHY_fdGet, PHY_fdPoll
+};
+
+const PHY_driver PHY_ptyDriver =
+{
+    "pty", ptyOpen, posixClose, PHY_fdSend, PHY_fdGet, PHY_fdPoll
+};
+
+// Function to print informative messages when something goes wrong...
+void printProblem(void)
+{
+	int problemCode = errno;  // get the code for the last problem
+	printf("PHY: Code %d = %s\n", problemCode, strerror(problemCode));
+}
+
+// Function to delay for a specified number of ms.
+void waitms(int delay_ms)
+{
+    struct timespec delay;  // time to wait
+    if (delay_ms <= 0) return;
+    if (SIM_active())  // in a simulation, wait in virtual time
+    {
+        SIM_wait(SIM_now() + 1000LL * delay_ms);
+        return;
+    }
+    delay.tv_sec = delay_ms / 1000;
+    delay.tv_nsec = (long)(delay_ms % 1000) * 1000000L;
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+        ;  // keep waiting if interrupted by a signal
+}
+
+/* Function to get the time in microseconds, from a clock that only
+   goes forward.  The starting point is not defined, so it is only
+   useful for measuring time intervals.  In a simulation task,
+   this is the virtual time.  */
+long long PHY_timeUs(void)
+{
+    struct timespec now;
+    if (SIM_active()) return SIM_now();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,388 @@
+/*  Physical Layer driver using POSIX shared memory.
+       shm driver   joins two links through a shared memory object, so
+                    two programs (or two links in one program) can talk
+                    on one computer without the system calls of a socket
+    The address names the shared memory object, e.g. /comsys1.  With no
+    address, /comsys followed by the port number is used.  The first link
+    to open a name makes the object and takes one end, the second link
+    takes the other end, and the object is removed when both have closed.
+    Each direction is a queue of bytes, protected by a mutex and signalled
+    by a condition variable that are shared between the processes.
+    Like the socket driver, it carries bytes as fast as it can: there is
+    no bit rate limit, but the receive time limits work as for the serial
+    port.  It uses real time, so it cannot be used in a simulation task
+    (see sim.h) - the loopback driver does that.
+    This version uses POSIX shared memory and threads.  */
+
+#define _POSIX_C_SOURCE 200809L  // needed for shm_open and pthread_condattr_setclock
+
+#include <stdio.h>      // needed for printf
+#include <stdlib.h>     // for malloc
+#include <string.h>     // for string functions
+#include <errno.h>      // for errno, to report problems
+#include <time.h>       // for clock values used by pthread, and nanosleep
+#include <fcntl.h>      // for O_CREAT and friends
+#include <unistd.h>     // for ftruncate and close
+#include <pthread.h>    // for process-shared mutex and condition variables
+#include <stdatomic.h>  // to mark the object set up, for the other process
+#include <sys/mman.h>   // for shm_open and mmap
+#include <sys/stat.h>   // for fstat
+#include "physical.h"   // for printProblem
+#include "phydriver.h"  // driver functions in this file
+#include "sim.h"        // to refuse to open in a simulation
+
+#define SHM_BUFSIZE 16384   // size of the byte queue in each direction
+#define SHM_NAMESIZE 64     // longest object name
+#define SHM_MAGIC 0x434F4D53u  // set once the object has been set up
+#define SHM_READY_WAIT 2000 // longest wait for the other end to set it up, in ms
+
+// One direction of the channel: a queue of bytes
+typedef struct
+{
+    byte_t data[SHM_BUFSIZE];  // bytes in the queue
+    int head;                  // position of the oldest byte
+    int count;                 // number of bytes in the queue
+} shmQueue;
+
+// The shared memory object joining two links
+typedef struct
+{
+    atomic_uint magic;         // SHM_MAGIC once the rest has been set up
+    pthread_mutex_t lock;      // protects everything below
+    pthread_cond_t changed;    // signalled when bytes are added or removed
+    int sideUsed[2];           // set when each end is in use
+    int sideClosed[2];         // set when each end has been closed
+    shmQueue queue[2];         // queue[i] carries bytes sent by end i
+} shmChannel;
+
+// Data kept for each link using this driver
+typedef struct
+{
+    shmChannel *chan;          // the channel, in shared memory
+    int side;                  // which end of the channel this link is: 0 or 1
+    char name[SHM_NAMESIZE];   // name of the object, to remove it
+} shmState;
+
+// Helper function to convert a time in us to the form used by pthread.
+static struct timespec toTimespec(long long timeUs)
+{
+    struct timespec t;
+    t.tv_sec = (time_t)(timeUs / 1000000);
+    t.tv_nsec = (long)(timeUs % 1000000) * 1000;
+    return t;
+}
+
+/* Helper function to lock the channel.  The mutex is robust: if the other
+   program stopped while holding it, the lock is taken over, as the queues
+   are always left in a state that can be used.  */
+static void lockChannel(shmChannel *chan)
+{
+    if (pthread_mutex_lock(&chan->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&chan->lock);
+}
+
+/* Helper function to wait, with the lock held, until the channel changes
+   or a time is reached (in us, from PHY_timeUs), or forever if negative.  */
+static void waitChange(shmChannel *chan, long long untilUs)
+{
+    struct timespec t;
+    int status;
+    if (untilUs < 0)
+        status = pthread_cond_wait(&chan->changed, &chan->lock);
+    else
+    {
+        t = toTimespec(untilUs);
+        status = pthread_cond_timedwait(&chan->changed, &chan->lock, &t);
+    }
+    if (status == EOWNERDEAD)
+        pthread_mutex_consistent(&chan->lock);
+}
+
+// Helper function to set up a new channel, before anyone else can use it.
+static void setUp(shmChannel *chan)
+{
+    pthread_mutexattr_t mAttr;  // shared between processes, and robust
+    pthread_condattr_t cAttr;   // shared, and using the same clock as PHY_timeUs
+
+    memset(chan, 0, sizeof(shmChannel));
+    pthread_mutexattr_init(&mAttr);
+    pthread_mutexattr_setpshared(&mAttr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mAttr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&chan->lock, &mAttr);
+    pthread_mutexattr_destroy(&mAttr);
+    pthread_condattr_init(&cAttr);
+    pthread_condattr_setpshared(&cAttr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&chan->changed, &cAttr);
+    pthread_condattr_destroy(&cAttr);
+    atomic_store(&chan->magic, SHM_MAGIC);
+}
+
+/* Helper function to wait for the link that made the object to finish
+   setting it up, then map it.  Until its size is set, the memory cannot
+   be used, and until the magic number is set, neither can the lock.
+   Returns the channel, or NULL if it is never ready.  */
+static shmChannel *waitReady(int fd)
+{
+    struct timespec pause = { 0, 1000000 };  // 1 ms between looks
+    struct stat info;         // size of the object
+    shmChannel *chan = NULL;  // the channel, once mapped
+    void *mem;
+    int tries;
+
+    for (tries = 0; tries < SHM_READY_WAIT; tries++)
+    {
+        if ((chan == NULL) && (fstat(fd, &info) == 0)
+            && (info.st_size >= (off_t) sizeof(shmChannel)))
+        {
+            mem = mmap(NULL, sizeof(shmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem == MAP_FAILED) return NULL;
+            chan = (shmChannel *) mem;
+        }
+        if ((chan != NULL) && (atomic_load(&chan->magic) == SHM_MAGIC))
+            return chan;
+        nanosleep(&pause, NULL);
+    }
+    if (chan != NULL) munmap(chan, sizeof(shmChannel));
+    return NULL;
+}
+
+//===================================================================
+/* Function to open one end of a shared memory channel.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int shmOpen(PHY_link *link, int portNum, const char *address)
+{
+    shmState *st;              // data for this link
+    shmChannel *chan = NULL;   // the channel
+    void *mem;                 // the shared memory, once mapped
+    int fd;                    // the shared memory object
+    int made = 0;              // set if this link made the object
+
+    if (SIM_active())
+    {
+        printf("PHY: The shm driver uses real time - use loopback in a simulation\n");
+        return 3;
+    }
+
+    st = (shmState *) malloc(sizeof(shmState));
+    if (st == NULL) return PHY_NOMEMORY;
+    if (address != NULL)
+        snprintf(st->name, sizeof(st->name), "%s%s", (address[0] == '/') ? "" : "/", address);
+    else
+        snprintf(st->name, sizeof(st->name), "/comsys%d", portNum);
+
+    // Make the object if it is not there, otherwise use the one there
+    fd = shm_open(st->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        made = 1;
+    else if (errno == EEXIST)
+        fd = shm_open(st->name, O_RDWR, 0600);
+    if (fd < 0)
+    {
+        printf("PHY: Failed to open shared memory |%s|\n", st->name);
+        printProblem();  // give details of the problem
+        free(st);
+        return 1;
+    }
+
+    if (made)
+    {
+        mem = MAP_FAILED;
+        if (ftruncate(fd, sizeof(shmChannel)) == 0)
+            mem = mmap(NULL, sizeof(shmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+        {
+            printf("PHY: Failed to set up shared memory |%s|\n", st->name);
+            printProblem();  // give details of the problem
+            close(fd);
+            shm_unlink(st->name);
+            free(st);
+            return 1;
+        }
+        chan = (shmChannel *) mem;
+        setUp(chan);
+    }
+    else if ((chan = waitReady(fd)) == NULL)
+    {
+        printf("PHY: Shared memory |%s| was never set up\n", st->name);
+        close(fd);
+        free(st);
+        return 1;
+    }
+    close(fd);  // the mapping stays
+
+    lockChannel(chan);
+    if (chan->sideUsed[0] && chan->sideUsed[1])
+    {
+        pthread_mutex_unlock(&chan->lock);
+        printf("PHY: Shared memory |%s| already has two ends - if a program "
+               "stopped without closing it, remove /dev/shm%s\n", st->name, st->name);
+        munmap(chan, sizeof(shmChannel));
+        free(st);
+        return 1;
+    }
+    st->chan = chan;
+    st->side = chan->sideUsed[0] ? 1 : 0;  // take the free end
+    chan->sideUsed[st->side] = 1;
+    chan->sideClosed[st->side] = 0;
+    pthread_cond_broadcast(&chan->changed);
+    pthread_mutex_unlock(&chan->lock);
+
+    link->state = st;
+    return 0;
+}
+
+//===================================================================
+/* Function to close one end of a shared memory channel.  When both ends
+   are closed, the object is removed.  Returns 0 always.  */
+static int shmClose(PHY_link *link)
+{
+    shmState *st = (shmState *) link->state;
+    shmChannel *chan;
+    int last;  // set if this was the last end in use
+
+    if (st == NULL) return 0;
+    chan = st->chan;
+
+    lockChannel(chan);
+    chan->sideUsed[st->side] = 0;
+    chan->sideClosed[st->side] = 1;
+    last = !chan->sideUsed[1 - st->side];
+    pthread_cond_broadcast(&chan->changed);  // wake the other end
+    pthread_mutex_unlock(&chan->lock);
+
+    munmap(chan, sizeof(shmChannel));
+    if (last) shm_unlink(st->name);  // last one out - remove the object
+    free(st);
+    link->state = NULL;
+    return 0;
+}
+
+//===================================================================
+/* Function to send bytes on a shared memory channel.
+   Returns without waiting for the bytes to be received, unless the queue
+   is full.  If the other end has closed, so no one will empty it, the
+   oldest byte is lost instead, as on a line with no one listening.
+   Returns number of bytes actually sent, or a negative value on failure.  */
+static int shmSend(PHY_link *link, byte_t *dataTX, int nBytesToSend)
+{
+    shmState *st = (shmState *) link->state;
+    shmQueue *q;  // queue for this direction
+    int i;
+
+    if (st == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    q = &st->chan->queue[st->side];
+
+    lockChannel(st->chan);
+    for (i = 0; i < nBytesToSend; i++)
+    {
+        while (q->count >= SHM_BUFSIZE)  // queue full - wait for space
+        {
+            if (st->chan->sideClosed[1 - st->side])  // no one to read it - lose the oldest byte
+            {
+                q->head = (q->head + 1) % SHM_BUFSIZE;
+                q->count--;
+                break;
+            }
+            if (i > 0) pthread_cond_broadcast(&st->chan->changed);
+            waitChange(st->chan, -1);
+        }
+        q->data[(q->head + q->count) % SHM_BUFSIZE] = dataTX[i];
+        q->count++;
+    }
+    pthread_cond_broadcast(&st->chan->changed);
+    pthread_mutex_unlock(&st->chan->lock);
+
+    return nBytesToSend;
+}
+
+//===================================================================
+/* Function to get received bytes from a shared memory channel.
+   Uses the same time limits as the serial driver: a total limit of
+   rxTimeConst + timeMult * bytes requested, and after the first byte,
+   a limit of rxTimeIntv between bytes.
+   Returns number of bytes actually received, or a negative value on failure.  */
+static int shmGet(PHY_link *link, byte_t *dataRX, int nBytesToGet)
+{
+    shmState *st = (shmState *) link->state;
+    PHY_params *p = &link->params;
+    shmQueue *q;               // queue for this direction
+    int nBytesGot = 0;         // number of bytes got so far
+    long long endTime = -1;    // time limit for the whole read, or -1
+    long long limit;           // time limit for the next byte, or -1
+    long long lastByte = 0;    // time when the last byte was received
+
+    if (st == NULL)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates failure
+    }
+    q = &st->chan->queue[1 - st->side];
+
+    if (p->rxTimeConst != 0)
+        endTime = PHY_timeUs() + 1000LL * (p->rxTimeConst + (long long)p->timeMult * nBytesToGet);
+
+    lockChannel(st->chan);
+    while (nBytesGot < nBytesToGet)
+    {
+        // Take all the bytes waiting
+        if (q->count > 0)
+        {
+            while ((nBytesGot < nBytesToGet) && (q->count > 0))
+            {
+                dataRX[nBytesGot++] = q->data[q->head];
+                q->head = (q->head + 1) % SHM_BUFSIZE;
+                q->count--;
+            }
+            lastByte = PHY_timeUs();
+            if (nBytesGot == nBytesToGet) break;
+        }
+
+        // Work out how long we may wait for the next byte
+        limit = endTime;
+        if ((nBytesGot > 0) && (p->rxTimeIntv != 0))
+        {
+            long long intvEnd = lastByte + 1000LL * p->rxTimeIntv;
+            if ((limit < 0) || (intvEnd < limit)) limit = intvEnd;
+        }
+        if ((limit >= 0) && (PHY_timeUs() >= limit)) break;  // out of time
+        waitChange(st->chan, limit);
+    }
+    if (nBytesGot > 0)  // there is space in the queue
+        pthread_cond_broadcast(&st->chan->changed);
+    pthread_mutex_unlock(&st->chan->lock);
+
+    return nBytesGot;
+}
+
+//===================================================================
+/* Function to wait for received bytes on a shared memory channel.
+   Returns the number of bytes waiting, 0 if time ran out,
+   negative on failure.  */
+static int shmPoll(PHY_link *link, int timeout_ms)
+{
+    shmState *st = (shmState *) link->state;
+    shmQueue *q;             // queue for this direction
+    long long limit = -1;    // time limit, or -1 to wait forever
+    int ready;               // number of bytes waiting
+
+    if (st == NULL) return -9;
+    q = &st->chan->queue[1 - st->side];
+    if (timeout_ms >= 0) limit = PHY_timeUs() + 1000LL * timeout_ms;
+
+    lockChannel(st->chan);
+    while (((ready = q->count) == 0) && ((limit < 0) || (PHY_timeUs() < limit)))
+        waitChange(st->chan, limit);
+    pthread_mutex_unlock(&st->chan->lock);
+    return ready;
+}
+
+// The driver in this file
+const PHY_driver PHY_shmDriver =
+{
+    "shm", shmOpen, shmClose, shmSend, shmGet, shmPoll
+};
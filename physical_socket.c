@@ -0,0 +1,254 @@
+/*  Physical Layer driver using a local stream socket.
+       socket driver   joins two links with a stream socket, instead of
+                       a serial port, so two programs can talk on one computer
+    The address chooses the kind of socket:
+       tcp:port  or  tcp:host:port   TCP socket, host defaults to 127.0.0.1
+       unix:path                     UNIX-domain socket, named by path
+       pair:name                     socketpair, between two links opened
+                                     with the same name in this program
+    With no address, TCP port 50000 + port number is used.
+    For tcp and unix, the first program to open the address waits for
+    the other to connect, so the two programs can be started in any order.
+    The socket carries bytes as fast as it can: there is no bit rate limit,
+    but the receive time limits work as for the serial port.
+    This version uses POSIX sockets.  */
+
+#define _DEFAULT_SOURCE  // needed for socket functions and types
+
+#include <stdio.h>      // needed for printf
+#include <stdlib.h>     // for malloc and atoi
+#include <string.h>     // for string functions
+#include <errno.h>      // for errno, to report problems
+#include <signal.h>     // to ignore SIGPIPE
+#include <unistd.h>     // for close and unlink
+#include <pthread.h>    // to protect the list of socketpairs
+#include <sys/socket.h> // for socket functions
+#include <sys/un.h>     // for UNIX-domain addresses
+#include <netinet/in.h> // for TCP addresses
+#include <netinet/tcp.h> // for TCP_NODELAY
+#include <arpa/inet.h>  // for inet_pton
+#include "physical.h"   // for printProblem
+#include "phydriver.h"  // driver functions in this file
+
+#define SOCK_BASEPORT 50000  // TCP port for port number 0
+#define SOCK_NAMESIZE 32     // longest socketpair name
+#define SOCK_TRIES 5         // attempts to connect or listen
+
+// A socketpair waiting for its second link
+typedef struct sockPair
+{
+    char name[SOCK_NAMESIZE];  // name used to find the pair
+    int fd;                    // file descriptor for the second end
+    struct sockPair *nextPair; // list of waiting pairs
+} sockPair;
+
+/* Creating a variable this way allows it to be shared
+   by the functions in this file only.  */
+static pthread_mutex_t pairLock = PTHREAD_MUTEX_INITIALIZER;
+static sockPair *pairs = NULL;  // socketpairs with one end not yet used
+
+//===================================================================
+/* Helper function to get one end of a named socketpair.  The first call
+   with a name makes the pair, and keeps the other end for the second call.
+   Returns a file descriptor, or -1 on failure.  */
+static int pairOpen(const char *name)
+{
+    sockPair *pair, **prev;  // for searching the list
+    int fds[2];              // the two ends of a new pair
+    int fd = -1;             // the end for this link
+
+    pthread_mutex_lock(&pairLock);
+    for (prev = &pairs; *prev != NULL; prev = &(*prev)->nextPair)
+    {
+        if (strcmp((*prev)->name, name) == 0)  // found, use second end
+        {
+            pair = *prev;
+            fd = pair->fd;
+            *prev = pair->nextPair;
+            free(pair);
+            break;
+        }
+    }
+    if (fd < 0)  // not found, make a new pair
+    {
+        pair = (sockPair *) malloc(sizeof(sockPair));
+        if ((pair != NULL) && (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0))
+        {
+            snprintf(pair->name, sizeof(pair->name), "%s", name);
+            pair->fd = fds[1];
+            pair->nextPair = pairs;
+            pairs = pair;
+            fd = fds[0];
+        }
+        else
+        {
+            printf("PHY: Failed to make socketpair |%s|\n", name);
+            printProblem();  // give details of the problem
+            free(pair);
+        }
+    }
+    pthread_mutex_unlock(&pairLock);
+    return fd;
+}
+
+//===================================================================
+/* Helper function to connect to an address, or if nobody is there yet,
+   to wait for the other program to connect to it.
+   Returns a file descriptor, or -1 on failure.  */
+static int connectOrListen(struct sockaddr *addr, socklen_t addrLen,
+                           const char *unixPath)
+{
+    int fd, server;  // file descriptors
+    int one = 1;     // for socket options
+    int tries;       // attempts so far
+    int problem;     // errno value, kept before closing
+
+    for (tries = 0; tries < SOCK_TRIES; tries++)
+    {
+        // First try to connect, in case the other end is waiting
+        fd = socket(addr->sa_family, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, addr, addrLen) == 0) return fd;
+        problem = errno;
+        close(fd);
+        errno = problem;
+        if ((problem != ECONNREFUSED) && (problem != ENOENT)) return -1;
+
+        // Nobody there, so wait for the other end to connect
+        server = socket(addr->sa_family, SOCK_STREAM, 0);
+        if (server < 0) return -1;
+        if (unixPath != NULL)
+            unlink(unixPath);  // remove old socket left by a program that stopped
+        else
+            setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if ((bind(server, addr, addrLen) == 0) && (listen(server, 1) == 0))
+        {
+            printf("PHY: Waiting for other end to connect...\n");
+            fd = accept(server, NULL, NULL);
+            close(server);
+            if (unixPath != NULL) unlink(unixPath);  // name no longer needed
+            return fd;
+        }
+        problem = errno;
+        close(server);
+        errno = problem;
+        if (problem != EADDRINUSE) return -1;
+        // The other end started listening first - try to connect again
+    }
+    return -1;
+}
+
+//===================================================================
+/* Function to open a socket for a link, using the address given.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+static int socketOpen(PHY_link *link, int portNum, const char *address)
+{
+    char defaultAddress[32];  // address made from port number
+    struct sockaddr_in inAddr;   // TCP address
+    struct sockaddr_un unAddr;   // UNIX-domain address
+    char host[64];            // host name for TCP
+    const char *portPart;     // TCP port number as a string
+    const char *colon;        // position of colon in tcp address
+    PHY_fdState *st;          // data for this link
+    int one = 1;              // for socket options
+    int fd;                   // the socket
+
+    /* A program writing to a socket that has been closed at the other end
+       would be stopped by SIGPIPE.  Ignore it, so PHY_send reports the
+       problem instead.  */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (address == NULL)
+    {
+        snprintf(defaultAddress, sizeof(defaultAddress), "tcp:%d",
+                 SOCK_BASEPORT + portNum);
+        address = defaultAddress;
+    }
+
+    if (strncmp(address, "pair:", 5) == 0)
+        fd = pairOpen(address + 5);
+    else if (strncmp(address, "unix:", 5) == 0)
+    {
+        memset(&unAddr, 0, sizeof(unAddr));
+        unAddr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(unAddr.sun_path))
+        {
+            printf("PHY: Socket path too long |%s|\n", address + 5);
+            return 3;
+        }
+        strcpy(unAddr.sun_path, address + 5);
+        fd = connectOrListen((struct sockaddr *)&unAddr, sizeof(unAddr),
+                             unAddr.sun_path);
+    }
+    else if (strncmp(address, "tcp:", 4) == 0)
+    {
+        // Split the address into host and port
+        colon = strrchr(address + 4, ':');
+        snprintf(host, sizeof(host), "127.0.0.1");
+        portPart = address + 4;
+        if (colon != NULL)
+        {
+            if (colon > address + 4)
+                snprintf(host, sizeof(host), "%.*s",
+                         (int)(colon - (address + 4)), address + 4);
+            portPart = colon + 1;
+        }
+        memset(&inAddr, 0, sizeof(inAddr));
+        inAddr.sin_family = AF_INET;
+        inAddr.sin_port = htons((unsigned short) atoi(portPart));
+        if ((atoi(portPart) <= 0) || (inet_pton(AF_INET, host, &inAddr.sin_addr) != 1))
+        {
+            printf("PHY: Invalid socket address |%s|\n", address);
+            return 3;
+        }
+        fd = connectOrListen((struct sockaddr *)&inAddr, sizeof(inAddr), NULL);
+        // Send small frames at once, rather than waiting to fill a packet
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    else
+    {
+        printf("PHY: Invalid socket address |%s|, use tcp:, unix: or pair:\n",
+               address);
+        return 3;
+    }
+
+    // Check for failure
+    if (fd < 0)
+    {
+        printf("PHY: Failed to open socket |%s|\n", address);
+        printProblem();  // give details of the problem
+        return 1;
+    }
+
+    st = (PHY_fdState *) malloc(sizeof(PHY_fdState));
+    if (st == NULL)
+    {
+        close(fd);
+        return PHY_NOMEMORY;
+    }
+    st->fd = fd;
+    st->slaveFd = -1;
+
+    // If we get this far, the socket is connected
+    link->state = st;
+    return 0;
+}
+
+//===================================================================
+/* Function to close the socket for a link.
+   Returns 0 always.  */
+static int socketClose(PHY_link *link)
+{
+    PHY_fdState *st = (PHY_fdState *) link->state;
+    if (st == NULL) return 0;
+    if (st->fd >= 0) close(st->fd);
+    free(st);
+    link->state = NULL;
+    return 0;
+}
+
+// The driver in this file - send, get and poll are in physical_posix.c
+const PHY_driver PHY_socketDriver =
+{
+    "socket", socketOpen, socketClose, PHY_fdSend, PHY_fdGet, PHY_fdPoll
+};
@@ -0,0 +1,115 @@
+/*  Receive buffer, for the bytes received on a link.
+       RXB_clear   empties the buffer
+       RXB_fill    reads all the bytes waiting into the buffer
+       RXB_find    finds a byte value in the buffer
+       RXB_peek    looks at a byte in the buffer
+       RXB_copy    copies bytes from the buffer
+       RXB_copyCheck  copies bytes, and adds them to a check value
+       RXB_take    takes bytes from the buffer
+       RXB_drop    discards bytes from the buffer
+    The bytes are in a ring, so the oldest ones may be near the end of
+    the array, and the newest ones at the start.  Each function deals
+    with the two parts separately.  */
+
+#include <string.h>     // for memchr and memcpy
+#include "physical.h"   // for PHY_read
+#include "rxbuffer.h"   // header file for functions in this file
+
+#define MASK (RXB_SIZE - 1)  // to wrap a position round the ring
+
+//===================================================================
+// Function to empty a receive buffer.
+void RXB_clear(RXB_buffer *rx)
+{
+    rx->head = 0;
+    rx->count = 0;
+}
+
+//===================================================================
+/* Function to read bytes from the default link into the buffer.
+   One read fills the space up to the end of the array; if the buffer
+   wraps round, any more bytes will come in the next read.
+   Returns number of bytes added, 0 if time ran out or the buffer is
+   full, negative on failure.  */
+int RXB_fill(RXB_buffer *rx, int timeout_ms)
+{
+    int tail = (rx->head + rx->count) & MASK;  // position for the next byte
+    int space = RXB_SIZE - rx->count;          // space left in the buffer
+    int bytesGot;                              // return value from PHY_read
+
+    if (space == 0) return 0;
+    if (space > RXB_SIZE - tail) space = RXB_SIZE - tail;  // up to the end
+    bytesGot = PHY_read(rx->data + tail, space, timeout_ms);
+    if (bytesGot > 0) rx->count += bytesGot;
+    return bytesGot;
+}
+
+//===================================================================
+/* Function to find a byte value in the buffer, starting at an offset.
+   memchr searches each part of the ring, so the search is as fast as
+   the C library can make it - usually many bytes at a time.
+   Returns the offset from the oldest byte, or -1 if it is not there.  */
+int RXB_find(const RXB_buffer *rx, byte_t value, int from)
+{
+    int start = (rx->head + from) & MASK;  // position to start looking
+    int first = RXB_SIZE - start;          // bytes up to the end of the array
+    int n = rx->count - from;              // bytes to look at
+    const byte_t *found;
+
+    if (n <= 0) return -1;
+    if (first > n) first = n;
+    found = memchr(rx->data + start, value, first);
+    if (found != NULL) return from + (int)(found - (rx->data + start));
+    found = memchr(rx->data, value, n - first);
+    if (found != NULL) return from + first + (int)(found - rx->data);
+    return -1;
+}
+
+//===================================================================
+// Function to look at a byte, without taking it.
+byte_t RXB_peek(const RXB_buffer *rx, int offset)
+{
+    return rx->data[(rx->head + offset) & MASK];
+}
+
+//===================================================================
+// Function to copy bytes from the buffer, without taking them.
+void RXB_copy(const RXB_buffer *rx, int offset, byte_t *dest, int n)
+{
+    int start = (rx->head + offset) & MASK;  // position of the first byte
+    int first = RXB_SIZE - start;            // bytes up to the end of the array
+
+    if (first > n) first = n;
+    memcpy(dest, rx->data + start, first);
+    memcpy(dest + first, rx->data, n - first);
+}
+
+//===================================================================
+// Function to copy bytes from the buffer, and add them to a check value.
+void RXB_copyCheck(const RXB_buffer *rx, int offset, byte_t *dest, int n,
+                   CHK_state *check)
+{
+    int start = (rx->head + offset) & MASK;  // position of the first byte
+    int first = RXB_SIZE - start;            // bytes up to the end of the array
+
+    if (first > n) first = n;
+    CHK_copy(check, dest, rx->data + start, first);
+    CHK_copy(check, dest + first, rx->data, n - first);
+}
+
+//===================================================================
+// Function to take the oldest bytes from the buffer.
+void RXB_take(RXB_buffer *rx, byte_t *dest, int n)
+{
+    RXB_copy(rx, 0, dest, n);
+    RXB_drop(rx, n);
+}
+
+//===================================================================
+// Function to discard the oldest bytes in the buffer.
+void RXB_drop(RXB_buffer *rx, int n)
+{
+    rx->head = (rx->head + n) & MASK;
+    rx->count -= n;
+    if (rx->count == 0) rx->head = 0;  // start again at the beginning
+}
@@ -0,0 +1,73 @@
+/* Define a type called byte_t, if not already defined.
+   This is an 8-bit variable, able to hold integers from 0 to 255. */
+#ifndef BYTE_T_DEFINED
+#define BYTE_T_DEFINED
+typedef unsigned char byte_t;  // define type "byte_t" for simplicity
+#endif
+
+#ifndef RXBUFFER_H_INCLUDED
+#define RXBUFFER_H_INCLUDED
+
+#include "checksum.h"  // for CHK_state
+
+/*  Receive buffer, for the bytes received on a link.
+    Each read from the physical layer takes all the bytes waiting, as
+    far as there is space, so one read may bring the end of one frame
+    and the start of the next.  The bytes are kept here, in order,
+    until the link layer has found the frames in them.  The buffer is
+    a ring: bytes are added after the newest and taken from the oldest,
+    so nothing needs to be moved.  */
+
+#define RXB_SIZE 16384  // bytes in a receive buffer, must be a power of 2 -
+                        // room for the largest frame, coded (see linklayer.h)
+
+// A receive buffer
+typedef struct
+{
+    byte_t data[RXB_SIZE];  // the bytes, in a ring
+    int head;               // position of the oldest byte
+    int count;              // number of bytes in the buffer
+} RXB_buffer;
+
+/* Function to empty a receive buffer. */
+void RXB_clear(RXB_buffer *rx);
+
+/* Function to read bytes from the default link into the buffer.
+   It waits until bytes arrive or the time runs out, then takes all
+   the bytes waiting, up to the space in the buffer, using PHY_read.
+   Argument timeout_ms is as for PHY_read.
+   Returns number of bytes added, 0 if time ran out or the buffer is
+   full, negative on failure.  */
+int RXB_fill(RXB_buffer *rx, int timeout_ms);
+
+/* Function to find a byte value in the buffer.
+   Arguments: rx - the buffer, value - the byte value to find,
+              from - offset from the oldest byte to start looking.
+   Returns the offset from the oldest byte, or -1 if it is not there.  */
+int RXB_find(const RXB_buffer *rx, byte_t value, int from);
+
+/* Function to look at a byte, without taking it.
+   Argument offset is from the oldest byte, and must be less than count. */
+byte_t RXB_peek(const RXB_buffer *rx, int offset);
+
+/* Function to copy bytes from the buffer, without taking them.
+   Arguments: rx - the buffer, offset - offset from the oldest byte,
+              dest - array for the bytes, n - number of bytes to copy,
+              with offset + n no more than count.  */
+void RXB_copy(const RXB_buffer *rx, int offset, byte_t *dest, int n);
+
+/* Function to copy bytes from the buffer, as RXB_copy, and add them to
+   a check value in the same pass (see CHK_copy).
+   Argument check is the check value so far.  */
+void RXB_copyCheck(const RXB_buffer *rx, int offset, byte_t *dest, int n,
+                   CHK_state *check);
+
+/* Function to take the oldest bytes from the buffer.
+   Arguments: rx - the buffer, dest - array for the bytes,
+              n - number of bytes to take, no more than count.  */
+void RXB_take(RXB_buffer *rx, byte_t *dest, int n);
+
+/* Function to discard the oldest bytes in the buffer. */
+void RXB_drop(RXB_buffer *rx, int n);
+
+#endif // RXBUFFER_H_INCLUDED
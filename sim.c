@@ -0,0 +1,234 @@
+/*  Discrete-event simulation with virtual time.
+       SIM_run     runs tasks in virtual time until they finish
+       SIM_wait    makes the running task wait for a virtual time
+       SIM_wake    brings forward the wake-up time of a waiting task
+    Each task is a thread, but a task only runs when the scheduler hands
+    it the turn, so only one runs at a time.  The order of events depends
+    only on the virtual times, never on the real time taken.
+    See sim.h for more details.  */
+
+#include <stdio.h>    // needed for printf
+#include <pthread.h>  // for threads, mutex and condition variables
+#include "sim.h"      // header file for functions in this file
+
+// States of a task
+#define TASK_RUNNING 0  // has the turn
+#define TASK_WAITING 1  // waiting for a virtual time, or to be woken
+#define TASK_DONE 2     // finished
+
+// Everything about one task
+typedef struct
+{
+    SIM_task func;       // task function
+    void *arg;           // argument for it
+    int number;          // number of this task
+    int state;           // TASK_RUNNING, TASK_WAITING or TASK_DONE
+    long long wakeAt;    // virtual time to wake, or SIM_FOREVER
+    long waitOrder;      // order of waiting, so equal wake times go in turn
+    pthread_t thread;    // thread running the task
+    pthread_cond_t turn; // signalled when the task gets the turn
+} simTask;
+
+/* Creating a variable this way allows it to be shared
+   by the functions in this file only.  One lock protects it all. */
+static pthread_mutex_t simLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t allDone = PTHREAD_COND_INITIALIZER;  // for SIM_run
+static simTask tasks[SIM_MAXTASKS];  // the tasks
+static int nTasksRun = 0;       // number of tasks in the simulation
+static int running = -1;        // number of the task with the turn, or -1
+static int stuck = 0;           // set if no task can run
+static long long simTime = 0;   // the virtual time, in us
+static long nWaits = 0;         // count of waits, for waitOrder
+static _Thread_local int self = -1;  // number of the task in this thread
+
+/* Helper function to give the turn to the next task, called with the lock
+   held by the task giving up the turn.  The next task is the one waiting
+   with the earliest wake-up time; the virtual time moves on to that time.
+   If no task can run, the simulation is finished (or stuck).  */
+static void schedule(void)
+{
+    int i, next = -1;
+    simTask *t;
+
+    for (i = 0; i < nTasksRun; i++)
+    {
+        t = &tasks[i];
+        if ((t->state != TASK_WAITING) || (t->wakeAt == SIM_FOREVER)) continue;
+        if ((next < 0) || (t->wakeAt < tasks[next].wakeAt)
+            || ((t->wakeAt == tasks[next].wakeAt)
+                && (t->waitOrder < tasks[next].waitOrder)))
+            next = i;
+    }
+
+    running = next;
+    if (next >= 0)
+    {
+        if (tasks[next].wakeAt > simTime) simTime = tasks[next].wakeAt;
+        tasks[next].state = TASK_RUNNING;
+        pthread_cond_signal(&tasks[next].turn);
+        return;
+    }
+
+    // Nobody can run - check if any task is still waiting
+    for (i = 0; i < nTasksRun; i++)
+        if (tasks[i].state != TASK_DONE) stuck = 1;
+    pthread_cond_signal(&allDone);
+}
+
+// Helper function to let go of the lock, if a task is cancelled while waiting.
+static void unlockSim(void *arg)
+{
+    (void) arg;
+    pthread_mutex_unlock(&simLock);
+}
+
+/* Helper function to wait, with the lock held, until this task has the turn.
+   The wait is where a stuck task is cancelled, by SIM_run.  */
+static void waitTurn(simTask *t)
+{
+    pthread_cleanup_push(unlockSim, NULL);
+    while (running != t->number)
+        pthread_cond_wait(&t->turn, &simLock);
+    pthread_cleanup_pop(0);
+}
+
+// Thread function that runs one task when it is given the turn.
+static void *taskThread(void *arg)
+{
+    simTask *t = (simTask *) arg;
+
+    pthread_mutex_lock(&simLock);
+    waitTurn(t);
+    pthread_mutex_unlock(&simLock);
+
+    self = t->number;
+    t->func(t->arg);  // run the task
+    self = -1;
+
+    pthread_mutex_lock(&simLock);
+    t->state = TASK_DONE;
+    schedule();  // give the turn to another task
+    pthread_mutex_unlock(&simLock);
+    return NULL;
+}
+
+//===================================================================
+/* Function to run tasks in virtual time, starting at time 0.
+   All tasks start at time 0, in order of their number.
+   Returns 0 if all went well, negative if the tasks got stuck.  */
+int SIM_run(int nTasks, SIM_task funcs[], void *args[])
+{
+    int i;
+
+    if ((nTasks <= 0) || (nTasks > SIM_MAXTASKS))
+    {
+        printf("SIM: Cannot run %d tasks, limit %d\n", nTasks, SIM_MAXTASKS);
+        return -1;
+    }
+
+    pthread_mutex_lock(&simLock);
+    nTasksRun = nTasks;
+    simTime = 0;
+    nWaits = 0;
+    stuck = 0;
+    running = -1;
+    for (i = 0; i < nTasks; i++)
+    {
+        tasks[i].func = funcs[i];
+        tasks[i].arg = args[i];
+        tasks[i].number = i;
+        tasks[i].state = TASK_WAITING;  // all wake at time 0
+        tasks[i].wakeAt = 0;
+        tasks[i].waitOrder = nWaits++;
+        pthread_cond_init(&tasks[i].turn, NULL);
+        pthread_create(&tasks[i].thread, NULL, taskThread, &tasks[i]);
+    }
+
+    // Give the first task the turn, then wait until nobody can run
+    schedule();
+    while (running >= 0)
+        pthread_cond_wait(&allDone, &simLock);
+    pthread_mutex_unlock(&simLock);
+
+    /* Tasks that are stuck can never run, so cancel them where they wait.
+       Every thread is joined before its condition variable is destroyed,
+       so the next SIM_run does not set up one that a thread still uses.  */
+    if (stuck)
+    {
+        printf("SIM: Tasks stuck at %.6f s - all waiting with no time limit\n",
+               simTime / 1.0e6);
+        for (i = 0; i < nTasks; i++)
+            if (tasks[i].state != TASK_DONE) pthread_cancel(tasks[i].thread);
+    }
+
+    for (i = 0; i < nTasks; i++)
+    {
+        pthread_join(tasks[i].thread, NULL);
+        pthread_cond_destroy(&tasks[i].turn);
+    }
+    nTasksRun = 0;
+    return stuck ? -2 : 0;
+}
+
+//===================================================================
+// Function to check if the simulation is running, in this thread.
+int SIM_active(void)
+{
+    return (self >= 0);
+}
+
+//===================================================================
+// Function to get the virtual time, in microseconds.
+long long SIM_now(void)
+{
+    long long now;
+    pthread_mutex_lock(&simLock);
+    now = simTime;
+    pthread_mutex_unlock(&simLock);
+    return now;
+}
+
+//===================================================================
+// Function to get the number of the task running in this thread.
+int SIM_self(void)
+{
+    return self;
+}
+
+//===================================================================
+/* Function to make the running task wait, and let other tasks run.
+   Returns at the wake-up time, or earlier if woken by another task. */
+void SIM_wait(long long untilUs)
+{
+    simTask *t;
+
+    if (self < 0) return;  // not in a simulation
+    t = &tasks[self];
+
+    pthread_mutex_lock(&simLock);
+    t->state = TASK_WAITING;
+    t->wakeAt = untilUs;
+    if ((untilUs != SIM_FOREVER) && (untilUs < simTime)) t->wakeAt = simTime;
+    t->waitOrder = nWaits++;
+    schedule();  // give the turn to the task due first - may be this one
+    waitTurn(t);
+    pthread_mutex_unlock(&simLock);
+}
+
+//===================================================================
+/* Function to make sure a waiting task wakes up no later than a given time.
+   The task does not run until the running task waits or finishes. */
+void SIM_wake(int task, long long atUs)
+{
+    simTask *t;
+
+    if ((task < 0) || (task >= nTasksRun)) return;
+    t = &tasks[task];
+
+    pthread_mutex_lock(&simLock);
+    if (atUs < simTime) atUs = simTime;  // cannot wake in the past
+    if ((t->state == TASK_WAITING)
+        && ((t->wakeAt == SIM_FOREVER) || (atUs < t->wakeAt)))
+        t->wakeAt = atUs;
+    pthread_mutex_unlock(&simLock);
+}
@@ -0,0 +1,53 @@
+#ifndef SIM_H_INCLUDED
+#define SIM_H_INCLUDED
+
+/*  Discrete-event simulation with virtual time.
+    SIM_run runs several tasks, for example the sender and receiver ends
+    of a link, as threads - but only one task runs at a time, so the
+    results are the same every time.  While the simulation runs, time is
+    virtual: PHY_timeUs returns the virtual time, and waiting (in waitms,
+    or for bytes on the loopback channel) does not take real time.
+    When the running task has to wait, the task that is due to wake
+    first is run next, and the virtual time jumps to its wake-up time.
+    This version uses POSIX threads.  */
+
+#define SIM_MAXTASKS 8   // maximum number of tasks in a simulation
+#define SIM_FOREVER (-1LL)  // wake-up time for a task with no time limit
+
+// Type for a task function: it is given its argument, returns nothing
+typedef void (*SIM_task)(void *arg);
+
+/* Function to run tasks in virtual time, starting at time 0.
+   Arguments: nTasks - number of tasks,
+              tasks - array of task functions,
+              args - array of arguments, one for each task.
+   Returns when all the tasks have finished: 0 if all went well, or
+   negative if the tasks got stuck, all waiting with no time limit.
+   Stuck tasks are cancelled where they wait, so SIM_run can be used
+   again, but anything they had open (such as a link) is left open.  */
+int SIM_run(int nTasks, SIM_task tasks[], void *args[]);
+
+/* Function to check if the simulation is running, in this thread.
+   Returns TRUE (1) in a simulation task, FALSE (0) otherwise. */
+int SIM_active(void);
+
+/* Function to get the virtual time, in microseconds. */
+long long SIM_now(void);
+
+/* Function to get the number of the task running, 0 to nTasks-1,
+   or -1 if not in a simulation task. */
+int SIM_self(void);
+
+/* Function to make the running task wait, and let other tasks run.
+   Argument: untilUs - virtual time to wake up, or SIM_FOREVER to wait
+             until woken by another task using SIM_wake.
+   Returns at the wake-up time, or earlier if woken by another task. */
+void SIM_wait(long long untilUs);
+
+/* Function to make sure a waiting task wakes up no later than a given time.
+   Arguments: task - the number of the task to wake,
+              atUs - the virtual time it should wake, at the latest.
+   The task does not run until the running task waits or finishes. */
+void SIM_wake(int task, long long atUs);
+
+#endif // SIM_H_INCLUDED
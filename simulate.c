@@ -0,0 +1,595 @@
+/* Simulation program for the link layer protocol.
+   It runs the sender and the receiver in this program, as two tasks in
+   virtual time (see sim.h), joined by the loopback channel.  Time jumps
+   from one event to the next, so a transfer that would take minutes on
+   a real line takes a fraction of a second, and gives the same result
+   every time.  It can repeat the transfer for every combination of bit
+   rate, block size, framing mode, checksum, ARQ mode, FEC mode, HARQ
+   setting and error model given, and
+   prints one line of results for each run, including the number of
+   blocks delivered with wrong data (errors the checksum missed), and
+   the sender's smoothed round trip time and retransmission timeout
+   at the end, in ms, and the block size at the end, the bytes
+   corrected by FEC, whether the sender was using FEC at the end, the
+   average time interleaving held back each codeword, in ms, and the bad
+   frames put right by combining copies.  Each
+   run has its own seed, shown in the results, which makes the errors
+   and, if no file is given, the random data.  So a run that fails can
+   be repeated exactly, with all the link layer messages, by giving its
+   settings with -s seed -n 1 -v - the options to do this are printed
+   after each run that fails.
+
+   Usage: simulate [options]
+     -f file    file to send (default: 10000 random bytes, made from
+                the seed for each run)
+     -r list    bit rates, e.g. 1200,4800,9600 (default BIT_RATE)
+     -b list    block sizes, e.g. 64,128,212 (default OPT_BLK), with
+                +adapt after a size to start there and let the link
+                layer adjust it, e.g. 212,212+adapt
+     -m list    framing modes, e.g. plain,stuff,cobs (default FRAMING),
+                with +hcs after a mode to add the header check byte,
+                e.g. plain,plain+hcs
+     -k list    checksums, e.g. sum250,crc16,crc32 (default CHECKSUM)
+     -a list    ARQ modes, sw (stop-and-wait), gbn (go-back-N) or sr
+                (selective repeat), with the window after gbn or sr,
+                e.g. sw,gbn:4,sr:16 (default ARQ, window WINDOW)
+     -x list    FEC modes, off, on or auto, with the interleaving depth
+                after on or auto, e.g. off,on:1,auto:8 (default FEC,
+                depth INTERLEAVE)
+     -y list    combining copies of bad frames (HARQ), off or on, e.g.
+                off,on (default HARQ)
+     -e model   error model on receive at both ends, as for PHY_RXERR,
+                e.g. 1e-4 or ge:1e-6,1e-2,1e-5,1e-3 - repeat for more
+                models (default PROB_ERR)
+     -c chan    channel emulator on receive at both ends, as for PHY_EMU,
+                e.g. delay=200,drop=1e-4 - repeat for more (default none)
+     -n runs    runs of each combination, each with a new seed (default 1)
+     -s seed    seed for the first run (default 1)
+     -v         show all the messages from the link layer
+
+   The application protocol is the same as in filetransfer.c, without
+   the file name block.  This program uses POSIX threads.  */
+
+#define _POSIX_C_SOURCE 200809L  // needed for getopt, dup and fdopen
+
+#include <stdio.h>      // standard input-output library
+#include <stdlib.h>     // for malloc, atoi, strtoull
+#include <string.h>     // for memcpy and memcmp
+#include <unistd.h>     // for dup, to keep the real output
+#include "linklayer.h"  // link layer functions
+#include "phydriver.h"  // to choose the loopback driver and errors
+#include "errmodel.h"   // error models
+#include "emulator.h"   // channel emulator
+#include "sim.h"        // virtual-time simulation
+
+#define FILEDATA 234    // header value for data
+#define FILEEND 235     // header value to mark end of file
+#define DEF_SIZE 10000  // size of random data if no file given
+#define MAX_LIST 64     // most values in each list
+#define PORTSIM 1       // port number, used to name the loopback channel
+
+static const char *const fecNames[] = { "off", "on", "auto" }; // FEC modes, by number
+
+// Everything about one run, shared by the two tasks
+typedef struct
+{
+    const byte_t *data;    // data to send
+    long size;             // number of bytes to send
+    LL_options options;    // link layer settings
+    ERR_config errors;     // error model for both ends
+    EMU_config channel;    // channel emulator for both ends
+    uint64_t seedTX;       // seed for errors at sending end
+    uint64_t seedRX;       // seed for errors at receiving end
+    int debug;             // controls printing in link layer
+    int sendResult;        // 0 for success, negative for failure
+    int recvResult;        // 0 for success, negative for failure
+    long received;         // number of bytes received correctly
+    int corrupt;           // number of blocks delivered with wrong data
+    LL_stats sendStats;    // counters from the sending end
+    LL_stats recvStats;    // counters from the receiving end
+} simRun;
+
+/* Task function for the sending end: sends the data in blocks of the
+   optimum size, then an end block.  If the link layer adjusts the
+   block size, it asks for it again before each block.  */
+static void sender(void *arg)
+{
+    simRun *run = (simRun *) arg;
+    byte_t block[MAX_BLK];  // block to send
+    int sizeDataBlk;        // number of data bytes per block
+    long pos = 0;           // position in the data
+    int n;                  // bytes in this block
+    int retVal;             // return value from functions
+
+    LL_setOptions(&run->options);
+    PHY_setErrorDefaults(&run->errors, NULL, run->seedTX);
+    PHY_setEmulatorDefaults(&run->channel);
+    retVal = LL_connect(PORTSIM, run->debug);
+    if (retVal < 0)
+    {
+        run->sendResult = retVal;
+        return;
+    }
+    sizeDataBlk = LL_getOptBlockSize() - 1;  // allow for header byte
+
+    do  // loop block by block
+    {
+        if (run->options.adaptBlock)
+            sizeDataBlk = LL_getOptBlockSize() - 1;
+        n = (run->size - pos < sizeDataBlk) ? (int)(run->size - pos) : sizeDataBlk;
+        block[0] = (byte_t) FILEDATA;
+        memcpy(block + 1, run->data + pos, n);
+        pos += n;
+        retVal = LL_send_LLC(block, n + 1);
+    }
+    while ((retVal == 0) && (pos < run->size));
+
+    if (retVal == 0)  // send the end block
+    {
+        block[0] = (byte_t) FILEEND;
+        retVal = LL_send_LLC(block, 1);
+    }
+    if ((LL_discon() < 0) && (retVal == 0))  // blocks not acknowledged (go-back-N)
+        retVal = FAILURE;
+    LL_getStats(&run->sendStats);
+    run->sendResult = retVal;
+}
+
+/* Task function for the receiving end: receives blocks until the end
+   block, and counts the bytes that match the data sent.  */
+static void receiver(void *arg)
+{
+    simRun *run = (simRun *) arg;
+    byte_t block[MAX_BLK];  // block received
+    long pos = 0;           // position in the data
+    int nByte;              // bytes in this block
+    int ok = TRUE;          // cleared if the data is wrong
+
+    LL_setOptions(&run->options);
+    PHY_setErrorDefaults(&run->errors, NULL, run->seedRX);
+    PHY_setEmulatorDefaults(&run->channel);
+    nByte = LL_connect(PORTSIM, run->debug);
+    if (nByte < 0)
+    {
+        run->recvResult = nByte;
+        return;
+    }
+
+    do  // loop block by block
+    {
+        nByte = LL_receive_LLC(block, MAX_BLK);
+        if ((nByte > 0) && (block[0] == FILEDATA))
+        {
+            nByte--;  // data bytes, after the header
+            if ((pos + nByte > run->size)
+                || (memcmp(block + 1, run->data + pos, nByte) != 0))
+            {
+                ok = FALSE;  // wrong data, but carry on to the end
+                run->corrupt++;
+            }
+            pos += nByte;
+        }
+        else if ((nByte > 0) && (block[0] == FILEEND))
+            nByte = -1;  // fake value to end loop
+    }
+    while (nByte >= 0);  // repeat until problem or end marker
+
+    LL_discon();
+    LL_getStats(&run->recvStats);
+    run->received = ok ? pos : 0;
+    run->recvResult = (nByte < -1) ? nByte : 0;
+}
+
+/* Function to read a list of numbers separated by commas.
+   Returns the number of values, or 0 if the list is not valid.  */
+static int readList(const char *text, int *values)
+{
+    int n = 0;
+    char *end;
+    do
+    {
+        if (n >= MAX_LIST) return 0;
+        values[n] = (int) strtol(text, &end, 10);
+        if ((end == text) || (values[n] <= 0)) return 0;
+        n++;
+        text = end + 1;
+    }
+    while (*end == ',');
+    return (*end == '\0') ? n : 0;
+}
+
+/* Function to read a list of block sizes separated by commas, each one
+   with +adapt after it if the link layer is to adjust it.
+   Returns the number of sizes, or 0 if the list is not valid.  */
+static int readBlocks(const char *text, int *values, int *adapts)
+{
+    int n = 0;
+    char *end;
+    do
+    {
+        if (n >= MAX_LIST) return 0;
+        values[n] = (int) strtol(text, &end, 10);
+        if ((end == text) || (values[n] <= 0)) return 0;
+        adapts[n] = (strncmp(end, "+adapt", 6) == 0);
+        if (adapts[n]) end += 6;
+        n++;
+        text = end + 1;
+    }
+    while (*end == ',');
+    return (*end == '\0') ? n : 0;
+}
+
+/* Function to split a list of names separated by commas.
+   Returns the number of names, or 0 if the list is not valid.  */
+static int readNames(const char *text, char (*names)[16])
+{
+    int n = 0;
+    size_t len;
+    do
+    {
+        len = strcspn(text, ",");
+        if ((n >= MAX_LIST) || (len >= sizeof(names[n]))) return 0;
+        memcpy(names[n], text, len);
+        names[n][len] = '\0';
+        n++;
+        text += len;
+    }
+    while (*text++ == ',');
+    return n;
+}
+
+/* Function to read a list of framing mode names separated by commas,
+   each one with +hcs after it if the header check is to be used.
+   Returns the number of modes, or 0 if the list is not valid.  */
+static int readModes(const char *text, int *modes, int *checks)
+{
+    char names[MAX_LIST][16];  // the names in the list
+    int n = readNames(text, names);
+    size_t len;
+    for (int i = 0; i < n; i++)
+    {
+        len = strlen(names[i]);
+        checks[i] = (len > 4) && (strcmp(names[i] + len - 4, "+hcs") == 0);
+        if (checks[i]) names[i][len - 4] = '\0';
+        modes[i] = FRM_parse(names[i]);
+        if (modes[i] < 0) return 0;
+    }
+    return n;
+}
+
+/* Function to read a list of ARQ modes separated by commas: sw, or
+   gbn or sr followed by :window (alone, they use the default window).
+   Returns the number of modes, or 0 if the list is not valid.  */
+static int readArqs(const char *text, int *arqs, int *windows)
+{
+    char names[MAX_LIST][16];  // the names in the list
+    int n = readNames(text, names);
+    size_t len;
+    char *end;
+    for (int i = 0; i < n; i++)
+    {
+        windows[i] = WINDOW;
+        if (strcmp(names[i], "sw") == 0)
+            arqs[i] = ARQ_STOPWAIT;
+        else
+        {
+            len = strcspn(names[i], ":");
+            if ((len == 3) && (strncmp(names[i], "gbn", 3) == 0))
+                arqs[i] = ARQ_GOBACKN;
+            else if ((len == 2) && (strncmp(names[i], "sr", 2) == 0))
+                arqs[i] = ARQ_SELECTIVE;
+            else return 0;
+            if (names[i][len] == ':')
+            {
+                windows[i] = (int) strtol(names[i] + len + 1, &end, 10);
+                if ((*end != '\0') || (windows[i] < 1) || (windows[i] > MAX_WINDOW)) return 0;
+            }
+        }
+    }
+    return n;
+}
+
+/* Function to read a list of FEC modes separated by commas: off, or
+   on or auto followed by :depth (alone, they use the default depth).
+   Returns the number of modes, or 0 if the list is not valid.  */
+static int readFecs(const char *text, int *fecs, int *depths)
+{
+    char names[MAX_LIST][16];  // the names in the list
+    int n = readNames(text, names);
+    size_t len;
+    char *end;
+    for (int i = 0; i < n; i++)
+    {
+        depths[i] = INTERLEAVE;
+        len = strcspn(names[i], ":");
+        for (fecs[i] = FEC_AUTO; fecs[i] >= FEC_OFF; fecs[i]--)
+            if ((strlen(fecNames[fecs[i]]) == len)
+                && (strncmp(names[i], fecNames[fecs[i]], len) == 0)) break;
+        if (fecs[i] < FEC_OFF) return 0;
+        if (names[i][len] == ':')
+        {
+            depths[i] = (int) strtol(names[i] + len + 1, &end, 10);
+            if ((fecs[i] == FEC_OFF) || (*end != '\0') || (depths[i] < 1) || (depths[i] > MAX_DEPTH))
+                return 0;
+        }
+    }
+    return n;
+}
+
+/* Function to read a list of HARQ settings separated by commas: off or on.
+   Returns the number of settings, or 0 if the list is not valid.  */
+static int readHarqs(const char *text, int *harqs)
+{
+    char names[MAX_LIST][16];  // the names in the list
+    int n = readNames(text, names);
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(names[i], "off") == 0) harqs[i] = FALSE;
+        else if (strcmp(names[i], "on") == 0) harqs[i] = TRUE;
+        else return 0;
+    }
+    return n;
+}
+
+/* Function to read a list of checksum names separated by commas.
+   Returns the number of checksums, or 0 if the list is not valid.  */
+static int readChecksums(const char *text, int *algs)
+{
+    char names[MAX_LIST][16];  // the names in the list
+    int n = readNames(text, names);
+    for (int i = 0; i < n; i++)
+    {
+        algs[i] = CHK_parse(names[i]);
+        if (algs[i] < 0) return 0;
+    }
+    return n;
+}
+
+// Function to fill the data to send with random bytes, using rng.
+static void makeData(byte_t *data, long size, uint64_t *rng)
+{
+    long i;
+    for (i = 0; i < size; i++)
+        data[i] = (byte_t) ERR_random(rng);
+}
+
+// Function to read the whole of a file.  Returns NULL on failure.
+static byte_t *readFile(const char *fName, long *size)
+{
+    FILE *fpi = fopen(fName, "rb");
+    byte_t *data;
+    if (fpi == NULL)
+    {
+        perror("SIM: Failed to open input file");
+        return NULL;
+    }
+    fseek(fpi, 0, SEEK_END);
+    *size = ftell(fpi);
+    rewind(fpi);
+    data = (byte_t *) malloc(*size + 1);
+    if ((data == NULL) || ((long) fread(data, 1, *size, fpi) != *size))
+    {
+        printf("SIM: Failed to read %s\n", fName);
+        free(data);
+        data = NULL;
+    }
+    fclose(fpi);
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    int rates[MAX_LIST] = { BIT_RATE };  // bit rates to use
+    int blocks[MAX_LIST] = { OPT_BLK };  // block sizes to use
+    int adapts[MAX_LIST] = { FALSE };    // whether the link layer adjusts each one
+    int framings[MAX_LIST] = { FRAMING }; // framing modes to use
+    int checks[MAX_LIST] = { HEADER_CHECK }; // header check with each mode
+    int checksums[MAX_LIST] = { CHECKSUM };  // checksums to use
+    int arqs[MAX_LIST] = { ARQ };            // ARQ modes to use
+    int windows[MAX_LIST] = { WINDOW };      // window with each ARQ mode
+    int fecs[MAX_LIST] = { FEC };            // FEC modes to use
+    int depths[MAX_LIST] = { INTERLEAVE };   // interleaving depth with each FEC mode
+    int harqs[MAX_LIST] = { HARQ };          // HARQ settings to use
+    const char *models[MAX_LIST] = { NULL };  // error models to use
+    const char *chans[MAX_LIST] = { "none" }; // channel emulator settings
+    int nRates = 1, nBlocks = 1, nFramings = 1, nChecksums = 1, nArqs = 1, nFecs = 1, nHarqs = 1, nModels = 0, nChans = 0;  // number of each
+    ERR_config errors[MAX_LIST];  // error models, after reading
+    EMU_config channels[MAX_LIST]; // channel emulators, after reading
+    char defModel[32];            // default error model, from PROB_ERR
+    const char *fName = NULL;     // file to send, or NULL
+    byte_t *data;                 // data to send
+    long size = DEF_SIZE;         // number of bytes to send
+    long nRuns = 1;               // runs of each combination
+    uint64_t seed = 1;            // seed for the next run
+    uint64_t rng;                 // to make seeds for each end
+    int verbose = FALSE;          // show link layer messages
+    FILE *results = stdout;       // where the results go
+    SIM_task tasks[2] = { sender, receiver };
+    void *args[2];
+    LL_options defaults;          // link layer settings not changed here
+    char frame[16];               // name of the framing mode, for the results
+    char arq[16];                 // name of the ARQ mode, for the results
+    char fec[16];                 // name of the FEC mode, for the results
+    char block[16];               // block size, for the results
+    char replay[512];             // options to repeat the run
+    simRun run;
+    long i, k, nCombos, nFailed = 0;
+    int r, b, f, s, a, x, y, m, c, opt, ok;
+
+    // Read the options
+    while ((opt = getopt(argc, argv, "f:r:b:m:k:a:x:y:e:c:n:s:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': fName = optarg; break;
+            case 'r': nRates = readList(optarg, rates); break;
+            case 'b': nBlocks = readBlocks(optarg, blocks, adapts); break;
+            case 'm': nFramings = readModes(optarg, framings, checks); break;
+            case 'k': nChecksums = readChecksums(optarg, checksums); break;
+            case 'a': nArqs = readArqs(optarg, arqs, windows); break;
+            case 'x': nFecs = readFecs(optarg, fecs, depths); break;
+            case 'y': nHarqs = readHarqs(optarg, harqs); break;
+            case 'e':
+                if (nModels < MAX_LIST) models[nModels++] = optarg;
+                break;
+            case 'c':
+                if (nChans < MAX_LIST) chans[nChans++] = optarg;
+                break;
+            case 'n': nRuns = atol(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'v': verbose = TRUE; break;
+            default: nRuns = 0; break;
+        }
+    }
+    if ((nRates == 0) || (nBlocks == 0) || (nFramings == 0) || (nChecksums == 0) || (nArqs == 0)
+        || (nFecs == 0) || (nHarqs == 0) || (nRuns <= 0)
+        || (optind < argc))
+    {
+        printf("Usage: %s [-f file] [-r rates] [-b blocks] [-m modes] [-k checks] [-a arqs] [-x fecs] [-y harqs] [-e model]... "
+               "[-c chan]... [-n runs] [-s seed] [-v]\n", argv[0]);
+        return 1;
+    }
+    if (nModels == 0)  // use the link layer setting
+    {
+        snprintf(defModel, sizeof(defModel), "%g", PROB_ERR);
+        models[nModels++] = defModel;
+    }
+    for (m = 0; m < nModels; m++)
+    {
+        if (ERR_parse(models[m], &errors[m]) != 0)
+        {
+            printf("SIM: Invalid error model |%s|\n", models[m]);
+            return 1;
+        }
+    }
+    if (nChans == 0) nChans = 1;  // no emulator
+    for (c = 0; c < nChans; c++)
+    {
+        if (EMU_parse(chans[c], &channels[c]) != 0)
+        {
+            printf("SIM: Invalid channel emulator settings |%s|\n", chans[c]);
+            return 1;
+        }
+    }
+
+    // Get the data to send
+    if (fName != NULL) data = readFile(fName, &size);
+    else data = (byte_t *) malloc(size);  // filled for each run, below
+    if (data == NULL) return 2;
+
+    // Both ends use the loopback channel
+    if (PHY_selectDriver("loopback", "sim") != 0) return 3;
+
+    /* The link layer prints a lot, so unless asked for, its messages are
+       thrown away, and the results are written to the real output.  */
+    if (!verbose)
+    {
+        fflush(stdout);
+        results = fdopen(dup(fileno(stdout)), "w");
+        if ((results == NULL) || (freopen("/dev/null", "w", stdout) == NULL))
+        {
+            fprintf(stderr, "SIM: Cannot redirect output\n");
+            return 4;
+        }
+    }
+
+    fprintf(results, "%8s %10s %-10s %-10s %-8s %-7s %-4s %-24s %-24s %20s %6s %10s %10s %7s %6s %5s %5s %5s %7s %7s %6s %6s %6s %7s %5s\n",
+            "rate", "block", "frame", "check", "arq", "fec", "harq", "errors", "channel", "seed", "result", "time",
+            "goodput", "effic%", "frames", "bad", "tmout", "corr", "rtt_ms", "rto_ms", "blkend",
+            "fixed", "fecend", "ilv_ms", "comb");
+
+    // Run every combination, nRuns times, each run with the next seed
+    LL_getOptions(&defaults);
+    nCombos = (long) nRates * nBlocks * nFramings * nChecksums * nArqs * nFecs * nHarqs * nModels * nChans;
+    for (k = 0; k < nCombos * nRuns; k++, seed++)
+    {
+        i = k / nRuns;  // number of the combination, split into its parts
+        c = (int)(i % nChans);
+        m = (int)(i / nChans % nModels);
+        y = (int)(i / nChans / nModels % nHarqs);
+        x = (int)(i / nChans / nModels / nHarqs % nFecs);
+        a = (int)(i / nChans / nModels / nHarqs / nFecs % nArqs);
+        s = (int)(i / nChans / nModels / nHarqs / nFecs / nArqs % nChecksums);
+        f = (int)(i / nChans / nModels / nHarqs / nFecs / nArqs / nChecksums % nFramings);
+        b = (int)(i / nChans / nModels / nHarqs / nFecs / nArqs / nChecksums / nFramings % nBlocks);
+        r = (int)(i / nChans / nModels / nHarqs / nFecs / nArqs / nChecksums / nFramings / nBlocks);
+
+        memset(&run, 0, sizeof(run));
+        run.data = data;
+        run.size = size;
+        run.options = defaults;
+        run.options.bitRate = rates[r];
+        run.options.optBlock = blocks[b];
+        run.options.adaptBlock = adapts[b];
+        run.options.framing = framings[f];
+        run.options.headerCheck = checks[f];
+        run.options.checksum = checksums[s];
+        run.options.arq = arqs[a];
+        run.options.window = windows[a];
+        run.options.fec = fecs[x];
+        run.options.interleave = depths[x];
+        run.options.harq = harqs[y];
+        snprintf(block, sizeof(block), "%d%s", blocks[b], adapts[b] ? "+adapt" : "");
+        snprintf(frame, sizeof(frame), "%s%s", FRM_name(framings[f]),
+                 checks[f] ? "+hcs" : "");
+        if (arqs[a] == ARQ_STOPWAIT)
+            snprintf(arq, sizeof(arq), "sw");
+        else
+            snprintf(arq, sizeof(arq), "%s:%d",
+                     (arqs[a] == ARQ_GOBACKN) ? "gbn" : "sr", windows[a]);
+        if (fecs[x] == FEC_OFF)
+            snprintf(fec, sizeof(fec), "off");
+        else
+            snprintf(fec, sizeof(fec), "%s:%d", fecNames[fecs[x]], depths[x]);
+        run.errors = errors[m];
+        run.channel = channels[c];
+        rng = seed;  // each end gets its own seed, made from the run seed,
+        run.seedTX = ERR_random(&rng);
+        run.seedRX = ERR_random(&rng);
+        if (fName == NULL) makeData(data, size, &rng);  // and so does the data
+        snprintf(replay, sizeof(replay), "%s -r %d -b %s -m %s -k %s -a %s -x %s -y %s -e %s -c %s%s%s -s %llu -n 1 -v",
+                 argv[0], rates[r], block, frame, CHK_name(checksums[s]), arq, fec,
+                 harqs[y] ? "on" : "off", models[m], chans[c],
+                 (fName != NULL) ? " -f " : "", (fName != NULL) ? fName : "",
+                 (unsigned long long) seed);
+        run.debug = verbose;
+        args[0] = &run;
+        args[1] = &run;
+
+        if (verbose)
+            printf("\nSIM: Run with rate %d, block %s, framing %s, checksum %s, ARQ %s, FEC %s, HARQ %s, errors %s, channel %s, seed %llu\n",
+                   rates[r], block, frame, CHK_name(checksums[s]), arq, fec, harqs[y] ? "on" : "off",
+                   models[m], chans[c],
+                   (unsigned long long) seed);
+        if (SIM_run(2, tasks, args) != 0)
+        {
+            fprintf(results, "SIM: Simulation stuck, seed %llu - to repeat: %s\n",
+                    (unsigned long long) seed, replay);
+            return 5;  // the stuck tasks left their links open, so give up
+        }
+
+        ok = (run.sendResult == 0) && (run.recvResult == 0) && (run.received == size);
+        if (!ok) nFailed++;
+        fprintf(results, "%8d %10s %-10s %-10s %-8s %-7s %-4s %-24s %-24s %20llu %6s %10.3f %10.1f %7.2f %6d %5d %5d %5d %7.1f %7.1f %6d %6d %6s %7.1f %5d\n",
+                rates[r], block, frame, CHK_name(checksums[s]), arq, fec, harqs[y] ? "on" : "off",
+                models[m], chans[c],
+                (unsigned long long) seed,
+                ok ? "ok" : "FAIL", run.sendStats.connTime,
+                (run.sendStats.connTime > 0.0) ? 8.0 * run.received / run.sendStats.connTime : 0.0,
+                (run.sendStats.connTime > 0.0)
+                    ? 800.0 * run.received / run.sendStats.connTime / rates[r] : 0.0,
+                run.sendStats.framesSent,
+                run.sendStats.badFrames + run.recvStats.badFrames,
+                run.sendStats.timeouts + run.recvStats.timeouts, run.corrupt,
+                1000.0 * run.sendStats.srtt, 1000.0 * run.sendStats.rto, run.sendStats.optBlock,
+                run.recvStats.fecFixed, run.sendStats.fecOn ? "on" : "off",
+                1000.0 * run.recvStats.ilvDelay,
+                run.sendStats.harqFrames + run.recvStats.harqFrames);
+        if (!ok) fprintf(results, "SIM: To repeat: %s\n", replay);
+        fflush(results);
+    }
+
+    fprintf(results, "SIM: %ld runs, %ld failed\n", nCombos * nRuns, nFailed);
+    free(data);
+    return (nFailed > 0) ? 6 : 0;
+}
@@ -0,0 +1,154 @@
+/*  Deadlines and timers, using the monotonic clock from PHY_timeUs.
+       TIM_deadline, TIM_passed, TIM_secondsLeft, TIM_msLeft
+                         work with deadlines
+       TIM_wheelInit, TIM_timerInit   set up a timer wheel and timers
+       TIM_arm, TIM_cancel   add and remove timers
+       TIM_nextExpired   finds timers that have expired
+       TIM_nextExpiry    finds when the next timer will expire
+    See timer.h for a description of the timer wheel.  */
+
+#include <stddef.h>     // for NULL
+#include <string.h>     // for memset
+#include "phydriver.h"  // for PHY_timeUs
+#include "timer.h"      // header file for functions in this file
+
+//===================================================================
+// Function to set a deadline at a time in the future.
+// Rounded to the nearest us, so a time left that has been through a
+// float still gives the same deadline, not one us short of it.
+long long TIM_deadline(double seconds)
+{
+    return PHY_timeUs() + (long long)(seconds * 1.0e6 + 0.5);
+}
+
+//===================================================================
+// Function to check if a deadline has passed.
+int TIM_passed(long long deadline)
+{
+    return PHY_timeUs() >= deadline;
+}
+
+//===================================================================
+// Function to find the time left before a deadline, in seconds.
+double TIM_secondsLeft(long long deadline)
+{
+    long long left = deadline - PHY_timeUs();
+    return (left > 0) ? left / 1.0e6 : 0.0;
+}
+
+//===================================================================
+// Function to find the time left before a deadline, in ms, rounded up.
+int TIM_msLeft(long long deadline)
+{
+    long long left = deadline - PHY_timeUs();
+    return (left > 0) ? (int)((left + 999) / 1000) : 0;
+}
+
+//===================================================================
+// Function to set up an empty timer wheel.
+void TIM_wheelInit(TIM_wheel *wheel, int tickMs)
+{
+    memset(wheel, 0, sizeof(TIM_wheel));
+    wheel->tickUs = (tickMs > 0) ? 1000LL * tickMs : 1000;
+    wheel->tick = PHY_timeUs() / wheel->tickUs;
+}
+
+//===================================================================
+// Function to set up a timer, not armed, with a number for the user.
+void TIM_timerInit(TIM_timer *timer, int id)
+{
+    memset(timer, 0, sizeof(TIM_timer));
+    timer->id = id;
+}
+
+//===================================================================
+/* Function to arm a timer, to expire at the time given.
+   A timer that expires before the tick already checked goes in the
+   slot for that tick, so it will be found on the next check.  */
+void TIM_arm(TIM_wheel *wheel, TIM_timer *timer, long long expiry)
+{
+    long long tick = expiry / wheel->tickUs;  // tick when it expires
+    TIM_timer **slot;
+
+    if (timer->armed) TIM_cancel(wheel, timer);
+    if (tick < wheel->tick) tick = wheel->tick;
+    timer->slot = (int)(tick & (TIM_SLOTS - 1));
+    slot = &wheel->slot[timer->slot];
+
+    // Put it at the front of the list for its slot
+    timer->expiry = expiry;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) (*slot)->prev = timer;
+    *slot = timer;
+    timer->armed = 1;
+    wheel->count++;
+}
+
+//===================================================================
+// Function to cancel a timer.  Does nothing if it is not armed.
+void TIM_cancel(TIM_wheel *wheel, TIM_timer *timer)
+{
+    if (!timer->armed) return;
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else  // first in its slot - the slot must point to the next one
+        wheel->slot[timer->slot] = timer->next;
+    if (timer->next != NULL) timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->armed = 0;
+    wheel->count--;
+}
+
+//===================================================================
+/* Function to find a timer that has expired by the time given, and
+   remove it from the wheel.  It checks the slots for each tick up to
+   now, at most one full rotation, then stays at the present tick,
+   as more timers may expire before it ends.
+   Returns the timer, or NULL if none has expired.  */
+TIM_timer *TIM_nextExpired(TIM_wheel *wheel, long long now)
+{
+    long long nowTick = now / wheel->tickUs;  // the present tick
+    TIM_timer *timer;
+
+    if (wheel->count == 0)  // nothing armed - just catch up
+    {
+        if (wheel->tick < nowTick) wheel->tick = nowTick;
+        return NULL;
+    }
+    if (nowTick - wheel->tick >= TIM_SLOTS)  // more than one rotation
+        wheel->tick = nowTick - TIM_SLOTS + 1;
+
+    while (1)
+    {
+        for (timer = wheel->slot[wheel->tick & (TIM_SLOTS - 1)];
+             timer != NULL; timer = timer->next)
+        {
+            if (timer->expiry <= now)  // expired - may be a later rotation
+            {
+                TIM_cancel(wheel, timer);
+                return timer;
+            }
+        }
+        if (wheel->tick >= nowTick) return NULL;
+        wheel->tick++;
+    }
+}
+
+//===================================================================
+/* Function to find when the next timer will expire.
+   This looks at every armed timer, so it is slower than the others.
+   Returns the time in us, or -1 if no timer is armed.  */
+long long TIM_nextExpiry(TIM_wheel *wheel)
+{
+    long long first = -1;
+    TIM_timer *timer;
+    int i;
+
+    for (i = 0; (i < TIM_SLOTS) && (wheel->count > 0); i++)
+        for (timer = wheel->slot[i]; timer != NULL; timer = timer->next)
+            if ((first < 0) || (timer->expiry < first))
+                first = timer->expiry;
+    return first;
+}
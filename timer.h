@@ -0,0 +1,88 @@
+#ifndef TIMER_H_INCLUDED
+#define TIMER_H_INCLUDED
+
+/*  Deadlines and timers, using the monotonic clock from PHY_timeUs.
+    The clock measures real time (or virtual time in a simulation), so
+    time limits are the same whether the program is busy or waiting.
+
+    A deadline is just the time, in microseconds, when a limit runs out.
+
+    A timer wheel holds many timers, for example one retransmission
+    timer for each frame waiting to be acknowledged.  The wheel is an
+    array of slots, one for each tick of time, used in rotation: a timer
+    goes in the slot for the tick when it expires, so arming and
+    cancelling a timer take the same time however many are armed.
+    Timers further ahead than one rotation share slots with earlier
+    ones, and are left in place until their time comes.  */
+
+#define TIM_SLOTS 256   // slots in a timer wheel, must be a power of 2
+
+// A timer, usually kept inside the structure it belongs to
+typedef struct TIM_timer
+{
+    struct TIM_timer *next;  // next timer in the same slot
+    struct TIM_timer *prev;  // previous timer in the same slot
+    long long expiry;        // time when it expires, in us
+    int slot;                // slot it is in, while armed
+    int armed;               // TRUE while it is in a wheel
+    int id;                  // for the user, e.g. a sequence number
+} TIM_timer;
+
+// A timer wheel
+typedef struct
+{
+    TIM_timer *slot[TIM_SLOTS];  // lists of timers, by tick of expiry
+    long long tickUs;            // length of one tick, in us
+    long long tick;              // tick checked up to, for expired timers
+    int count;                   // number of timers armed
+} TIM_wheel;
+
+/* Function to set a deadline at a time in the future.
+   Argument:  seconds - the time from now.
+   Returns the deadline, in microseconds on the PHY_timeUs clock.  */
+long long TIM_deadline(double seconds);
+
+/* Function to check if a deadline has passed.
+   Returns TRUE (1) if it has, FALSE (0) if not.  */
+int TIM_passed(long long deadline);
+
+/* Function to find the time left before a deadline.
+   Returns the time in seconds, or 0 if it has passed.  */
+double TIM_secondsLeft(long long deadline);
+
+/* Function to find the time left before a deadline, in ms, rounded up,
+   to use as a time limit for PHY_read or a poll.
+   Returns the time in ms, or 0 if it has passed.  */
+int TIM_msLeft(long long deadline);
+
+/* Function to set up an empty timer wheel.
+   Arguments: wheel - the wheel,
+              tickMs - length of one tick in ms, which is the
+              resolution of the wheel (timers expire up to one
+              tick late if TIM_nextExpired is only called once a tick).  */
+void TIM_wheelInit(TIM_wheel *wheel, int tickMs);
+
+/* Function to set up a timer, not armed, with a number for the user. */
+void TIM_timerInit(TIM_timer *timer, int id);
+
+/* Function to arm a timer, to expire at the time given.  If it is
+   already armed, it is moved to the new time.
+   Arguments: wheel - the wheel, timer - the timer,
+              expiry - the time, in us (e.g. from TIM_deadline).  */
+void TIM_arm(TIM_wheel *wheel, TIM_timer *timer, long long expiry);
+
+/* Function to cancel a timer.  Does nothing if it is not armed. */
+void TIM_cancel(TIM_wheel *wheel, TIM_timer *timer);
+
+/* Function to find a timer that has expired by the time given, and
+   remove it from the wheel.  Call it again until it returns NULL to
+   find all the expired timers.
+   Returns the timer, or NULL if none has expired.  */
+TIM_timer *TIM_nextExpired(TIM_wheel *wheel, long long now);
+
+/* Function to find when the next timer will expire, for example to
+   know how long to wait for a frame.
+   Returns the time in us, or -1 if no timer is armed.  */
+long long TIM_nextExpiry(TIM_wheel *wheel);
+
+#endif // TIMER_H_INCLUDED